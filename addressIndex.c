@@ -0,0 +1,339 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "addressIndex.h"
+
+#define INDEX_BATCH 4096   //Records decoded per y86DecodeBatch call
+#define QUERY_CHUNK 65536  //Listing bytes read per pread
+#define QUERY_LINE_MAX 256 //Longest listing line a query accepts
+
+//The header fields a query needs
+struct IndexHeader {
+  uint64_t count;         //Checkpoints in the file
+  uint64_t baseAddr;      //Address of the first decoded byte
+  uint64_t length;        //Bytes decoded
+  uint64_t listingLength; //Bytes of listing the index describes
+};
+
+static void putLE(uint8_t *p, uint64_t value, int n) {
+  for (int i = 0; i < n; i++) {
+    p[i] = (uint8_t)(value >> (8 * i));
+  }
+}
+
+static uint64_t getLE(const uint8_t *p, int n) {
+  uint64_t value = 0;
+  for (int i = n - 1; i >= 0; i--) {
+    value = value << 8 | p[i];
+  }
+  return value;
+}
+
+/* pwrite all n bytes at offset, retrying short and interrupted writes
+ */
+static int pwriteAll(int fd, const uint8_t *data, size_t n, off_t offset) {
+  while (n > 0) {
+    ssize_t wrote = pwrite(fd, data, n, offset);
+    if (wrote < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    data += wrote;
+    n -= (size_t)wrote;
+    offset += wrote;
+  }
+  return 0;
+}
+
+/* pread up to n bytes at offset, retrying short and interrupted reads
+ * Returns the number of bytes read (less than n only at the end of the file), -1 on error
+ */
+static ssize_t preadAll(int fd, void *data, size_t n, off_t offset) {
+  size_t done = 0;
+  while (done < n) {
+    ssize_t got = pread(fd, (char *)data + done, n - done, offset + (off_t)done);
+    if (got < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    if (got == 0) {
+      break;
+    }
+    done += (size_t)got;
+  }
+  return (ssize_t)done;
+}
+
+/* Write the listing of code[0..length), whose first byte lives at baseAddr,
+ * to out and an index of it to indexFd, which must be a regular file
+ * A checkpoint goes before every run of every items (INDEX_DEFAULT_EVERY if
+ * every is 0), with the listing offset counted from the first byte written
+ * to out. The listing is the one decodeMachineCode writes; it is rendered
+ * from y86DecodeBatch records so the cursor at each checkpoint comes for free.
+ * Returns 0 on success and -1 if the index or the listing could not be written
+ */
+int writeIndexedListing(struct OutBuffer *out, int indexFd, const uint8_t *code, size_t length,
+                        uint64_t baseAddr, unsigned every) {
+  struct Y86Record records[INDEX_BATCH];
+  struct Y86Cursor cursor;
+  struct OutBuffer index;
+  uint8_t header[INDEX_HEADER_SIZE];
+  uint64_t listed = 0, count = 0;
+  uint64_t lastLine = 0; //Offset of the last line written, which covers the silent halts after it
+  size_t left = 0; //Items before the next checkpoint
+
+  if (every == 0) {
+    every = INDEX_DEFAULT_EVERY;
+  }
+  if (openOutBuffer(&index, indexFd, OUT_BUFFER_SIZE) != 0) {
+    return -1;
+  }
+  memset(header, 0, sizeof(header));
+  writeOut(&index, (const char *)header, sizeof(header)); //Filled in at the end
+
+  y86InitCursor(&cursor);
+  while (cursor.pos < length) {
+    size_t n;
+    if (left == 0) {
+      uint8_t entry[INDEX_ENTRY_SIZE];
+      int silent = cursor.skipHalt && cursor.dataLeft == 0 && code[cursor.pos] == 0x00;
+      memset(entry, 0, sizeof(entry));
+      putLE(entry, baseAddr + cursor.pos, 8);
+      putLE(entry + 8, silent ? lastLine : listed, 8);
+      putLE(entry + 16, (uint64_t)cursor.dataLeft, 4);
+      entry[20] = (uint8_t)cursor.skipHalt;
+      writeOut(&index, (const char *)entry, sizeof(entry));
+      count++;
+      left = every;
+    }
+    n = y86DecodeBatch(code, length, baseAddr, &cursor, records, left < INDEX_BATCH ? left : INDEX_BATCH);
+    for (size_t i = 0; i < n; i++) {
+      char *p = reserveOut(out, Y86_LINE_MAX);
+      size_t lineLength = y86RenderRecord(&records[i], p);
+      commitOut(out, p + lineLength);
+      if (lineLength != 0) {
+        lastLine = listed;
+        listed += lineLength;
+      }
+    }
+    left -= n;
+  }
+  if (closeOutBuffer(&index) != 0) {
+    return -1;
+  }
+
+  memcpy(header, "Y86X", 4);
+  putLE(header + 4, INDEX_FILE_VERSION, 2);
+  putLE(header + 8, INDEX_ENTRY_SIZE, 4);
+  putLE(header + 12, every, 4);
+  putLE(header + 16, count, 8);
+  putLE(header + 24, baseAddr, 8);
+  putLE(header + 32, length, 8);
+  putLE(header + 40, listed, 8);
+  if (pwriteAll(indexFd, header, sizeof(header), 0) != 0) {
+    return -1;
+  }
+  if (out->error != 0) {
+    errno = out->error;
+    return -1;
+  }
+  return 0;
+}
+
+/* Read and check the header of an index file
+ * Returns 0 on success, -1 with errno set to EINVAL if fd holds no index
+ */
+static int readIndexHeader(int fd, struct IndexHeader *header) {
+  uint8_t raw[INDEX_HEADER_SIZE];
+  ssize_t got = preadAll(fd, raw, sizeof(raw), 0);
+
+  if (got < 0) {
+    return -1;
+  }
+  if (got != (ssize_t)sizeof(raw) || memcmp(raw, "Y86X", 4) != 0 || getLE(raw + 4, 2) != INDEX_FILE_VERSION ||
+      getLE(raw + 8, 4) != INDEX_ENTRY_SIZE) {
+    errno = EINVAL;
+    return -1;
+  }
+  header->count = getLE(raw + 16, 8);
+  header->baseAddr = getLE(raw + 24, 8);
+  header->length = getLE(raw + 32, 8);
+  header->listingLength = getLE(raw + 40, 8);
+  return 0;
+}
+
+/* Read checkpoint number i of an index
+ */
+static int readCheckpoint(int fd, uint64_t i, struct IndexCheckpoint *checkpoint) {
+  uint8_t entry[INDEX_ENTRY_SIZE];
+  ssize_t got = preadAll(fd, entry, sizeof(entry), (off_t)(INDEX_HEADER_SIZE + i * INDEX_ENTRY_SIZE));
+
+  if (got != (ssize_t)sizeof(entry)) {
+    if (got >= 0) {
+      errno = EINVAL; //The file is shorter than its header says
+    }
+    return -1;
+  }
+  checkpoint->address = getLE(entry, 8);
+  checkpoint->listingOffset = getLE(entry + 8, 8);
+  checkpoint->cursor.dataLeft = (int)getLE(entry + 16, 4);
+  checkpoint->cursor.skipHalt = entry[20];
+  checkpoint->cursor.pos = 0; //Set by the caller, which knows the base address
+  return 0;
+}
+
+/* Binary search the checkpoints of an index for the last one at or before
+ * address (the first one if address comes before all of them)
+ */
+static int searchCheckpoints(int fd, const struct IndexHeader *header, uint64_t address, struct IndexCheckpoint *checkpoint) {
+  uint64_t low = 0, high = header->count; //The answer is in [low, high)
+
+  while (high - low > 1) {
+    uint64_t middle = low + (high - low) / 2;
+    if (readCheckpoint(fd, middle, checkpoint) != 0) {
+      return -1;
+    }
+    if (checkpoint->address <= address) {
+      low = middle;
+    }
+    else {
+      high = middle;
+    }
+  }
+  if (readCheckpoint(fd, low, checkpoint) != 0) {
+    return -1;
+  }
+  checkpoint->cursor.pos = (size_t)(checkpoint->address - header->baseAddr);
+  return 0;
+}
+
+/* Find the checkpoint of the index in indexFd to start from for address
+ * checkpoint->cursor is ready to pass to y86DecodeBatch with the image the
+ * index was built from.
+ * Returns 0 on success and -1 if the index could not be read or is empty
+ */
+int findCheckpoint(int indexFd, uint64_t address, struct IndexCheckpoint *checkpoint) {
+  struct IndexHeader header;
+
+  if (readIndexHeader(indexFd, &header) != 0) {
+    return -1;
+  }
+  if (header.count == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  return searchCheckpoints(indexFd, &header, address, checkpoint);
+}
+
+/* Address at the start of a listing line, which is 16 hex digits and ':'
+ * Returns 0 on success and -1 if the line does not start that way
+ */
+static int lineAddress(const char *line, size_t n, uint64_t *address) {
+  uint64_t value = 0;
+
+  if (n < 17 || line[16] != ':') {
+    return -1;
+  }
+  for (int i = 0; i < 16; i++) {
+    char c = line[i];
+    int digit = (c >= '0' && c <= '9') ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : -1;
+    if (digit < 0) {
+      return -1;
+    }
+    value = value << 4 | (uint64_t)digit;
+  }
+  *address = value;
+  return 0;
+}
+
+/* Write to out the lines of the listing in listingFd whose items overlap
+ * the addresses [low, high), using the index in indexFd to seek to them
+ * Only the listing from the checkpoint before low to the line after high is
+ * read. An item reaches up to the address on the next line (silent halts
+ * belong to the halt line before them), the last one to the end of the image.
+ * Returns 0 on success and -1 if a file could not be read, with errno set to
+ * EINVAL if the index does not belong to the listing
+ */
+int queryListing(struct OutBuffer *out, int indexFd, int listingFd, uint64_t low, uint64_t high) {
+  struct IndexHeader header;
+  struct IndexCheckpoint checkpoint;
+  struct stat listingStat;
+  char buffer[QUERY_CHUNK];
+  char pending[QUERY_LINE_MAX]; //The last line seen, written once the next line shows where it ends
+  size_t pendingLength = 0, kept = 0;
+  uint64_t pendingAddress = 0, at;
+  int done = 0;
+
+  if (readIndexHeader(indexFd, &header) != 0 || fstat(listingFd, &listingStat) != 0) {
+    return -1;
+  }
+  if ((uint64_t)listingStat.st_size != header.listingLength) {
+    errno = EINVAL; //The listing changed since the index was written
+    return -1;
+  }
+  if (header.count == 0 || low >= high) {
+    return 0;
+  }
+  if (searchCheckpoints(indexFd, &header, low, &checkpoint) != 0) {
+    return -1;
+  }
+
+  at = checkpoint.listingOffset;
+  while (!done) {
+    ssize_t got = preadAll(listingFd, buffer + kept, sizeof(buffer) - kept, (off_t)at);
+    size_t filled, start = 0;
+    char *newline;
+
+    if (got < 0) {
+      return -1;
+    }
+    at += (uint64_t)got;
+    filled = kept + (size_t)got;
+    if (got == 0) {
+      break;
+    }
+    while (!done && (newline = memchr(buffer + start, '\n', filled - start)) != NULL) {
+      size_t lineLength = (size_t)(newline - (buffer + start)) + 1;
+      uint64_t address;
+
+      if (lineLength > QUERY_LINE_MAX || lineAddress(buffer + start, lineLength, &address) != 0) {
+        errno = EINVAL;
+        return -1;
+      }
+      if (pendingLength != 0 && address > low && pendingAddress < high) {
+        writeOut(out, pending, pendingLength);
+      }
+      if (address >= high) {
+        pendingLength = 0;
+        done = 1;
+      }
+      else {
+        memcpy(pending, buffer + start, lineLength);
+        pendingLength = lineLength;
+        pendingAddress = address;
+      }
+      start += lineLength;
+    }
+    kept = filled - start;
+    if (kept == sizeof(buffer)) {
+      errno = EINVAL; //No line ends in a whole chunk
+      return -1;
+    }
+    memmove(buffer, buffer + start, kept);
+  }
+  if (pendingLength != 0 && header.baseAddr + header.length > low && pendingAddress < high) {
+    writeOut(out, pending, pendingLength);
+  }
+  if (out->error != 0) {
+    errno = out->error;
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,56 @@
+/* This file contains the prototypes and constants needed to use the
+   routines defined in addressIndex.c, and describes the index file they
+   produce.
+
+   An index maps addresses to places in a listing so a query can seek
+   straight to them. All integers are little endian. The file starts with
+   an INDEX_HEADER_SIZE byte header:
+     0  "Y86X"
+     4  uint16 version (INDEX_FILE_VERSION)
+     6  uint16 reserved, 0
+     8  uint32 bytes per checkpoint (INDEX_ENTRY_SIZE)
+     12 uint32 items between checkpoints
+     16 uint64 checkpoint count
+     24 uint64 address of the first decoded byte
+     32 uint64 number of bytes decoded
+     40 uint64 length of the listing in bytes
+     48 reserved up to INDEX_HEADER_SIZE, 0
+
+   Checkpoints follow in address order, one before every run of that many
+   items (a run of silent halts is one), each INDEX_ENTRY_SIZE bytes:
+     0  uint64 address of the next item
+     8  uint64 offset in the listing of the line covering it (the halt line
+        before it if it is a run of silent halts)
+     16 uint32 bytes of a data run still to be listed as .byte lines
+     20 uint8 1 if the next halt is silent
+     21 padding up to INDEX_ENTRY_SIZE, 0
+   Bytes 16..20 are the y86DecodeBatch cursor, so decoding can also be
+   resumed at a checkpoint without going back to the start of the image.
+*/
+
+#ifndef _ADDRESSINDEX_H_
+#define _ADDRESSINDEX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "outBuffer.h"
+#include "disasm.h"
+
+#define INDEX_HEADER_SIZE 64
+#define INDEX_FILE_VERSION 1
+#define INDEX_ENTRY_SIZE 24
+#define INDEX_DEFAULT_EVERY 1024 //Items between checkpoints unless asked otherwise
+
+//One checkpoint of an index file
+struct IndexCheckpoint {
+  uint64_t address;       //Address of the next item
+  uint64_t listingOffset; //Where the line covering it starts in the listing
+  struct Y86Cursor cursor; //Decoder state at address
+};
+
+int writeIndexedListing(struct OutBuffer *out, int indexFd, const uint8_t *code, size_t length,
+                        uint64_t baseAddr, unsigned every);
+int findCheckpoint(int indexFd, uint64_t address, struct IndexCheckpoint *checkpoint);
+int queryListing(struct OutBuffer *out, int indexFd, int listingFd, uint64_t low, uint64_t high);
+
+#endif /* ADDRESSINDEX */
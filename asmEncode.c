@@ -0,0 +1,643 @@
+#include <stdlib.h>
+#include <string.h>
+#include "asmEncode.h"
+#include "printRoutines.h"
+
+/* Mnemonics, directives and registers are found with perfect hashes: the
+ * multipliers were searched for so that the names below land in distinct
+ * slots, so a lookup is one multiply and one compare. The tables are filled
+ * from opTable and getRegString, and a collision (say after adding an
+ * instruction) is reported instead of silently shadowing a name.
+ */
+#define MNEMONIC_BITS 6
+#define MNEMONIC_MULTIPLIER 0x0988F5A5u
+#define REGISTER_BITS 5
+#define REGISTER_MULTIPLIER 0xC9733CD5u
+
+//Keyword codes beyond the 256 first bytes of instructions
+enum Directive {DIR_QUAD = 256, DIR_BYTE, DIR_POS, DIR_ALIGN, DIR_FILL};
+
+struct Keyword {
+  const char *name;
+  size_t length;
+  int code; //First byte of the instruction, a Directive or a register number
+};
+
+//A label; name points into the source text
+struct Symbol {
+  const char *name;
+  size_t length;
+  uint64_t value;
+  int defined;
+};
+
+//A field to fill in once its label is known
+struct Fixup {
+  uint64_t at;         //Address of the field
+  size_t symbol;       //Index in symbols
+  int size;            //Bytes in the field
+  unsigned long line;  //For the error message if the label never shows up
+};
+
+//An operand that is a number or a label not defined yet
+struct Value {
+  uint64_t number;
+  size_t symbol; //NO_SYMBOL if number holds the value
+};
+
+#define NO_SYMBOL ((size_t)-1)
+
+struct Assembler {
+  struct Keyword mnemonics[1 << MNEMONIC_BITS];
+  struct Keyword registers[1 << REGISTER_BITS];
+  struct Symbol *symbols;  //In order of first use, indices never change
+  size_t symbolCount;
+  size_t symbolCapacity;
+  uint32_t *slots;         //Open addressed: index + 1 into symbols, 0 if free
+  size_t slotCount;        //A power of 2, at least twice symbolCount
+  struct Fixup *fixups;
+  size_t fixupCount;
+  size_t fixupCapacity;
+  size_t *pending;         //Labels with no statement after them yet
+  size_t pendingCount;
+  size_t pendingCapacity;
+  struct AsmImage *image;
+  uint64_t location;       //Address the next byte goes to
+  unsigned long line;
+  const char *error;       //First error, NULL while all is well
+};
+
+static unsigned perfectHash(const char *s, size_t n, uint32_t multiplier, int bits) {
+  uint32_t key = (uint32_t)(unsigned char)s[0] | (uint32_t)(unsigned char)s[1] << 8 |
+                 (uint32_t)(unsigned char)s[n - 2] << 16 | (uint32_t)(unsigned char)s[n - 1] << 24;
+  key ^= (uint32_t)n << 28;
+  return (unsigned)((key * multiplier) >> (32 - bits));
+}
+
+static int addKeyword(struct Keyword *table, int bits, uint32_t multiplier, const char *name, int code) {
+  size_t n = strlen(name);
+  struct Keyword *slot = &table[perfectHash(name, n, multiplier, bits)];
+  if (slot->name != NULL) {
+    return -1;
+  }
+  slot->name = name;
+  slot->length = n;
+  slot->code = code;
+  return 0;
+}
+
+/* Returns the code of the keyword s[0..n) or -1 if there is none
+ */
+static int findKeyword(const struct Keyword *table, int bits, uint32_t multiplier, const char *s, size_t n) {
+  const struct Keyword *slot;
+  if (n < 2) {
+    return -1;
+  }
+  slot = &table[perfectHash(s, n, multiplier, bits)];
+  if (slot->length != n || memcmp(slot->name, s, n) != 0) {
+    return -1;
+  }
+  return slot->code;
+}
+
+static int buildKeywords(struct Assembler *as) {
+  static const char *const directives[5] = {".quad", ".byte", ".pos", ".align", ".fill"};
+  int failed = 0;
+
+  for (int b = 0; b < 256; b++) {
+    if (opTable[b].length != 0) {
+      failed |= addKeyword(as->mnemonics, MNEMONIC_BITS, MNEMONIC_MULTIPLIER, opTable[b].mnemonic, b);
+    }
+  }
+  for (int d = 0; d < 5; d++) {
+    failed |= addKeyword(as->mnemonics, MNEMONIC_BITS, MNEMONIC_MULTIPLIER, directives[d], DIR_QUAD + d);
+  }
+  for (unsigned char r = 0; r < 0xF; r++) {
+    failed |= addKeyword(as->registers, REGISTER_BITS, REGISTER_MULTIPLIER, getRegString(r), r);
+  }
+  return failed;
+}
+
+static int fail(struct Assembler *as, const char *message) {
+  if (as->error == NULL) {
+    as->error = message;
+  }
+  return -1;
+}
+
+/* Index of the label s[0..n), added (undefined) if it is new
+ * Returns NO_SYMBOL if memory ran out
+ */
+static size_t findSymbol(struct Assembler *as, const char *s, size_t n) {
+  uint64_t hash = 0xCBF29CE484222325ULL; //FNV-1a
+  size_t slot;
+
+  for (size_t i = 0; i < n; i++) {
+    hash = (hash ^ (unsigned char)s[i]) * 0x100000001B3ULL;
+  }
+  if (2 * (as->symbolCount + 1) > as->slotCount) {
+    size_t count = as->slotCount ? 2 * as->slotCount : 1024;
+    uint32_t *slots = calloc(count, sizeof(*slots));
+    if (slots == NULL) {
+      return NO_SYMBOL;
+    }
+    for (size_t i = 0; i < as->slotCount; i++) { //Rehash by name
+      if (as->slots[i] != 0) {
+        const struct Symbol *symbol = &as->symbols[as->slots[i] - 1];
+        uint64_t h = 0xCBF29CE484222325ULL;
+        for (size_t c = 0; c < symbol->length; c++) {
+          h = (h ^ (unsigned char)symbol->name[c]) * 0x100000001B3ULL;
+        }
+        size_t j = (size_t)h & (count - 1);
+        while (slots[j] != 0) {
+          j = (j + 1) & (count - 1);
+        }
+        slots[j] = as->slots[i];
+      }
+    }
+    free(as->slots);
+    as->slots = slots;
+    as->slotCount = count;
+  }
+
+  for (slot = (size_t)hash & (as->slotCount - 1); as->slots[slot] != 0; slot = (slot + 1) & (as->slotCount - 1)) {
+    const struct Symbol *symbol = &as->symbols[as->slots[slot] - 1];
+    if (symbol->length == n && memcmp(symbol->name, s, n) == 0) {
+      return as->slots[slot] - 1;
+    }
+  }
+  if (as->symbolCount == as->symbolCapacity) {
+    size_t capacity = as->symbolCapacity ? 2 * as->symbolCapacity : 512;
+    struct Symbol *symbols = realloc(as->symbols, capacity * sizeof(*symbols));
+    if (symbols == NULL) {
+      return NO_SYMBOL;
+    }
+    as->symbols = symbols;
+    as->symbolCapacity = capacity;
+  }
+  as->symbols[as->symbolCount].name = s;
+  as->symbols[as->symbolCount].length = n;
+  as->symbols[as->symbolCount].value = 0;
+  as->symbols[as->symbolCount].defined = 0;
+  as->slots[slot] = (uint32_t)(as->symbolCount + 1);
+  return as->symbolCount++;
+}
+
+/* Make sure bytes [location, location + n) exist in the image
+ * Returns a pointer to the byte at location, NULL if memory ran out
+ */
+static uint8_t *reserveBytes(struct Assembler *as, uint64_t n) {
+  struct AsmImage *image = as->image;
+  uint64_t end = as->location + n;
+
+  if (end < as->location || end > (uint64_t)SIZE_MAX / 2) {
+    fail(as, "address out of range");
+    return NULL;
+  }
+  if (end > image->capacity) {
+    size_t capacity = image->capacity ? image->capacity : 65536;
+    while (capacity < end) {
+      capacity *= 2;
+    }
+    uint8_t *bytes = realloc(image->bytes, capacity);
+    if (bytes == NULL) {
+      fail(as, "out of memory");
+      return NULL;
+    }
+    memset(bytes + image->capacity, 0, capacity - image->capacity);
+    image->bytes = bytes;
+    image->capacity = capacity;
+  }
+  if (end > image->length) {
+    image->length = (size_t)end;
+  }
+  return image->bytes + as->location;
+}
+
+static void putLittleEndian(uint8_t *p, uint64_t value, int n) {
+  for (int i = 0; i < n; i++) {
+    p[i] = (uint8_t)(value >> (8 * i));
+  }
+}
+
+/* Write a size byte field at the location: the value, or a fixup for its label
+ */
+static int emitValue(struct Assembler *as, const struct Value *value, int size) {
+  uint8_t *p = reserveBytes(as, (uint64_t)size);
+  if (p == NULL) {
+    return -1;
+  }
+  if (value->symbol == NO_SYMBOL) {
+    putLittleEndian(p, value->number, size);
+  }
+  else {
+    if (as->fixupCount == as->fixupCapacity) {
+      size_t capacity = as->fixupCapacity ? 2 * as->fixupCapacity : 1024;
+      struct Fixup *fixups = realloc(as->fixups, capacity * sizeof(*fixups));
+      if (fixups == NULL) {
+        return fail(as, "out of memory");
+      }
+      as->fixups = fixups;
+      as->fixupCapacity = capacity;
+    }
+    as->fixups[as->fixupCount].at = as->location;
+    as->fixups[as->fixupCount].symbol = value->symbol;
+    as->fixups[as->fixupCount].size = size;
+    as->fixups[as->fixupCount].line = as->line;
+    as->fixupCount++;
+  }
+  as->location += (uint64_t)size;
+  return 0;
+}
+
+static int emitBytes(struct Assembler *as, const uint8_t *bytes, int n) {
+  uint8_t *p = reserveBytes(as, (uint64_t)n);
+  if (p == NULL) {
+    return -1;
+  }
+  memcpy(p, bytes, (size_t)n);
+  as->location += (uint64_t)n;
+  return 0;
+}
+
+//The lexer works on [p, end) of one line and never copies text
+
+static int isHexDigit(char c) {
+  return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+static int hexValue(char c) {
+  return c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10;
+}
+
+static int isNameChar(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '.';
+}
+
+static const char *skipBlanks(const char *p, const char *end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+    p++;
+  }
+  return p;
+}
+
+static const char *skipName(const char *p, const char *end) {
+  while (p < end && isNameChar(*p)) {
+    p++;
+  }
+  return p;
+}
+
+/* Expect c (after blanks) at *p and step over it
+ */
+static int expect(struct Assembler *as, const char **p, const char *end, char c, const char *message) {
+  *p = skipBlanks(*p, end);
+  if (*p == end || **p != c) {
+    return fail(as, message);
+  }
+  (*p)++;
+  return 0;
+}
+
+/* Parse a number: decimal, 0x hex, either with a leading -
+ */
+static int parseNumber(struct Assembler *as, const char **p, const char *end, uint64_t *number) {
+  const char *s = *p;
+  int negative = 0;
+  uint64_t value = 0;
+  int digits = 0;
+
+  if (s < end && *s == '-') {
+    negative = 1;
+    s++;
+  }
+  if (end - s > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+    for (s += 2; s < end && isHexDigit(*s); s++, digits++) {
+      value = value << 4 | (uint64_t)hexValue(*s);
+    }
+    if (digits > 16) {
+      return fail(as, "number too large");
+    }
+  }
+  else {
+    for (; s < end && *s >= '0' && *s <= '9'; s++, digits++) {
+      uint64_t next = value * 10 + (uint64_t)(*s - '0');
+      if (next / 10 != value) {
+        return fail(as, "number too large");
+      }
+      value = next;
+    }
+  }
+  if (digits == 0 || (s < end && isNameChar(*s))) {
+    return fail(as, "bad number");
+  }
+  *number = negative ? (uint64_t)0 - value : value;
+  *p = s;
+  return 0;
+}
+
+/* Parse a number or a label name
+ */
+static int parseValue(struct Assembler *as, const char **p, const char *end, struct Value *value) {
+  *p = skipBlanks(*p, end);
+  value->symbol = NO_SYMBOL;
+  value->number = 0;
+  if (*p < end && (**p == '-' || (**p >= '0' && **p <= '9'))) {
+    return parseNumber(as, p, end, &value->number);
+  }
+  if (*p == end || !isNameChar(**p)) {
+    return fail(as, "expected a number or a label");
+  }
+  const char *name = *p;
+  *p = skipName(*p, end);
+  size_t symbol = findSymbol(as, name, (size_t)(*p - name));
+  if (symbol == NO_SYMBOL) {
+    return fail(as, "out of memory");
+  }
+  if (as->symbols[symbol].defined) {
+    value->number = as->symbols[symbol].value;
+  }
+  else {
+    value->symbol = symbol;
+  }
+  return 0;
+}
+
+static int parseRegister(struct Assembler *as, const char **p, const char *end, int *reg) {
+  const char *name;
+  *p = skipBlanks(*p, end);
+  name = *p;
+  if (*p < end && **p == '%') {
+    *p = skipName(*p + 1, end);
+  }
+  *reg = findKeyword(as->registers, REGISTER_BITS, REGISTER_MULTIPLIER, name, (size_t)(*p - name));
+  return *reg < 0 ? fail(as, "expected a register") : 0;
+}
+
+/* Parse D(rB) where D is optional
+ */
+static int parseMemory(struct Assembler *as, const char **p, const char *end, struct Value *displacement, int *reg) {
+  *p = skipBlanks(*p, end);
+  displacement->number = 0;
+  displacement->symbol = NO_SYMBOL;
+  if (*p < end && **p != '(' && parseValue(as, p, end, displacement) != 0) {
+    return -1;
+  }
+  if (expect(as, p, end, '(', "expected (") != 0 || parseRegister(as, p, end, reg) != 0) {
+    return -1;
+  }
+  return expect(as, p, end, ')', "expected )");
+}
+
+/* Assemble the instruction whose first byte is code, operands at *p
+ */
+static int assembleInstruction(struct Assembler *as, const char **p, const char *end, int code) {
+  const struct OpDescriptor *op = &opTable[code];
+  uint8_t bytes[2] = {(uint8_t)code, 0};
+  struct Value value;
+  int rA = 0xF, rB = 0xF;
+
+  switch (op->shape) {
+    case SHAPE_NONE:
+      return emitBytes(as, bytes, 1);
+    case SHAPE_RR:
+      if (parseRegister(as, p, end, &rA) != 0 || expect(as, p, end, ',', "expected ,") != 0 ||
+          parseRegister(as, p, end, &rB) != 0) {
+        return -1;
+      }
+      bytes[1] = (uint8_t)(rA << 4 | rB);
+      return emitBytes(as, bytes, 2);
+    case SHAPE_IR:
+      *p = skipBlanks(*p, end);
+      if (*p < end && **p == '$') {
+        (*p)++;
+      }
+      if (parseValue(as, p, end, &value) != 0 || expect(as, p, end, ',', "expected ,") != 0 ||
+          parseRegister(as, p, end, &rB) != 0) {
+        return -1;
+      }
+      bytes[1] = (uint8_t)(0xF0 | rB);
+      break;
+    case SHAPE_RM:
+      if (parseRegister(as, p, end, &rA) != 0 || expect(as, p, end, ',', "expected ,") != 0 ||
+          parseMemory(as, p, end, &value, &rB) != 0) {
+        return -1;
+      }
+      bytes[1] = (uint8_t)(rA << 4 | rB);
+      break;
+    case SHAPE_MR:
+      if (parseMemory(as, p, end, &value, &rB) != 0 || expect(as, p, end, ',', "expected ,") != 0 ||
+          parseRegister(as, p, end, &rA) != 0) {
+        return -1;
+      }
+      bytes[1] = (uint8_t)(rA << 4 | rB);
+      break;
+    case SHAPE_DEST:
+      if (parseValue(as, p, end, &value) != 0 || emitBytes(as, bytes, 1) != 0) {
+        return -1;
+      }
+      return emitValue(as, &value, 8);
+    case SHAPE_R:
+      if (parseRegister(as, p, end, &rA) != 0) {
+        return -1;
+      }
+      bytes[1] = (uint8_t)(rA << 4 | 0xF);
+      return emitBytes(as, bytes, 2);
+  }
+  if (emitBytes(as, bytes, 2) != 0) {
+    return -1;
+  }
+  return emitValue(as, &value, 8);
+}
+
+static int assembleDirective(struct Assembler *as, const char **p, const char *end, int code) {
+  struct Value value;
+  uint64_t count, size;
+
+  switch (code) {
+    case DIR_QUAD:
+    case DIR_BYTE:
+      if (parseValue(as, p, end, &value) != 0) {
+        return -1;
+      }
+      return emitValue(as, &value, code == DIR_QUAD ? 8 : 1);
+    case DIR_POS:
+      *p = skipBlanks(*p, end);
+      return parseNumber(as, p, end, &as->location);
+    case DIR_ALIGN:
+      *p = skipBlanks(*p, end);
+      if (parseNumber(as, p, end, &size) != 0) {
+        return -1;
+      }
+      if (size == 0) {
+        return fail(as, "bad alignment");
+      }
+      as->location = (as->location + size - 1) / size * size;
+      return 0;
+    default: //DIR_FILL
+      *p = skipBlanks(*p, end);
+      if (parseNumber(as, p, end, &count) != 0 || expect(as, p, end, ',', "expected ,") != 0) {
+        return -1;
+      }
+      *p = skipBlanks(*p, end);
+      if (parseNumber(as, p, end, &size) != 0 || expect(as, p, end, ',', "expected ,") != 0) {
+        return -1;
+      }
+      *p = skipBlanks(*p, end);
+      if (parseNumber(as, p, end, &value.number) != 0) {
+        return -1;
+      }
+      if (size != 1 && size != 2 && size != 4 && size != 8) {
+        return fail(as, "bad .fill size");
+      }
+      if (count > (uint64_t)SIZE_MAX / 16) {
+        return fail(as, "address out of range");
+      }
+      uint8_t *fill = reserveBytes(as, count * size);
+      if (fill == NULL) {
+        return -1;
+      }
+      for (uint64_t i = 0; i < count; i++) {
+        putLittleEndian(fill + i * size, value.number, (int)size);
+      }
+      as->location += count * size;
+      return 0;
+  }
+}
+
+/* Assemble the line [p, end)
+ */
+static int assembleLine(struct Assembler *as, const char *p, const char *end) {
+  p = skipBlanks(p, end);
+
+  //A listing line: 16 digit address, colon, encoding column. The labels on
+  //the lines before it name its address, which can be past the end of the
+  //previous line when halts were left out.
+  if (end - p > 16 && p[16] == ':') {
+    uint64_t address = 0;
+    int i;
+    for (i = 0; i < 16 && isHexDigit(p[i]); i++) {
+      address = address << 4 | (uint64_t)hexValue(p[i]);
+    }
+    if (i == 16) {
+      as->location = address;
+      for (size_t l = 0; l < as->pendingCount; l++) {
+        as->symbols[as->pending[l]].value = address;
+      }
+      as->pendingCount = 0;
+      p = skipBlanks(p + 17, end);
+      const char *encoding = p;
+      while (p < end && isHexDigit(*p)) {
+        p++;
+      }
+      if (p == encoding || (p < end && *p != ' ' && *p != '\t')) {
+        p = encoding; //Not an encoding column after all
+      }
+      p = skipBlanks(p, end);
+    }
+  }
+
+  while (p < end && *p != '#') {
+    const char *name = p;
+    int code;
+    p = skipName(p, end);
+    if (p == name) {
+      return fail(as, "unexpected character");
+    }
+    if (p < end && *p == ':') { //Label
+      size_t symbol = findSymbol(as, name, (size_t)(p - name));
+      if (symbol == NO_SYMBOL) {
+        return fail(as, "out of memory");
+      }
+      if (as->symbols[symbol].defined) {
+        return fail(as, "label defined twice");
+      }
+      as->symbols[symbol].defined = 1;
+      as->symbols[symbol].value = as->location;
+      if (as->pendingCount == as->pendingCapacity) {
+        size_t capacity = as->pendingCapacity ? 2 * as->pendingCapacity : 16;
+        size_t *pending = realloc(as->pending, capacity * sizeof(*pending));
+        if (pending == NULL) {
+          return fail(as, "out of memory");
+        }
+        as->pending = pending;
+        as->pendingCapacity = capacity;
+      }
+      as->pending[as->pendingCount++] = symbol;
+      p = skipBlanks(p + 1, end);
+      continue;
+    }
+
+    code = findKeyword(as->mnemonics, MNEMONIC_BITS, MNEMONIC_MULTIPLIER, name, (size_t)(p - name));
+    if (code < 0) {
+      return fail(as, "unknown instruction");
+    }
+    as->pendingCount = 0;
+    if ((code < 256 ? assembleInstruction(as, &p, end, code) : assembleDirective(as, &p, end, code)) != 0) {
+      return -1;
+    }
+    p = skipBlanks(p, end);
+    if (p < end && *p != '#') {
+      return fail(as, "unexpected text after the operands");
+    }
+  }
+  return 0;
+}
+
+/* Assemble the source text[0..length) into image (which is set up here and
+ * released with freeAsmImage, also after a failure)
+ * The source is read in a single pass; fields that name labels not defined
+ * yet are recorded and patched once the whole text has been read.
+ * Returns 0 on success and -1 on failure, with error saying where and why
+ */
+int assembleText(const char *text, size_t length, struct AsmImage *image, struct AsmError *error) {
+  struct Assembler as;
+  const char *p = text, *end = text + length;
+
+  memset(&as, 0, sizeof(as));
+  memset(image, 0, sizeof(*image));
+  as.image = image;
+  error->line = 0;
+  error->message = NULL;
+  if (buildKeywords(&as) != 0) {
+    error->message = "mnemonic hash collision, the multipliers need to be searched for again";
+    return -1;
+  }
+
+  while (p < end && as.error == NULL) {
+    const char *lineEnd = memchr(p, '\n', (size_t)(end - p));
+    if (lineEnd == NULL) {
+      lineEnd = end;
+    }
+    as.line++;
+    assembleLine(&as, p, lineEnd);
+    p = lineEnd + 1;
+  }
+
+  for (size_t i = 0; i < as.fixupCount && as.error == NULL; i++) {
+    const struct Fixup *fixup = &as.fixups[i];
+    const struct Symbol *symbol = &as.symbols[fixup->symbol];
+    if (!symbol->defined) {
+      as.line = fixup->line;
+      fail(&as, "undefined label");
+    }
+    else {
+      putLittleEndian(image->bytes + fixup->at, symbol->value, fixup->size);
+    }
+  }
+
+  if (as.error != NULL) {
+    error->line = as.line;
+    error->message = as.error;
+  }
+  free(as.symbols);
+  free(as.slots);
+  free(as.fixups);
+  free(as.pending);
+  return as.error != NULL ? -1 : 0;
+}
+
+void freeAsmImage(struct AsmImage *image) {
+  free(image->bytes);
+  memset(image, 0, sizeof(*image));
+}
@@ -0,0 +1,40 @@
+/* This file contains the prototypes and constants needed to use the
+   routines defined in asmEncode.c, the Y86 assembler.
+
+   Accepted source, one statement per line:
+     label:                     a label, any number per line
+     mnemonic operands          the instructions of the listing (rrmovq, cmovXX,
+                                irmovq $V|label, rmmovq rA, D(rB), mrmovq D(rB), rA,
+                                OPq, jXX/call Dest|label, pushq, popq, halt, nop, ret)
+     .quad V|label  .byte V     data
+     .pos A  .align N           move the location counter
+     .fill count, size, value   count copies of a size (1, 2, 4 or 8) byte value
+     # comment
+   A line of the disassembler's listing assembles as is: its 16 digit
+   address prefix sets the location counter (so left out halts come back as
+   zeros) and the encoding column after it is skipped.
+*/
+
+#ifndef _ASMENCODE_H_
+#define _ASMENCODE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+//Assembled bytes, from address 0 up to the last byte written (gaps are zero)
+struct AsmImage {
+  uint8_t *bytes;
+  size_t length;
+  size_t capacity;
+};
+
+//Where and why assembling stopped
+struct AsmError {
+  unsigned long line; //1 based, 0 if the error has no line
+  const char *message;
+};
+
+int assembleText(const char *text, size_t length, struct AsmImage *image, struct AsmError *error);
+void freeAsmImage(struct AsmImage *image);
+
+#endif /* ASMENCODE */
@@ -0,0 +1,90 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include "asmEncode.h"
+#include "inputMap.h"
+
+#define ERROR_RETURN -1
+#define SUCCESS 0
+
+int main(int argc, char **argv) {
+
+  FILE *source, *outputFile;
+  FILE *status = stdout; //Where progress and error messages go
+  struct InputMap map;
+  struct AsmImage image;
+  struct AsmError error;
+  struct timespec start, stop;
+  double seconds;
+
+  if (argc != 3) {
+    printf("Usage: %s InputFilename|- OutputFilename|-\n", argv[0]);
+    return ERROR_RETURN;
+  }
+
+  // With the image on stdout, status messages go to stderr
+  if (strcmp(argv[2], "-") == 0) {
+    status = stderr;
+  }
+
+  source = strcmp(argv[1], "-") == 0 ? stdin : fopen(argv[1], "rb");
+  if (source == NULL) {
+    fprintf(status, "Failed to open %s: %s\n", argv[1], strerror(errno));
+    return ERROR_RETURN;
+  }
+  if (mapInput(source, &map) != 0) {
+    fprintf(status, "Failed to read %s: %s\n", argv[1], strerror(errno));
+    fclose(source);
+    return ERROR_RETURN;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if (assembleText((const char *)map.data, map.length, &image, &error) != 0) {
+    if (error.line != 0) {
+      fprintf(status, "%s:%lu: %s\n", argv[1], error.line, error.message);
+    }
+    else {
+      fprintf(status, "%s: %s\n", argv[1], error.message);
+    }
+    freeAsmImage(&image);
+    unmapInput(&map);
+    fclose(source);
+    return ERROR_RETURN;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  seconds = (double)(stop.tv_sec - start.tv_sec) + (double)(stop.tv_nsec - start.tv_nsec) / 1e9;
+
+  outputFile = strcmp(argv[2], "-") == 0 ? stdout : fopen(argv[2], "wb");
+  if (outputFile == NULL) {
+    fprintf(status, "Failed to open %s: %s\n", argv[2], strerror(errno));
+    freeAsmImage(&image);
+    unmapInput(&map);
+    fclose(source);
+    return ERROR_RETURN;
+  }
+  if (fwrite(image.bytes, 1, image.length, outputFile) != image.length || fflush(outputFile) != 0) {
+    fprintf(status, "Failed to write %s: %s\n", argv[2], strerror(errno));
+    fclose(outputFile);
+    freeAsmImage(&image);
+    unmapInput(&map);
+    fclose(source);
+    return ERROR_RETURN;
+  }
+
+  fprintf(status, "Assembled %s into %s: %lu bytes of source, %lu bytes of image",
+          argv[1], argv[2], (unsigned long)map.length, (unsigned long)image.length);
+  if (seconds > 0) {
+    fprintf(status, " (%.1f MB/s)", (double)map.length / seconds / 1e6);
+  }
+  fprintf(status, "\n");
+
+  fclose(outputFile);
+  freeAsmImage(&image);
+  unmapInput(&map);
+  fclose(source);
+  return SUCCESS;
+}
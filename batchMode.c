@@ -0,0 +1,353 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "batchMode.h"
+#include "inputMap.h"
+#include "outBuffer.h"
+#include "printRoutines.h"
+
+/* One input/output pair of a batch and how it went
+ */
+struct BatchJob {
+  char *input;
+  char *output;
+  unsigned long startingOffset;
+  unsigned long endOffset;
+  const char *failedTo; //What went wrong ("open", "read", ...), NULL on success
+  int error;            //errno of the failure
+};
+
+//Jobs shared by the worker threads, handed out in order
+struct BatchPool {
+  struct BatchJob *jobs;
+  size_t count;
+  size_t next;
+  pthread_mutex_t lock;
+};
+
+static void failJob(struct BatchJob *job, const char *failedTo, int error) {
+  job->failedTo = failedTo;
+  job->error = error;
+}
+
+/* Disassemble one file through ob, which is reused from the previous file
+ */
+static void runJob(struct BatchJob *job, struct OutBuffer *ob) {
+  struct InputMap map;
+  FILE *machineCode = fopen(job->input, "rb");
+  int fd;
+
+  if (machineCode == NULL) {
+    failJob(job, "open", errno);
+    return;
+  }
+  fd = open(job->output, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0) {
+    failJob(job, "create", errno);
+    fclose(machineCode);
+    return;
+  }
+  if (mapInputWindow(machineCode, job->startingOffset, job->endOffset, &map) != 0) {
+    failJob(job, "read", errno);
+  }
+  else {
+    resetOutBuffer(ob, fd);
+    decodeMachineCode(ob, map.data, map.length, job->startingOffset);
+    if (flushOutBuffer(ob) != 0) {
+      failJob(job, "write", ob->error);
+    }
+    resetOutBuffer(ob, -1);
+    unmapInput(&map);
+  }
+  if (close(fd) != 0 && job->failedTo == NULL) {
+    failJob(job, "write", errno);
+  }
+  fclose(machineCode);
+}
+
+/* Worker body: take the next job until there are none left
+ */
+static void *batchWorker(void *arg) {
+  struct BatchPool *pool = arg;
+  struct OutBuffer ob;
+  int haveBuffer = (openOutBuffer(&ob, -1, OUT_BUFFER_SIZE) == 0);
+
+  for (;;) {
+    size_t i;
+    pthread_mutex_lock(&pool->lock);
+    i = pool->next++;
+    pthread_mutex_unlock(&pool->lock);
+    if (i >= pool->count) {
+      break;
+    }
+    if (haveBuffer) {
+      runJob(&pool->jobs[i], &ob);
+    }
+    else {
+      failJob(&pool->jobs[i], "allocate a buffer for", ENOMEM);
+    }
+  }
+  if (haveBuffer) {
+    closeOutBuffer(&ob);
+  }
+  return NULL;
+}
+
+/* Run every job on threads workers (the calling thread is one of them) and
+ * report the failures in job order
+ * Returns the number of failed jobs
+ */
+static int runJobs(struct BatchJob *jobs, size_t count, int threads) {
+  struct BatchPool pool = {jobs, count, 0};
+  pthread_t *workers = NULL;
+  int started = 0;
+  int failed = 0;
+
+  pthread_mutex_init(&pool.lock, NULL);
+  if (threads > 1 && count > 1) {
+    workers = calloc((size_t)threads, sizeof(*workers));
+  }
+  for (int i = 1; workers != NULL && i < threads && (size_t)i < count; i++) {
+    if (pthread_create(&workers[started], NULL, batchWorker, &pool) == 0) {
+      started++;
+    }
+  }
+  batchWorker(&pool);
+  for (int i = 0; i < started; i++) {
+    pthread_join(workers[i], NULL);
+  }
+  free(workers);
+  pthread_mutex_destroy(&pool.lock);
+
+  for (size_t i = 0; i < count; i++) {
+    if (jobs[i].failedTo != NULL) {
+      printf("Failed to %s %s: %s\n", jobs[i].failedTo,
+             strcmp(jobs[i].failedTo, "create") == 0 || strcmp(jobs[i].failedTo, "write") == 0 ? jobs[i].output : jobs[i].input,
+             strerror(jobs[i].error));
+      failed++;
+    }
+  }
+  printf("Disassembled %lu of %lu files\n", (unsigned long)(count - (size_t)failed), (unsigned long)count);
+  return failed;
+}
+
+/* Parse a starting offset and an optional end offset ("+length" for a
+ * length), the same way the command line does
+ * Returns 0 on success and -1 if either is malformed
+ */
+static int parseWindow(const char *start, const char *end, struct BatchJob *job) {
+  char *rest;
+
+  job->startingOffset = 0;
+  job->endOffset = INPUT_TO_END;
+  if (start == NULL) {
+    return 0;
+  }
+  errno = 0;
+  job->startingOffset = strtoul(start, &rest, 0);
+  if (errno != 0 || *rest != '\0') {
+    return -1;
+  }
+  if (end != NULL) {
+    int isLength = (end[0] == '+');
+    unsigned long value = strtoul(isLength ? end + 1 : end, &rest, 0);
+    if (errno != 0 || *rest != '\0') {
+      return -1;
+    }
+    if (isLength) {
+      value = value > INPUT_TO_END - job->startingOffset ? INPUT_TO_END : job->startingOffset + value;
+    }
+    if (value < job->startingOffset) {
+      return -1;
+    }
+    job->endOffset = value;
+  }
+  return 0;
+}
+
+/* Disassemble every pair listed in the manifest at manifestPath, one per line:
+ *   InputFilename OutputFilename [startingOffset [endOffset|+length]]
+ * separated by blanks; empty lines and lines starting with # are skipped.
+ * Files are processed on threads threads and a failing file does not stop
+ * the others.
+ * Returns the number of files that failed, or -1 if the manifest could not
+ * be read or has a malformed line
+ */
+int runBatchManifest(const char *manifestPath, int threads) {
+  FILE *manifest = fopen(manifestPath, "rb");
+  struct InputMap map;
+  struct BatchJob *jobs = NULL;
+  char *text;
+  size_t count = 0, capacity = 0, lineNumber = 0;
+  int result;
+
+  if (manifest == NULL || mapInput(manifest, &map) != 0) {
+    printf("Failed to read %s: %s\n", manifestPath, strerror(errno));
+    if (manifest != NULL) {
+      fclose(manifest);
+    }
+    return -1;
+  }
+  text = malloc(map.length + 1); //Copied so fields can be cut out in place
+  if (text == NULL) {
+    printf("Failed to read %s: %s\n", manifestPath, strerror(ENOMEM));
+    unmapInput(&map);
+    fclose(manifest);
+    return -1;
+  }
+  memcpy(text, map.data, map.length);
+  text[map.length] = '\0';
+  unmapInput(&map);
+  fclose(manifest);
+
+  for (char *line = text; line != NULL && *line != '\0'; ) {
+    char *fields[4] = {NULL, NULL, NULL, NULL};
+    int fieldCount = 0;
+    char *p = line;
+    char *newline = strchr(line, '\n');
+
+    lineNumber++;
+    if (newline != NULL) {
+      *newline = '\0';
+    }
+    line = newline != NULL ? newline + 1 : NULL;
+    while (*p != '\0' && *p != '#') {
+      while (*p == ' ' || *p == '\t' || *p == '\r') {
+        *p++ = '\0';
+      }
+      if (*p == '\0' || *p == '#') {
+        break;
+      }
+      if (fieldCount == 4) {
+        fieldCount++;
+        break;
+      }
+      fields[fieldCount++] = p;
+      while (*p != '\0' && *p != ' ' && *p != '\t' && *p != '\r') {
+        p++;
+      }
+    }
+    if (fieldCount == 0) {
+      continue;
+    }
+
+    if (count == capacity) {
+      size_t grown = capacity ? 2 * capacity : 256;
+      struct BatchJob *bigger = realloc(jobs, grown * sizeof(*jobs));
+      if (bigger == NULL) {
+        printf("Failed to read %s: %s\n", manifestPath, strerror(ENOMEM));
+        free(jobs);
+        free(text);
+        return -1;
+      }
+      jobs = bigger;
+      capacity = grown;
+    }
+    memset(&jobs[count], 0, sizeof(jobs[count]));
+    jobs[count].input = fields[0];
+    jobs[count].output = fields[1];
+    if (fieldCount < 2 || fieldCount > 4 || parseWindow(fields[2], fields[3], &jobs[count]) != 0) {
+      printf("Invalid line %lu in %s\n", (unsigned long)lineNumber, manifestPath);
+      free(jobs);
+      free(text);
+      return -1;
+    }
+    count++;
+  }
+
+  result = runJobs(jobs, count, threads);
+  free(jobs);
+  free(text);
+  return result;
+}
+
+static int compareNames(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Disassemble every regular file in inputDir (except hidden ones) into a
+ * file of the same name with .txt appended in outputDir
+ * Returns the number of files that failed, or -1 if a directory could not
+ * be read
+ */
+int runBatchDirectory(const char *inputDir, const char *outputDir, int threads) {
+  DIR *dir = opendir(inputDir);
+  struct dirent *entry;
+  struct BatchJob *jobs = NULL;
+  char **names = NULL;
+  size_t count = 0, capacity = 0;
+  int result = -1;
+
+  if (dir == NULL) {
+    printf("Failed to open %s: %s\n", inputDir, strerror(errno));
+    return -1;
+  }
+  while ((entry = readdir(dir)) != NULL) {
+    struct stat info;
+    char *path;
+
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+    path = malloc(strlen(inputDir) + strlen(entry->d_name) + 2);
+    if (path == NULL) {
+      goto done;
+    }
+    sprintf(path, "%s/%s", inputDir, entry->d_name);
+    if (stat(path, &info) != 0 || !S_ISREG(info.st_mode)) {
+      free(path);
+      continue;
+    }
+    if (count == capacity) {
+      size_t grown = capacity ? 2 * capacity : 256;
+      char **bigger = realloc(names, grown * sizeof(*names));
+      if (bigger == NULL) {
+        free(path);
+        goto done;
+      }
+      names = bigger;
+      capacity = grown;
+    }
+    names[count++] = path;
+  }
+  qsort(names, count, sizeof(*names), compareNames);
+
+  jobs = calloc(count + 1, sizeof(*jobs));
+  if (jobs == NULL) {
+    goto done;
+  }
+  for (size_t i = 0; i < count; i++) {
+    const char *name = names[i] + strlen(inputDir) + 1;
+    jobs[i].input = names[i];
+    jobs[i].output = malloc(strlen(outputDir) + strlen(name) + 6);
+    if (jobs[i].output == NULL) {
+      goto done;
+    }
+    sprintf(jobs[i].output, "%s/%s.txt", outputDir, name);
+    jobs[i].endOffset = INPUT_TO_END;
+  }
+  result = runJobs(jobs, count, threads);
+
+done:
+  if (result < 0) {
+    printf("Failed to read %s: %s\n", inputDir, strerror(ENOMEM));
+  }
+  for (size_t i = 0; i < count; i++) {
+    free(names[i]);
+    if (jobs != NULL) {
+      free(jobs[i].output);
+    }
+  }
+  free(names);
+  free(jobs);
+  closedir(dir);
+  return result;
+}
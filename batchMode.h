@@ -0,0 +1,11 @@
+/* This file contains the prototypes and constants needed to use the
+   routines defined in batchMode.c
+*/
+
+#ifndef _BATCHMODE_H_
+#define _BATCHMODE_H_
+
+int runBatchManifest(const char *manifestPath, int threads);
+int runBatchDirectory(const char *inputDir, const char *outputDir, int threads);
+
+#endif /* BATCHMODE */
@@ -0,0 +1,218 @@
+/* Times every decode path of the disassembler on one or more images and
+ * reports throughput in MB/s of image and in instructions per second.
+ *
+ * Usage: benchdisasm [-j threads] [-r repeats] ImageFilename...
+ * Output goes to /dev/null so only decoding and rendering are measured.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include "printRoutines.h"
+#include "inputMap.h"
+#include "outBuffer.h"
+#include "parallelDecode.h"
+#include "recordWriter.h"
+#include "disasm.h"
+#include "outputSink.h"
+
+#define ERROR_RETURN -1
+#define SUCCESS 0
+
+#define BATCH_RECORDS 4096
+
+struct Image {
+  const uint8_t *code;
+  size_t length;
+  int sink; //Descriptor of /dev/null
+  int threads;
+};
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void textSerial(const struct Image *image) {
+  struct OutBuffer ob;
+  if (openOutBuffer(&ob, image->sink, OUT_BUFFER_SIZE) == 0) {
+    decodeMachineCode(&ob, image->code, image->length, 0);
+    closeOutBuffer(&ob);
+  }
+}
+
+static void textParallel(const struct Image *image) {
+  struct OutBuffer ob;
+  if (openOutBuffer(&ob, image->sink, OUT_BUFFER_SIZE) == 0) {
+    decodeParallel(&ob, image->code, image->length, 0, image->threads);
+    closeOutBuffer(&ob);
+  }
+}
+
+static void batchOnly(const struct Image *image) {
+  static struct Y86Record records[BATCH_RECORDS];
+  struct Y86Cursor cursor;
+  y86InitCursor(&cursor);
+  while (y86DecodeBatch(image->code, image->length, 0, &cursor, records, BATCH_RECORDS) > 0) {
+  }
+}
+
+static void batchRendered(const struct Image *image) {
+  static struct Y86Record records[BATCH_RECORDS];
+  struct Y86Cursor cursor;
+  struct OutBuffer ob;
+  size_t n;
+
+  if (openOutBuffer(&ob, image->sink, OUT_BUFFER_SIZE) != 0) {
+    return;
+  }
+  y86InitCursor(&cursor);
+  while ((n = y86DecodeBatch(image->code, image->length, 0, &cursor, records, BATCH_RECORDS)) > 0) {
+    for (size_t i = 0; i < n; i++) {
+      char *p = reserveOut(&ob, Y86_LINE_MAX);
+      commitOut(&ob, p + y86RenderRecord(&records[i], p));
+    }
+  }
+  closeOutBuffer(&ob);
+}
+
+/* Decode through one of the built-in sinks
+ */
+static void throughSink(const struct Image *image, int format) {
+  struct OutputSink sink;
+  struct OutBuffer ob;
+
+  if (openOutBuffer(&ob, image->sink, OUT_BUFFER_SIZE) == 0) {
+    openSink(&sink, format, &ob);
+    decodeToSink(&sink, image->code, image->length, 0);
+    closeOutBuffer(&ob);
+  }
+}
+
+static void sinkText(const struct Image *image) {
+  throughSink(image, SINK_TEXT);
+}
+
+static void sinkCompact(const struct Image *image) {
+  throughSink(image, SINK_COMPACT);
+}
+
+static void sinkJson(const struct Image *image) {
+  throughSink(image, SINK_JSONL);
+}
+
+static void sinkNull(const struct Image *image) {
+  throughSink(image, SINK_NULL);
+}
+
+static void binaryRows(const struct Image *image) {
+  writeRecordFile(image->sink, image->code, image->length, 0, RECORD_LAYOUT_ROWS);
+}
+
+static const struct {
+  const char *name;
+  void (*run)(const struct Image *);
+} paths[] = {
+  {"text", textSerial},
+  {"text -j", textParallel},
+  {"batch decode", batchOnly},
+  {"batch+render", batchRendered},
+  {"sink text", sinkText},
+  {"sink compact", sinkCompact},
+  {"sink jsonl", sinkJson},
+  {"sink null", sinkNull},
+  {"binary rows", binaryRows},
+};
+
+/* Count the instructions (valid code items) and the listing lines of an image
+ */
+static void countItems(const struct Image *image, unsigned long *instructions, unsigned long *lines) {
+  static struct Y86Record records[BATCH_RECORDS];
+  struct Y86Cursor cursor;
+  size_t n;
+
+  *instructions = 0;
+  *lines = 0;
+  y86InitCursor(&cursor);
+  while ((n = y86DecodeBatch(image->code, image->length, 0, &cursor, records, BATCH_RECORDS)) > 0) {
+    for (size_t i = 0; i < n; i++) {
+      *instructions += (records[i].kind != Y86_KIND_CODE) ? 0 : (records[i].flags & Y86_FLAG_SILENT) ? records[i].length : 1;
+      *lines += !(records[i].flags & Y86_FLAG_SILENT);
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  struct Image image;
+  int repeats = 3;
+
+  image.threads = 4;
+  while (argc > 1 && argv[1][0] == '-' && argc > 2) {
+    if (strcmp(argv[1], "-j") == 0) {
+      image.threads = atoi(argv[2]);
+    }
+    else if (strcmp(argv[1], "-r") == 0) {
+      repeats = atoi(argv[2]);
+    }
+    else {
+      break;
+    }
+    argc -= 2;
+    argv += 2;
+  }
+  if (argc < 2 || image.threads < 1 || repeats < 1) {
+    printf("Usage: %s [-j threads] [-r repeats] ImageFilename...\n", argv[0]);
+    return ERROR_RETURN;
+  }
+  image.sink = open("/dev/null", O_WRONLY);
+  if (image.sink < 0) {
+    printf("Failed to open /dev/null: %s\n", strerror(errno));
+    return ERROR_RETURN;
+  }
+
+  printf("%-28s %-14s %10s %12s %12s\n", "image", "path", "MB/s", "Minstr/s", "Mlines/s");
+  for (int f = 1; f < argc; f++) {
+    struct InputMap map;
+    unsigned long instructions, lines;
+    FILE *machineCode = fopen(argv[f], "rb");
+
+    if (machineCode == NULL || mapInput(machineCode, &map) != 0) {
+      printf("Failed to read %s: %s\n", argv[f], strerror(errno));
+      if (machineCode != NULL) {
+        fclose(machineCode);
+      }
+      continue;
+    }
+    image.code = map.data;
+    image.length = map.length;
+    countItems(&image, &instructions, &lines);
+
+    for (size_t p = 0; p < sizeof(paths) / sizeof(paths[0]); p++) {
+      double best = 0;
+      for (int r = 0; r < repeats; r++) {
+        double start = now();
+        paths[p].run(&image);
+        double elapsed = now() - start;
+        if (r == 0 || elapsed < best) {
+          best = elapsed;
+        }
+      }
+      if (best <= 0) {
+        best = 1e-9;
+      }
+      printf("%-28s %-14s %10.1f %12.2f %12.2f\n", argv[f], paths[p].name,
+             (double)image.length / best / 1e6, (double)instructions / best / 1e6, (double)lines / best / 1e6);
+    }
+    unmapInput(&map);
+    fclose(machineCode);
+  }
+  close(image.sink);
+  return SUCCESS;
+}
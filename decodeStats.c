@@ -0,0 +1,154 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "decodeStats.h"
+#include "printRoutines.h"
+
+static const char *const classNames[16] = {
+  "halt", "nop", "rrmovq/cmovXX", "irmovq", "rmmovq", "mrmovq", "OPq", "jXX",
+  "call", "ret", "pushq", "popq", "0xC?", "0xD?", "0xE?", "0xF?"
+};
+
+/* Seconds on a monotonic clock, for timing phases
+ */
+double statsClock(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* Read one byte per page so a mapped image is faulted in before decoding,
+ * which lets the input phase be timed on its own
+ */
+void touchImage(const uint8_t *code, size_t length) {
+  volatile uint8_t sink = 0;
+  size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+  for (size_t pos = 0; pos < length; pos += pageSize) {
+    sink ^= code[pos];
+  }
+  (void)sink;
+}
+
+/* Sweep code[0..length) exactly like the listing does, without writing
+ * anything, and count what every position turns out to be
+ * Sets decodeSeconds; the other phase times are left to the caller.
+ */
+void collectStats(const uint8_t *code, size_t length, struct DecodeStats *stats) {
+  double start = statsClock();
+  int skipHalt = 1;
+  size_t pos = 0;
+
+  stats->imageBytes = length;
+  while (pos < length) {
+    const uint8_t *instr = code + pos;
+    size_t avail = length - pos;
+    const struct OpDescriptor *op = &opTable[instr[0]];
+    int reason = dataRunReason(op, instr, avail);
+    int icode = instr[0] >> 4;
+
+    if (reason != DATA_NONE) {
+      int data = dataRunLength(op, instr, avail);
+      if (reason == DATA_BAD_OPCODE) {
+        stats->badOpcode++;
+      }
+      else if (reason == DATA_BAD_REGISTER) {
+        stats->badRegister[icode]++;
+      }
+      else {
+        stats->truncated[icode]++;
+      }
+      stats->quads += (data >= 8);
+      stats->bytes += (unsigned long)(data >= 8 ? data - 8 : data);
+      stats->dataBytes += (unsigned long)data;
+      skipHalt = 0;
+      pos += (size_t)data;
+    }
+    else if (instr[0] == 0x00) { //A whole run of halts, all but maybe the first silent
+      size_t run = zeroRunLength(code, pos, length);
+      stats->instructions[0] += (skipHalt == 0);
+      stats->silentHalts += run - (skipHalt == 0);
+      stats->lengthHistogram[1] += run;
+      stats->codeBytes += run;
+      skipHalt = 1;
+      pos += run;
+    }
+    else {
+      stats->instructions[icode]++;
+      stats->lengthHistogram[op->length]++;
+      stats->codeBytes += op->length;
+      skipHalt = 0;
+      pos += op->length;
+    }
+  }
+  stats->decodeSeconds = statsClock() - start;
+}
+
+static void printRate(FILE *out, const char *phase, double seconds, size_t bytes) {
+  if (seconds > 0) {
+    fprintf(out, "  %-10s %10.3f s %10.1f MB/s\n", phase, seconds, (double)bytes / seconds / 1e6);
+  }
+}
+
+static double percent(unsigned long part, size_t whole) {
+  return whole ? 100.0 * (double)part / (double)whole : 0.0;
+}
+
+/* Write a human readable report of stats to out
+ */
+void printStats(FILE *out, const struct DecodeStats *stats) {
+  unsigned long instructions = 0;
+  unsigned long badRegister = 0;
+  unsigned long truncated = 0;
+
+  for (int c = 0; c < 16; c++) {
+    instructions += stats->instructions[c];
+    badRegister += stats->badRegister[c];
+    truncated += stats->truncated[c];
+  }
+
+  fprintf(out, "Image bytes      %12lu\n", (unsigned long)stats->imageBytes);
+  fprintf(out, "Code bytes       %12lu (%.1f%%)\n", stats->codeBytes, percent(stats->codeBytes, stats->imageBytes));
+  fprintf(out, "Data bytes       %12lu (%.1f%%)\n", stats->dataBytes, percent(stats->dataBytes, stats->imageBytes));
+  fprintf(out, "Listing lines    %12lu\n", instructions + stats->quads + stats->bytes);
+
+  fprintf(out, "Instructions     %12lu\n", instructions);
+  for (int c = 0; c < 16; c++) {
+    if (stats->instructions[c] != 0) {
+      fprintf(out, "  %-14s %12lu\n", classNames[c], stats->instructions[c]);
+    }
+  }
+  fprintf(out, "  %-14s %12lu\n", "silent halts", stats->silentHalts);
+
+  fprintf(out, "Data items       %12lu (%lu .quad, %lu .byte)\n",
+          stats->badOpcode + badRegister + truncated, stats->quads, stats->bytes);
+  fprintf(out, "  %-30s %12lu\n", "not an opcode", stats->badOpcode);
+  for (int c = 0; c < 16; c++) {
+    if (stats->badRegister[c] != 0) {
+      char label[40];
+      snprintf(label, sizeof(label), "bad register in %s", classNames[c]);
+      fprintf(out, "  %-30s %12lu\n", label, stats->badRegister[c]);
+    }
+  }
+  for (int c = 0; c < 16; c++) {
+    if (stats->truncated[c] != 0) {
+      char label[40];
+      snprintf(label, sizeof(label), "truncated %s", classNames[c]);
+      fprintf(out, "  %-30s %12lu\n", label, stats->truncated[c]);
+    }
+  }
+
+  fprintf(out, "Instruction lengths\n");
+  for (int l = 1; l <= 10; l++) {
+    if (stats->lengthHistogram[l] != 0) {
+      fprintf(out, "  %2d bytes %18lu\n", l, stats->lengthHistogram[l]);
+    }
+  }
+
+  fprintf(out, "Phases\n");
+  printRate(out, "input", stats->inputSeconds, stats->imageBytes);
+  printRate(out, "decode", stats->decodeSeconds, stats->imageBytes);
+  printRate(out, "listing", stats->listingSeconds, stats->imageBytes);
+  printRate(out, "  write", stats->writeSeconds, stats->imageBytes);
+}
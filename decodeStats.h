@@ -0,0 +1,38 @@
+/* This file contains the prototypes and constants needed to use the
+   routines defined in decodeStats.c
+*/
+
+#ifndef _DECODESTATS_H_
+#define _DECODESTATS_H_
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* What a linear sweep found in an image and how long each phase took
+ * Classes are indexed by icode, the upper nibble of the first byte.
+ */
+struct DecodeStats {
+  size_t imageBytes;
+  unsigned long instructions[16];     //Valid instructions per class
+  unsigned long silentHalts;          //Halts the listing leaves out
+  unsigned long lengthHistogram[11];  //Valid instructions by length in bytes
+  unsigned long badOpcode;            //Data items starting with a byte that is no opcode
+  unsigned long badRegister[16];      //Data items from a failed register check, per class
+  unsigned long truncated[16];        //Data items from an instruction cut off by the end, per class
+  unsigned long quads;                //.quad lines
+  unsigned long bytes;                //.byte lines
+  unsigned long codeBytes;            //Bytes covered by valid instructions
+  unsigned long dataBytes;            //Bytes covered by .quad/.byte
+  double inputSeconds;                //Mapping and faulting in the image
+  double decodeSeconds;               //The classifying sweep, no output
+  double listingSeconds;              //Producing the listing, 0 if none was written
+  double writeSeconds;                //Part of listingSeconds spent in write()
+};
+
+double statsClock(void);
+void touchImage(const uint8_t *code, size_t length);
+void collectStats(const uint8_t *code, size_t length, struct DecodeStats *stats);
+void printStats(FILE *out, const struct DecodeStats *stats);
+
+#endif /* DECODESTATS */
@@ -0,0 +1,143 @@
+#include <string.h>
+#include "disasm.h"
+#include "printRoutines.h"
+
+/* Start decoding at the beginning of an image, the way the listing does
+ */
+void y86InitCursor(struct Y86Cursor *cursor) {
+  cursor->pos = 0;
+  cursor->skipHalt = 1;
+  cursor->dataLeft = 0;
+}
+
+/* Fill in a data record for n (8 or 1) bytes at bytes
+ */
+static void dataRecord(struct Y86Record *record, const uint8_t *bytes, int n, uint64_t address) {
+  memset(record, 0, sizeof(*record));
+  record->address = address;
+  record->immediate = readLittleEndian(bytes, n);
+  record->rA = Y86_NO_REG;
+  record->rB = Y86_NO_REG;
+  record->length = (uint8_t)n;
+  record->kind = (n == 8) ? Y86_KIND_QUAD : Y86_KIND_BYTE;
+}
+
+/* Decode code[0..length), whose first byte lives at baseAddr, into records
+ * Decoding starts at cursor and stops at the end of the image or once the
+ * maxRecords records are full; cursor is advanced so the next call carries
+ * on, in the middle of a data run if need be. Data runs become one .quad
+ * record and/or .byte records exactly as in the listing and every listed
+ * halt gets a record. The halts the listing leaves out are skipped in one
+ * scan, as decodeRange does, and handed back as a single record flagged
+ * Y86_FLAG_SILENT whose length is the number of them.
+ * Returns the number of records written, 0 once the image is exhausted
+ */
+size_t y86DecodeBatch(const uint8_t *code, size_t length, uint64_t baseAddr, struct Y86Cursor *cursor,
+                      struct Y86Record *records, size_t maxRecords) {
+  size_t count = 0;
+  size_t pos = cursor->pos;
+  int skipHalt = cursor->skipHalt;
+  int dataLeft = cursor->dataLeft;
+
+  while (pos < length && count < maxRecords) {
+    const uint8_t *instr = code + pos;
+    size_t avail = length - pos;
+    const struct OpDescriptor *op = &opTable[instr[0]];
+    int data;
+
+    if (dataLeft > 0) { //The .byte records of a run started earlier
+      dataRecord(&records[count++], instr, 1, baseAddr + pos);
+      dataLeft--;
+      pos++;
+      continue;
+    }
+    data = dataRunLength(op, instr, avail);
+    if (data != 0) {
+      //One quad if the run has 8 bytes, then a .byte record for each byte beyond it
+      if (data >= 8) {
+        dataRecord(&records[count++], instr, 8, baseAddr + pos);
+        pos += 8;
+        data -= 8;
+      }
+      dataLeft = data;
+      skipHalt = 0;
+    }
+    else {
+      struct Y86Record *record = &records[count++];
+      int hasRegs = (op->rAMask != 0);
+      record->address = baseAddr + pos;
+      record->immediate = 0;
+      if (op->shape == SHAPE_DEST) {
+        record->immediate = readLittleEndian(instr + 1, 8);
+      }
+      else if (op->length == 10) {
+        record->immediate = readLittleEndian(instr + 2, 8);
+      }
+      record->opcode = instr[0] >> 4;
+      record->ifun = instr[0] & 0xF;
+      record->rA = hasRegs ? instr[1] >> 4 : Y86_NO_REG;
+      record->rB = hasRegs ? instr[1] & 0xF : Y86_NO_REG;
+      record->length = op->length;
+      record->kind = Y86_KIND_CODE;
+      record->flags = 0;
+      if (instr[0] == 0x00 && skipHalt) { //The rest of a run of halts
+        size_t run = zeroRunLength(code, pos, length);
+        record->length = (uint32_t)(run < Y86_RUN_MAX ? run : Y86_RUN_MAX);
+        record->flags = Y86_FLAG_SILENT;
+      }
+      skipHalt = (instr[0] == 0x00);
+      pos += record->length;
+    }
+  }
+  cursor->pos = pos;
+  cursor->skipHalt = skipHalt;
+  cursor->dataLeft = dataLeft;
+  return count;
+}
+
+/* Render one record as its listing line, newline included, into line
+ * The instruction bytes are rebuilt from the record so the encoding column
+ * matches the listing exactly. Records are not trusted: one that could not
+ * have come from y86DecodeBatch renders nothing.
+ * Returns the length of the line, 0 for silent halts which have no line and
+ * for invalid records (a code record whose first byte is not an opcode, a
+ * data record of no bytes or more than 8, a nibble field above 0xF)
+ */
+size_t y86RenderRecord(const struct Y86Record *record, char line[Y86_LINE_MAX]) {
+  uint8_t bytes[10];
+  char *end;
+
+  if (record->flags & Y86_FLAG_SILENT) {
+    return 0;
+  }
+  if (record->kind != Y86_KIND_CODE) {
+    if (record->length == 0 || record->length > 8) {
+      return 0;
+    }
+    for (int i = 0; i < record->length; i++) {
+      bytes[i] = (uint8_t)(record->immediate >> (8 * i));
+    }
+    end = putDataLine(line, bytes, record->length, record->address);
+  }
+  else {
+    const struct OpDescriptor *op;
+    int immediateAt = 2;
+    if (record->opcode > 0xF || record->ifun > 0xF || record->rA > 0xF || record->rB > 0xF) {
+      return 0;
+    }
+    bytes[0] = (uint8_t)(record->opcode << 4 | record->ifun);
+    bytes[1] = (uint8_t)(record->rA << 4 | record->rB);
+    op = &opTable[bytes[0]];
+    if (op->length == 0) {
+      return 0;
+    }
+    if (op->shape == SHAPE_DEST) {
+      immediateAt = 1;
+    }
+    for (int i = 0; i < 8 && immediateAt + i < 10; i++) {
+      bytes[immediateAt + i] = (uint8_t)(record->immediate >> (8 * i));
+    }
+    end = putInstruction(line, op, bytes, record->address);
+  }
+  return (size_t)(end - line);
+}
@@ -0,0 +1,58 @@
+/* This file contains the prototypes and constants needed to use libdisasm,
+   the routines defined in disasm.c. It is the only header an embedding
+   program needs.
+*/
+
+#ifndef _DISASM_H_
+#define _DISASM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define Y86_LINE_MAX 128 //Room needed by y86RenderRecord for one line
+#define Y86_NO_REG 0xF   //rA/rB value of an instruction without that register
+
+//What a record stands for
+enum Y86Kind {
+  Y86_KIND_CODE, //A valid instruction
+  Y86_KIND_QUAD, //8 bytes of data
+  Y86_KIND_BYTE  //1 byte of data
+};
+
+#define Y86_FLAG_SILENT 0x1 //Halts the listing leaves out (they follow another halt)
+#define Y86_RUN_MAX 0xFFFFFFFFu //Most halts one silent record stands for
+
+/* One decoded instruction or data item, 32 bytes
+ * A silent record stands for a whole run of halts, one per byte of length.
+ */
+struct Y86Record {
+  uint64_t address;   //Address of the first byte
+  uint64_t immediate; //V, D or Dest of an instruction, the value of a quad or byte
+  uint32_t length;    //Number of bytes covered
+  uint8_t opcode;     //icode, upper nibble of the first byte (code only)
+  uint8_t ifun;       //Lower nibble of the first byte (code only)
+  uint8_t rA;         //Y86_NO_REG if unused
+  uint8_t rB;         //Y86_NO_REG if unused
+  uint8_t kind;       //A Y86Kind
+  uint8_t flags;      //Y86_FLAG_* bits
+};
+
+/* Where a batch decode stopped; set up with y86InitCursor before the first batch
+ */
+struct Y86Cursor {
+  size_t pos;   //Offset of the next item in the image
+  int skipHalt; //If 1, the next halt is silent
+  int dataLeft; //Bytes at pos still owed as .byte records of a data run
+};
+
+void y86InitCursor(struct Y86Cursor *cursor);
+size_t y86DecodeBatch(const uint8_t *code, size_t length, uint64_t baseAddr, struct Y86Cursor *cursor,
+                      struct Y86Record *records, size_t maxRecords);
+/* y86RenderRecord writes the listing line of a record, newline included, and
+ * returns its length. It returns 0 and writes nothing for silent halts and
+ * for records y86DecodeBatch never produces: code whose first byte has no
+ * opcode, data of no bytes or more than 8, or nibble fields above 0xF.
+ */
+size_t y86RenderRecord(const struct Y86Record *record, char line[Y86_LINE_MAX]);
+
+#endif /* DISASM */
@@ -7,46 +7,370 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <limits.h>
 #include "printRoutines.h"
+#include "inputMap.h"
+#include "batchMode.h"
+#include "flowGraph.h"
+#include "imageDiff.h"
+#include "outputSink.h"
+#include "addressIndex.h"
+#include "outBuffer.h"
 
 #define ERROR_RETURN -1
 #define SUCCESS 0
+#define MAX_THREADS 1024
+#define MAX_ENTRIES 256
 
 int main(int argc, char **argv) {
 
   FILE *machineCode, *outputFile;
   long currAddr = 0;
+  unsigned long endAddr = INPUT_TO_END;
+  struct DecodeOptions options = {.endOffset = INPUT_TO_END, .threads = 1, .output = OUTPUT_TEXT, .stats = STATS_OFF,
+                                  .labels = LABELS_OFF, .graph = GRAPH_OFF, .format = SINK_TEXT}; //Everything else 0 or NULL
+  char *program = argv[0];
+  unsigned long entries[MAX_ENTRIES];
+  int incremental = 0;
+  char *cachePath = NULL;
+  char *manifest = NULL, *inputDir = NULL, *outputDir = NULL;
+  int diff = 0;
+  int query = 0;
+  FILE *status = stdout; //Where progress and error messages go
+
+  // Options come before the file names
+  while (argc > 1 && argv[1][0] == '-' && argv[1][1] != '\0') {
+    if (strcmp(argv[1], "-j") == 0 && argc > 2) {
+      char *end;
+      long threads = strtol(argv[2], &end, 0);
+      if (*end != '\0' || threads < 1 || threads > MAX_THREADS) {
+        printf("Invalid thread count: %s\n", argv[2]);
+        return ERROR_RETURN;
+      }
+      options.threads = (int)threads;
+      argc -= 2;
+      argv += 2;
+    }
+    else if (strcmp(argv[1], "-b") == 0 && argc > 2) {
+      if (strcmp(argv[2], "rows") == 0) {
+        options.output = OUTPUT_ROWS;
+      }
+      else if (strcmp(argv[2], "columns") == 0) {
+        options.output = OUTPUT_COLUMNS;
+      }
+      else {
+        printf("Invalid binary layout (rows or columns): %s\n", argv[2]);
+        return ERROR_RETURN;
+      }
+      argc -= 2;
+      argv += 2;
+    }
+    else if (strcmp(argv[1], "-e") == 0 && argc > 2) {
+      char *end;
+      errno = 0;
+      unsigned long entry = strtoul(argv[2], &end, 0);
+      if (*end != '\0' || errno != 0 || options.entryCount == MAX_ENTRIES) {
+        printf("Invalid entry address: %s\n", argv[2]);
+        return ERROR_RETURN;
+      }
+      entries[options.entryCount++] = entry;
+      options.entries = entries;
+      options.follow = 1;
+      argc -= 2;
+      argv += 2;
+    }
+    else if (strcmp(argv[1], "--follow") == 0) {
+      options.follow = 1;
+      argc--;
+      argv++;
+    }
+    else if (strcmp(argv[1], "--labels") == 0) {
+      options.labels = options.labels == LABELS_XREF ? LABELS_XREF : LABELS_ON;
+      argc--;
+      argv++;
+    }
+    else if (strcmp(argv[1], "--xref") == 0) {
+      options.labels = LABELS_XREF;
+      argc--;
+      argv++;
+    }
+    else if (strcmp(argv[1], "--batch") == 0 && argc > 2) {
+      manifest = argv[2];
+      argc -= 2;
+      argv += 2;
+    }
+    else if (strcmp(argv[1], "--batch-dir") == 0 && argc > 3) {
+      inputDir = argv[2];
+      outputDir = argv[3];
+      argc -= 3;
+      argv += 3;
+    }
+    else if (strcmp(argv[1], "--diff") == 0) {
+      diff = 1;
+      argc--;
+      argv++;
+    }
+    else if (strcmp(argv[1], "--query") == 0) {
+      query = 1;
+      argc--;
+      argv++;
+    }
+    else if (strcmp(argv[1], "--index") == 0 && argc > 2) {
+      options.indexPath = argv[2];
+      argc -= 2;
+      argv += 2;
+    }
+    else if (strcmp(argv[1], "--index-every") == 0 && argc > 2) {
+      char *end;
+      errno = 0;
+      unsigned long every = strtoul(argv[2], &end, 0);
+      if (*end != '\0' || errno != 0 || every < 1 || every > UINT32_MAX) {
+        printf("Invalid checkpoint interval: %s\n", argv[2]);
+        return ERROR_RETURN;
+      }
+      options.indexEvery = (unsigned)every;
+      argc -= 2;
+      argv += 2;
+    }
+    else if (strcmp(argv[1], "--incremental") == 0) {
+      incremental = 1;
+      argc--;
+      argv++;
+    }
+    else if (strcmp(argv[1], "--cfg") == 0 && argc > 2) {
+      if (strcmp(argv[2], "json") == 0) {
+        options.graph = GRAPH_JSON;
+      }
+      else if (strcmp(argv[2], "dot") == 0) {
+        options.graph = GRAPH_DOT;
+      }
+      else {
+        printf("Invalid graph format (json or dot): %s\n", argv[2]);
+        return ERROR_RETURN;
+      }
+      argc -= 2;
+      argv += 2;
+    }
+    else if (strcmp(argv[1], "--format") == 0 && argc > 2) {
+      options.format = findSinkFormat(argv[2]);
+      if (options.format < 0) {
+        printf("Invalid format (text, compact, jsonl or null): %s\n", argv[2]);
+        return ERROR_RETURN;
+      }
+      argc -= 2;
+      argv += 2;
+    }
+    else if (strcmp(argv[1], "--ir") == 0) {
+      options.ir = 1;
+      argc--;
+      argv++;
+    }
+    else if (strcmp(argv[1], "--fill") == 0) {
+      options.fill = 1;
+      argc--;
+      argv++;
+    }
+    else if (strcmp(argv[1], "--stats") == 0) {
+      options.stats = STATS_ALONGSIDE;
+      argc--;
+      argv++;
+    }
+    else if (strcmp(argv[1], "--stats-only") == 0) {
+      options.stats = STATS_ONLY;
+      argc--;
+      argv++;
+    }
+    else {
+      printf("Unknown option: %s\n", argv[1]);
+      return ERROR_RETURN;
+    }
+  }
+
+  // A batch takes the place of the file names; -j is the number of files in flight
+  if (manifest != NULL || inputDir != NULL) {
+    int failed;
+    if (argc != 1) {
+      printf("Usage: %s [-j threads] --batch Manifest | --batch-dir InputDir OutputDir\n", program);
+      return ERROR_RETURN;
+    }
+    if (manifest != NULL) {
+      failed = runBatchManifest(manifest, options.threads);
+    }
+    else {
+      failed = runBatchDirectory(inputDir, outputDir, options.threads);
+    }
+    return failed == 0 ? SUCCESS : ERROR_RETURN;
+  }
+
+  // A diff takes two images and writes only the regions where they differ
+  if (diff) {
+    FILE *beforeCode, *afterCode;
+    int result;
+    if (argc != 4) {
+      printf("Usage: %s --diff OldFilename NewFilename OutputFilename|-\n", program);
+      return ERROR_RETURN;
+    }
+    status = strcmp(argv[3], "-") == 0 ? stderr : stdout;
+    beforeCode = fopen(argv[1], "rb");
+    afterCode = fopen(argv[2], "rb");
+    outputFile = strcmp(argv[3], "-") == 0 ? stdout : fopen(argv[3], "w");
+    if (beforeCode == NULL || afterCode == NULL || outputFile == NULL) {
+      fprintf(status, "Failed to open %s: %s\n", beforeCode == NULL ? argv[1] : afterCode == NULL ? argv[2] : argv[3], strerror(errno));
+      result = ERROR_RETURN;
+    }
+    else {
+      fprintf(status, "Comparing %s with %s, saving output to %s\n", argv[1], argv[2], argv[3]);
+      result = diffMachineCode(outputFile, beforeCode, afterCode) == 0 ? SUCCESS : ERROR_RETURN;
+      if (result != SUCCESS) {
+        fprintf(status, "Failed to compare %s with %s: %s\n", argv[1], argv[2], strerror(errno));
+      }
+    }
+    if (beforeCode != NULL) {
+      fclose(beforeCode);
+    }
+    if (afterCode != NULL) {
+      fclose(afterCode);
+    }
+    if (outputFile != NULL) {
+      fclose(outputFile);
+    }
+    return result;
+  }
+
+  // A query prints the lines of an indexed listing that cover an address range
+  if (query) {
+    int indexFd, listingFd, result = ERROR_RETURN;
+    unsigned long low, high = 0;
+    char *end;
+    if (argc != 5) {
+      printf("Usage: %s --query IndexFilename ListingFilename lowAddress highAddress|+length\n", program);
+      return ERROR_RETURN;
+    }
+    errno = 0;
+    low = strtoul(argv[3], &end, 0);
+    if (*end == '\0' && errno == 0) {
+      int isLength = (argv[4][0] == '+');
+      high = strtoul(isLength ? argv[4] + 1 : argv[4], &end, 0);
+      if (isLength) {
+        high = (high > ULONG_MAX - low) ? ULONG_MAX : low + high;
+      }
+    }
+    if (*end != '\0' || errno != 0 || high < low) {
+      printf("Invalid address range: %s %s\n", argv[3], argv[4]);
+      return ERROR_RETURN;
+    }
+    indexFd = open(argv[1], O_RDONLY);
+    listingFd = open(argv[2], O_RDONLY);
+    if (indexFd < 0 || listingFd < 0) {
+      fprintf(stderr, "Failed to open %s: %s\n", indexFd < 0 ? argv[1] : argv[2], strerror(errno));
+    }
+    else {
+      struct OutBuffer ob;
+      if (fflush(stdout) == 0 && openOutBuffer(&ob, fileno(stdout), OUT_BUFFER_SIZE) == 0) {
+        int failed = queryListing(&ob, indexFd, listingFd, low, high) != 0;
+        failed |= closeOutBuffer(&ob) != 0;
+        result = failed ? ERROR_RETURN : SUCCESS;
+      }
+      if (result != SUCCESS) {
+        fprintf(stderr, "Failed to query %s with %s: %s\n", argv[2], argv[1], strerror(errno));
+      }
+    }
+    if (indexFd >= 0) {
+      close(indexFd);
+    }
+    if (listingFd >= 0) {
+      close(listingFd);
+    }
+    return result;
+  }
+
+  if (options.indexPath != NULL && (options.output != OUTPUT_TEXT || options.follow || options.labels != LABELS_OFF ||
+                                    options.fill || incremental || options.ir || options.graph != GRAPH_OFF ||
+                                    options.format != SINK_TEXT)) {
+    printf("--index only works with a plain text listing\n");
+    return ERROR_RETURN;
+  }
+  if (options.format != SINK_TEXT && (options.output != OUTPUT_TEXT || options.follow || options.labels != LABELS_OFF ||
+                                      options.fill || options.graph != GRAPH_OFF || options.ir || incremental)) {
+    printf("--format cannot be combined with -b, --follow, --labels, --xref, --fill, --incremental, --cfg or --ir\n");
+    return ERROR_RETURN;
+  }
+  if (options.stats == STATS_ONLY && (options.output != OUTPUT_TEXT || options.follow || options.labels != LABELS_OFF ||
+                                      options.fill || incremental || options.ir || options.graph != GRAPH_OFF ||
+                                      options.format != SINK_TEXT || options.indexPath != NULL)) {
+    printf("--stats-only writes the report instead of any output and cannot be combined with other output modes\n");
+    return ERROR_RETURN;
+  }
+  if (options.stats == STATS_ALONGSIDE && (options.follow || options.labels != LABELS_OFF || options.fill ||
+                                           options.graph != GRAPH_OFF || options.format != SINK_TEXT)) {
+    printf("--stats describes the plain listing and cannot be combined with --follow, --labels, --xref, --fill, --cfg or --format\n");
+    return ERROR_RETURN;
+  }
+  if ((options.follow || options.labels != LABELS_OFF) && options.output != OUTPUT_TEXT) {
+    printf("Following control flow and labels only apply to a text listing\n");
+    return ERROR_RETURN;
+  }
+  if (incremental && (options.output != OUTPUT_TEXT || options.follow || options.labels != LABELS_OFF || options.fill)) {
+    printf("--incremental only works with a plain text listing\n");
+    return ERROR_RETURN;
+  }
+  if (options.graph != GRAPH_OFF && (options.output != OUTPUT_TEXT || options.follow || options.labels != LABELS_OFF || options.fill || incremental)) {
+    printf("--cfg cannot be combined with other output modes\n");
+    return ERROR_RETURN;
+  }
+  if (options.ir && (options.output != OUTPUT_TEXT || options.follow || options.labels != LABELS_OFF || options.fill || incremental)) {
+    printf("--ir only works with a plain text listing\n");
+    return ERROR_RETURN;
+  }
+  if (options.follow && options.labels != LABELS_OFF) {
+    printf("Labels are not available when following control flow\n");
+    return ERROR_RETURN;
+  }
 
   // Verify that the command line has an appropriate number
   // of arguments
 
-  if (argc < 3 || argc > 4) {
-    printf("Usage: %s InputFilename OutputFilename [startingOffset]\n", argv[0]);
+  if (argc < 3 || argc > 5) {
+    printf("Usage: %s [-j threads] [-b rows|columns] [--fill] [--follow] [-e entry]... [--labels|--xref] [--incremental] [--ir] [--cfg json|dot] [--format text|compact|jsonl|null] [--index IndexFilename [--index-every n]] [--stats|--stats-only] InputFilename|- OutputFilename|- [startingOffset [endOffset|+length]]\n", program);
+    printf("       %s [-j threads] --batch Manifest | --batch-dir InputDir OutputDir\n", program);
+    printf("       %s --diff OldFilename NewFilename OutputFilename|-\n", program);
+    printf("       %s --query IndexFilename ListingFilename lowAddress highAddress|+length\n", program);
+    return ERROR_RETURN;
+  }
+
+  if (incremental && strcmp(argv[2], "-") == 0) {
+    printf("--incremental needs a named output file for its cache\n");
     return ERROR_RETURN;
   }
 
+  // A file name of "-" means stdin or stdout. The listing then owns stdout,
+  // so status messages go to stderr.
+  if (strcmp(argv[2], "-") == 0) {
+    status = stderr;
+  }
+
   // First argument is the file to read, attempt to open it
   // for reading and verify that the open did occur.
-  machineCode = fopen(argv[1], "rb");
+  machineCode = strcmp(argv[1], "-") == 0 ? stdin : fopen(argv[1], "rb");
 
   if (machineCode == NULL) {
-    printf("Failed to open %s: %s\n", argv[1], strerror(errno));
+    fprintf(status, "Failed to open %s: %s\n", argv[1], strerror(errno));
     return ERROR_RETURN;
   }
 
   // Second argument is the file to write, attempt to open it
   // for writing and verify that the open did occur.
-  outputFile = fopen(argv[2], "w");
+  outputFile = strcmp(argv[2], "-") == 0 ? stdout : fopen(argv[2], "w");
 
   if (outputFile == NULL) {
-    printf("Failed to open %s: %s\n", argv[2], strerror(errno));
+    fprintf(status, "Failed to open %s: %s\n", argv[2], strerror(errno));
     fclose(machineCode);
     return ERROR_RETURN;
   }
 
   // If there is a 3rd argument present it is an offset so
   // convert it to a value.
-  if (4 == argc) {
+  if (argc >= 4) {
     // See man page for strtol() as to why we check for errors by examining errno
     errno = 0;
     currAddr = strtol(argv[3], NULL, 0);
@@ -58,8 +382,29 @@ int main(int argc, char **argv) {
     }
   }
 
-  printf("Opened %s, starting offset 0x%lX\n", argv[1], currAddr);
-  printf("Saving output to %s\n", argv[2]);
+  // If there is a 4th argument present it ends the window to decode, either
+  // as an absolute offset or, when prefixed with '+', as a length.
+  if (5 == argc) {
+    char *end = argv[4];
+    int isLength = (end[0] == '+');
+    errno = 0;
+    endAddr = strtoul(isLength ? end + 1 : end, NULL, 0);
+    if (errno == 0 && isLength) {
+      endAddr = (endAddr > INPUT_TO_END - (unsigned long)currAddr) ? INPUT_TO_END : (unsigned long)currAddr + endAddr;
+    }
+    if (errno != 0 || endAddr < (unsigned long)currAddr) {
+      fprintf(status, "Invalid end offset on command line: %s\n", argv[4]);
+      fclose(machineCode);
+      fclose(outputFile);
+      return ERROR_RETURN;
+    }
+  }
+
+  fprintf(status, "Opened %s, starting offset 0x%lX\n", argv[1], currAddr);
+  if (endAddr != INPUT_TO_END) {
+    fprintf(status, "Stopping at offset 0x%lX\n", endAddr);
+  }
+  fprintf(status, "Saving output to %s\n", argv[2]);
 
   /* Comment or delete the following line and this comment before
    * handing in your final version.
@@ -67,8 +412,29 @@ int main(int argc, char **argv) {
   //samplePrint(outputFile);
 
   // Your code starts here.
-  readMachineCode(outputFile, machineCode, currAddr); //Test that we can read machine code
+  options.startingOffset = (unsigned long)currAddr;
+  options.endOffset = endAddr;
+  // The region cache lives next to the output as OutputFilename.cache
+  if (incremental) {
+    cachePath = malloc(strlen(argv[2]) + 7);
+    if (cachePath == NULL) {
+      fprintf(status, "Failed to set up the cache for %s: %s\n", argv[2], strerror(errno));
+      fclose(machineCode);
+      fclose(outputFile);
+      return ERROR_RETURN;
+    }
+    sprintf(cachePath, "%s.cache", argv[2]);
+    options.cachePath = cachePath;
+  }
+  if (readMachineCode(outputFile, machineCode, &options) != 0) {
+    fprintf(status, "Failed to disassemble %s: %s\n", argv[1], strerror(errno));
+    free(cachePath);
+    fclose(machineCode);
+    fclose(outputFile);
+    return ERROR_RETURN;
+  }
 
+  free(cachePath);
   fclose(machineCode);
   fclose(outputFile);
   return SUCCESS;
@@ -0,0 +1,196 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "flowDecode.h"
+#include "printRoutines.h"
+
+/* Recursive descent: instructions are only decoded where control can reach
+ * them from an entry point. Two bitmaps with one bit per image byte record
+ * which bytes start an instruction and which belong to one, so memory is a
+ * quarter of the image plus one worklist entry per pending branch target.
+ */
+struct Flow {
+  const uint8_t *code;
+  size_t length;
+  unsigned long baseAddr;
+  uint64_t *starts;   //Bit set where a reached instruction starts
+  uint64_t *covered;  //Bit set for every byte of a reached instruction
+  size_t *work;       //Offsets still to be traced
+  size_t workCount;
+  size_t workCapacity;
+};
+
+static inline int testBit(const uint64_t *bitmap, size_t pos) {
+  return (int)((bitmap[pos / 64] >> (pos % 64)) & 1);
+}
+
+static inline void setBit(uint64_t *bitmap, size_t pos) {
+  bitmap[pos / 64] |= (uint64_t)1 << (pos % 64);
+}
+
+/* Offset of the first set bit at or after pos, or length if there is none
+ */
+static size_t nextSetBit(const uint64_t *bitmap, size_t pos, size_t length) {
+  size_t word = pos / 64;
+  uint64_t bits;
+
+  if (pos >= length) {
+    return length;
+  }
+  bits = bitmap[word] & (~(uint64_t)0 << (pos % 64));
+  while (bits == 0) {
+    if (++word * 64 >= length) {
+      return length;
+    }
+    bits = bitmap[word];
+  }
+#if defined(__GNUC__)
+  pos = word * 64 + (size_t)__builtin_ctzll(bits);
+#else
+  for (pos = word * 64; ((bits >> (pos % 64)) & 1) == 0; pos++) {
+  }
+#endif
+  return pos < length ? pos : length;
+}
+
+/* Queue the instruction at address target unless it lies outside the image
+ * or is already part of the reached code
+ * Returns 0 on success and -1 if the worklist could not grow
+ */
+static int pushTarget(struct Flow *flow, uint64_t target) {
+  size_t pos;
+
+  if (target < flow->baseAddr || target - flow->baseAddr >= flow->length) {
+    return 0;
+  }
+  pos = (size_t)(target - flow->baseAddr);
+  if (testBit(flow->covered, pos)) {
+    return 0;
+  }
+  if (flow->workCount == flow->workCapacity) {
+    size_t capacity = flow->workCapacity ? 2 * flow->workCapacity : 1024;
+    size_t *work = realloc(flow->work, capacity * sizeof(*work));
+    if (work == NULL) {
+      return -1;
+    }
+    flow->work = work;
+    flow->workCapacity = capacity;
+  }
+  flow->work[flow->workCount++] = pos;
+  return 0;
+}
+
+/* Follow straight line code from pos, claiming each instruction on the way
+ * and queueing the targets of jXX and call. The trace ends at halt, ret and
+ * jmp, at bytes that do not decode, and where it would run into code that
+ * was already claimed (the first trace to reach a byte wins).
+ * Returns 0 on success and -1 if the worklist could not grow
+ */
+static int trace(struct Flow *flow, size_t pos) {
+  while (pos < flow->length && !testBit(flow->covered, pos)) {
+    const uint8_t *instr = flow->code + pos;
+    const struct OpDescriptor *op = &opTable[instr[0]];
+
+    if (dataRunLength(op, instr, flow->length - pos) != 0) {
+      return 0;
+    }
+    for (int i = 1; i < op->length; i++) {
+      if (testBit(flow->covered, pos + i)) {
+        return 0;
+      }
+    }
+    setBit(flow->starts, pos);
+    for (int i = 0; i < op->length; i++) {
+      setBit(flow->covered, pos + i);
+    }
+
+    if ((instr[0] >> 4) == 0x7 || instr[0] == 0x80) { //jXX, call
+      if (pushTarget(flow, readLittleEndian(instr + 1, 8)) != 0) {
+        return -1;
+      }
+    }
+    if (instr[0] == 0x00 || instr[0] == 0x90 || instr[0] == 0x70) { //halt, ret, jmp
+      return 0;
+    }
+    pos += op->length;
+  }
+  return 0;
+}
+
+/* List the bytes code[pos..end) that no trace reached as .quad/.byte lines
+ * (or .fill lines for runs of identical quads if fill is set)
+ */
+static void listData(struct OutBuffer *out, const struct Flow *flow, size_t pos, size_t end, int fill) {
+  while (pos < end) {
+    const uint8_t *bytes = flow->code + pos;
+    unsigned long currAddr = flow->baseAddr + pos;
+    size_t count;
+
+    if (end - pos < 8) {
+      pos += (size_t)quadOrByteCase(out, bytes, (int)(end - pos), currAddr);
+    }
+    else if (fill && (count = quadRunLength(flow->code, pos, end - 7)) > 1) {
+      commitOut(out, putFillLine(reserveOut(out, OUT_LINE_MAX), bytes, count, currAddr));
+      pos += 8 * count;
+    }
+    else {
+      pos += (size_t)quadOrByteCase(out, bytes, 8, currAddr);
+    }
+  }
+}
+
+/* Decode code[0..length), whose first byte lives at baseAddr, by following
+ * control flow from the entryCount addresses in entries, and write the listing
+ * to out in address order. Every reached instruction is listed (halts
+ * included); everything else is listed as data.
+ * Returns 0 on success and -1 on failure (errno describes the failure)
+ */
+int decodeFollowing(struct OutBuffer *out, const uint8_t *code, size_t length, unsigned long baseAddr,
+                    const unsigned long *entries, int entryCount, int fill) {
+  struct Flow flow;
+  size_t words = (length + 63) / 64;
+  int result = 0;
+
+  memset(&flow, 0, sizeof(flow));
+  flow.code = code;
+  flow.length = length;
+  flow.baseAddr = baseAddr;
+  flow.starts = calloc(words ? words : 1, sizeof(uint64_t));
+  flow.covered = calloc(words ? words : 1, sizeof(uint64_t));
+  if (flow.starts == NULL || flow.covered == NULL) {
+    result = -1;
+    goto done;
+  }
+
+  for (int i = entryCount - 1; i >= 0 && result == 0; i--) { //Popped in the order given
+    result = pushTarget(&flow, entries[i]);
+  }
+  while (flow.workCount > 0 && result == 0) {
+    result = trace(&flow, flow.work[--flow.workCount]);
+  }
+  if (result != 0) {
+    errno = ENOMEM;
+    goto done;
+  }
+
+  for (size_t pos = 0; pos < length; ) {
+    size_t next = nextSetBit(flow.starts, pos, length);
+    listData(out, &flow, pos, next, fill);
+    if (next < length) {
+      const struct OpDescriptor *op = &opTable[code[next]];
+      commitOut(out, putInstruction(reserveOut(out, OUT_LINE_MAX), op, code + next, baseAddr + next));
+      next += op->length;
+    }
+    pos = next;
+  }
+  if (out->error != 0) {
+    errno = out->error;
+    result = -1;
+  }
+
+done:
+  free(flow.starts);
+  free(flow.covered);
+  free(flow.work);
+  return result;
+}
@@ -0,0 +1,15 @@
+/* This file contains the prototypes and constants needed to use the
+   routines defined in flowDecode.c
+*/
+
+#ifndef _FLOWDECODE_H_
+#define _FLOWDECODE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "outBuffer.h"
+
+int decodeFollowing(struct OutBuffer *out, const uint8_t *code, size_t length, unsigned long baseAddr,
+                    const unsigned long *entries, int entryCount, int fill);
+
+#endif /* FLOWDECODE */
@@ -0,0 +1,327 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "flowGraph.h"
+#include "disasm.h"
+
+#define GRAPH_LINE_MAX 256 //Upper bound on one line of JSON or DOT
+
+static const char *const edgeNames[3] = {"fall", "jump", "call"};
+
+/* 1 if item index is a listed instruction (not data, not a run of silent halts)
+ */
+static int isCodeItem(const struct ImageIr *ir, size_t index) {
+  return irChunkOf(ir, index)->flags[index % IR_CHUNK] == Y86_KIND_CODE;
+}
+
+static size_t countBits(uint64_t word) {
+#if defined(__GNUC__)
+  return (size_t)__builtin_popcountll(word);
+#else
+  size_t count = 0;
+  for (; word != 0; word &= word - 1) {
+    count++;
+  }
+  return count;
+#endif
+}
+
+static unsigned char itemIcode(const struct ImageIr *ir, size_t index) {
+  return irChunkOf(ir, index)->opcode[index % IR_CHUNK] >> 4;
+}
+
+static uint64_t itemImmediate(const struct ImageIr *ir, size_t index) {
+  return irChunkOf(ir, index)->immediate[index % IR_CHUNK];
+}
+
+/* 1 if the instruction at item index ends a block: halt, jXX, call or ret
+ */
+static int endsBlock(const struct ImageIr *ir, size_t index) {
+  unsigned char icode = itemIcode(ir, index);
+  return icode == 0x0 || icode == 0x7 || icode == 0x8 || icode == 0x9;
+}
+
+/* The item a jXX/call destination lands on if it is the start of a listed
+ * instruction, IR_NONE otherwise
+ */
+static size_t targetItem(const struct ImageIr *ir, uint64_t address) {
+  size_t item = findIrItem(ir, address);
+  if (item == IR_NONE || irAddress(ir, item) != address || !isCodeItem(ir, item)) {
+    return IR_NONE;
+  }
+  return item;
+}
+
+/* Binary search for the block whose first item is item
+ */
+static size_t blockOfItem(const struct FlowGraph *graph, size_t item) {
+  size_t low = 0, high = graph->blockCount;
+
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (graph->firstItem[mid] < item) {
+      low = mid + 1;
+    }
+    else {
+      high = mid;
+    }
+  }
+  return (low < graph->blockCount && graph->firstItem[low] == item) ? low : BLOCK_NONE;
+}
+
+/* Mark the first item of every block in leaders, one bit per item
+ * Returns the number of blocks
+ */
+static size_t markLeaders(const struct ImageIr *ir, uint64_t *leaders) {
+  size_t count = 0;
+
+  for (size_t i = 0; i < ir->count; i++) {
+    unsigned char icode;
+    if (!isCodeItem(ir, i)) {
+      continue;
+    }
+    icode = itemIcode(ir, i);
+    if (icode == 0x7 || icode == 0x8) {
+      size_t target = targetItem(ir, itemImmediate(ir, i));
+      if (target != IR_NONE) {
+        leaders[target / 64] |= (uint64_t)1 << (target % 64);
+      }
+    }
+    if (i == 0 || !isCodeItem(ir, i - 1) || endsBlock(ir, i - 1)) {
+      leaders[i / 64] |= (uint64_t)1 << (i % 64);
+    }
+  }
+  for (size_t w = 0; w < (ir->count + 63) / 64; w++) {
+    count += countBits(leaders[w]);
+  }
+  return count;
+}
+
+/* Add the edge from block to the block starting at item, if there is one
+ */
+static void addEdge(struct FlowGraph *graph, size_t item, int kind) {
+  size_t to = item == IR_NONE ? BLOCK_NONE : blockOfItem(graph, item);
+  if (to != BLOCK_NONE) {
+    graph->successors[graph->edgeCount] = to;
+    graph->successorKind[graph->edgeCount++] = (uint8_t)kind;
+  }
+}
+
+/* Fill in the successors of every block from its last instruction, then
+ * the predecessors by counting and scattering the same edges
+ * Returns 0 on success and -1 if memory ran out
+ */
+static int linkBlocks(struct FlowGraph *graph, const struct ImageIr *ir) {
+  size_t blocks = graph->blockCount;
+  size_t *next;
+
+  graph->firstSuccessor = malloc((blocks + 1) * sizeof(*graph->firstSuccessor));
+  graph->successors = malloc((2 * blocks + 1) * sizeof(*graph->successors));
+  graph->successorKind = malloc(2 * blocks + 1);
+  graph->firstPredecessor = calloc(blocks + 1, sizeof(*graph->firstPredecessor));
+  if (graph->firstSuccessor == NULL || graph->successors == NULL || graph->successorKind == NULL ||
+      graph->firstPredecessor == NULL) {
+    return -1;
+  }
+
+  for (size_t b = 0; b < blocks; b++) {
+    size_t last = graph->endItem[b] - 1;
+    uint8_t first = irChunkOf(ir, last)->opcode[last % IR_CHUNK];
+    unsigned char icode = first >> 4;
+    int fallsThrough = first != 0x00 && first != 0x70 && first != 0x90 && //halt, jmp, ret
+                       b + 1 < blocks && graph->firstItem[b + 1] == graph->endItem[b];
+
+    graph->firstSuccessor[b] = graph->edgeCount;
+    if (icode == 0x7 || icode == 0x8) {
+      addEdge(graph, targetItem(ir, itemImmediate(ir, last)), icode == 0x7 ? EDGE_JUMP : EDGE_CALL);
+    }
+    if (fallsThrough) {
+      graph->successors[graph->edgeCount] = b + 1;
+      graph->successorKind[graph->edgeCount++] = EDGE_FALL;
+    }
+  }
+  graph->firstSuccessor[blocks] = graph->edgeCount;
+
+  for (size_t e = 0; e < graph->edgeCount; e++) {
+    graph->firstPredecessor[graph->successors[e] + 1]++;
+  }
+  for (size_t b = 0; b < blocks; b++) {
+    graph->firstPredecessor[b + 1] += graph->firstPredecessor[b];
+  }
+  graph->predecessors = malloc((graph->edgeCount + 1) * sizeof(*graph->predecessors));
+  next = malloc((blocks + 1) * sizeof(*next));
+  if (graph->predecessors == NULL || next == NULL) {
+    free(next);
+    return -1;
+  }
+  memcpy(next, graph->firstPredecessor, blocks * sizeof(*next));
+  for (size_t b = 0; b < blocks; b++) {
+    for (size_t e = graph->firstSuccessor[b]; e < graph->firstSuccessor[b + 1]; e++) {
+      graph->predecessors[next[graph->successors[e]]++] = b;
+    }
+  }
+  free(next);
+  return 0;
+}
+
+/* Split the listing in ir into basic blocks and link them
+ * A block starts at the first instruction, at every jXX/call destination
+ * that is a listed instruction, and after halt, jXX, call, ret and data;
+ * it ends before the next start. jXX and call get an edge to their
+ * destination (destinations that are not instructions of the image are
+ * dropped), and everything but halt, ret and jmp falls through to the
+ * block right after it.
+ * Memory is one bit per item while marking, then a few words per block
+ * and per edge, all in flat arrays.
+ * Returns 0 on success and -1 if memory ran out (errno is ENOMEM)
+ */
+int buildFlowGraph(const struct ImageIr *ir, struct FlowGraph *graph) {
+  uint64_t *leaders = calloc((ir->count + 63) / 64 + 1, sizeof(*leaders));
+  size_t b = 0;
+
+  memset(graph, 0, sizeof(*graph));
+  if (leaders == NULL) {
+    errno = ENOMEM;
+    return -1;
+  }
+  graph->blockCount = markLeaders(ir, leaders);
+  graph->firstItem = malloc((graph->blockCount + 1) * sizeof(*graph->firstItem));
+  graph->endItem = malloc((graph->blockCount + 1) * sizeof(*graph->endItem));
+  if (graph->firstItem == NULL || graph->endItem == NULL) {
+    free(leaders);
+    freeFlowGraph(graph);
+    errno = ENOMEM;
+    return -1;
+  }
+  for (size_t i = 0; i < ir->count; i++) {
+    if (leaders[i / 64] & ((uint64_t)1 << (i % 64))) {
+      graph->firstItem[b++] = i;
+    }
+    if (b > 0 && isCodeItem(ir, i)) {
+      graph->endItem[b - 1] = i + 1;
+    }
+  }
+  free(leaders);
+
+  if (linkBlocks(graph, ir) != 0) {
+    freeFlowGraph(graph);
+    errno = ENOMEM;
+    return -1;
+  }
+  return 0;
+}
+
+void freeFlowGraph(struct FlowGraph *graph) {
+  free(graph->firstItem);
+  free(graph->endItem);
+  free(graph->firstSuccessor);
+  free(graph->successors);
+  free(graph->successorKind);
+  free(graph->firstPredecessor);
+  free(graph->predecessors);
+  memset(graph, 0, sizeof(*graph));
+}
+
+/* The block starting at address, or BLOCK_NONE
+ */
+size_t findBlock(const struct FlowGraph *graph, const struct ImageIr *ir, uint64_t address) {
+  size_t item = targetItem(ir, address);
+  return item == IR_NONE ? BLOCK_NONE : blockOfItem(graph, item);
+}
+
+static char *putText(char *p, const char *s) {
+  while (*s != '\0') {
+    *p++ = *s++;
+  }
+  return p;
+}
+
+/* The address just past the last instruction of block b
+ */
+static uint64_t blockEnd(const struct FlowGraph *graph, const struct ImageIr *ir, size_t b) {
+  size_t last = graph->endItem[b] - 1;
+  return irAddress(ir, last) + irChunkOf(ir, last)->length[last % IR_CHUNK];
+}
+
+static void writeJson(struct OutBuffer *out, const struct FlowGraph *graph, const struct ImageIr *ir) {
+  writeOut(out, "{\"blocks\":[\n", 12);
+  for (size_t b = 0; b < graph->blockCount; b++) {
+    char *p = reserveOut(out, GRAPH_LINE_MAX);
+    p = putText(p, "{\"id\":");
+    p = putDecimal(p, b);
+    p = putText(p, ",\"start\":\"");
+    p = putHexValue(p, irAddress(ir, graph->firstItem[b]));
+    p = putText(p, "\",\"end\":\"");
+    p = putHexValue(p, blockEnd(graph, ir, b));
+    p = putText(p, "\",\"instructions\":");
+    p = putDecimal(p, graph->endItem[b] - graph->firstItem[b]);
+    p = putText(p, b + 1 < graph->blockCount ? "},\n" : "}\n");
+    commitOut(out, p);
+  }
+  writeOut(out, "],\"edges\":[\n", 12);
+  for (size_t b = 0; b < graph->blockCount; b++) {
+    for (size_t e = graph->firstSuccessor[b]; e < graph->firstSuccessor[b + 1]; e++) {
+      char *p = reserveOut(out, GRAPH_LINE_MAX);
+      p = putText(p, "{\"from\":");
+      p = putDecimal(p, b);
+      p = putText(p, ",\"to\":");
+      p = putDecimal(p, graph->successors[e]);
+      p = putText(p, ",\"kind\":\"");
+      p = putText(p, edgeNames[graph->successorKind[e]]);
+      p = putText(p, e + 1 < graph->edgeCount ? "\"},\n" : "\"}\n");
+      commitOut(out, p);
+    }
+  }
+  writeOut(out, "]}\n", 3);
+}
+
+static void writeDot(struct OutBuffer *out, const struct FlowGraph *graph, const struct ImageIr *ir) {
+  static const char *const edgeStyles[3] = {"", " [color=blue]", " [style=dashed]"};
+
+  writeOut(out, "digraph cfg {\n  node [shape=box];\n", 34);
+  for (size_t b = 0; b < graph->blockCount; b++) {
+    char *p = reserveOut(out, GRAPH_LINE_MAX);
+    p = putText(p, "  b");
+    p = putDecimal(p, b);
+    p = putText(p, " [label=\"");
+    p = putHexValue(p, irAddress(ir, graph->firstItem[b]));
+    p = putText(p, "-");
+    p = putHexValue(p, blockEnd(graph, ir, b));
+    p = putText(p, "\\n");
+    p = putDecimal(p, graph->endItem[b] - graph->firstItem[b]);
+    p = putText(p, " instructions\"];\n");
+    commitOut(out, p);
+  }
+  for (size_t b = 0; b < graph->blockCount; b++) {
+    for (size_t e = graph->firstSuccessor[b]; e < graph->firstSuccessor[b + 1]; e++) {
+      char *p = reserveOut(out, GRAPH_LINE_MAX);
+      p = putText(p, "  b");
+      p = putDecimal(p, b);
+      p = putText(p, " -> b");
+      p = putDecimal(p, graph->successors[e]);
+      p = putText(p, edgeStyles[graph->successorKind[e]]);
+      p = putText(p, ";\n");
+      commitOut(out, p);
+    }
+  }
+  writeOut(out, "}\n", 2);
+}
+
+/* Write the graph as JSON (a "blocks" array of ids and address ranges and
+ * an "edges" array of from/to/kind) or as a Graphviz digraph, blue edges
+ * for jumps and dashed ones for calls
+ * Returns 0 on success and -1 if writing failed (errno is set)
+ */
+int writeFlowGraph(struct OutBuffer *out, const struct FlowGraph *graph, const struct ImageIr *ir, int format) {
+  if (format == GRAPH_DOT) {
+    writeDot(out, graph, ir);
+  }
+  else {
+    writeJson(out, graph, ir);
+  }
+  if (out->error != 0) {
+    errno = out->error;
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,48 @@
+/* This file contains the prototypes and constants needed to use the
+   routines defined in flowGraph.c
+*/
+
+#ifndef _FLOWGRAPH_H_
+#define _FLOWGRAPH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "outBuffer.h"
+#include "imageIr.h"
+
+//How writeFlowGraph prints the graph
+enum GraphFormat {GRAPH_OFF, GRAPH_JSON, GRAPH_DOT};
+
+//Why control goes from one block to another
+enum EdgeKind {
+  EDGE_FALL, //The next block in the image
+  EDGE_JUMP, //A jXX or jmp destination
+  EDGE_CALL  //A call destination
+};
+
+/* The basic blocks of a listing and the edges between them
+ * Block b covers the IR items [firstItem[b], endItem[b]); data items and
+ * silent halts belong to no block. Edges are kept in compressed sparse row
+ * form: the successors of b are successors[firstSuccessor[b]..firstSuccessor[b + 1])
+ * with kinds in successorKind, and likewise for predecessors.
+ */
+struct FlowGraph {
+  size_t blockCount;
+  size_t *firstItem;
+  size_t *endItem;
+  size_t *firstSuccessor;   //blockCount + 1 entries
+  size_t *successors;
+  uint8_t *successorKind;   //An EdgeKind per successor
+  size_t *firstPredecessor; //blockCount + 1 entries
+  size_t *predecessors;
+  size_t edgeCount;
+};
+
+#define BLOCK_NONE ((size_t)-1) //findBlock result for an address that starts no block
+
+int buildFlowGraph(const struct ImageIr *ir, struct FlowGraph *graph);
+void freeFlowGraph(struct FlowGraph *graph);
+size_t findBlock(const struct FlowGraph *graph, const struct ImageIr *ir, uint64_t address);
+int writeFlowGraph(struct OutBuffer *out, const struct FlowGraph *graph, const struct ImageIr *ir, int format);
+
+#endif /* FLOWGRAPH */
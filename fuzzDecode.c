@@ -0,0 +1,636 @@
+/* Differential fuzzing harness for the decode paths.
+
+   A deliberately plain reference decoder, written from the listing rules
+   with snprintf and the original "%016lx: %-22s%-8s" layout and sharing no
+   code with printRoutines.c, renders every image first. Each fast path
+   (serial, resumed decodeRange, parallel, batch records, text sink, IR, stream,
+   region cache cold and warm) must then produce byte-identical text, and
+   a diff against the same image with one branch retargeted must report
+   exactly one changed region, as must one with a nop inserted at a branch
+   destination.
+
+   Built with -DFUZZ_LIBFUZZER it is a libFuzzer target; otherwise main
+   replays files and directories given on the command line and then checks
+   -n random images (seeded with -s). On a mismatch the image is written to
+   fuzz-failure.bin, the first differing lines are printed and the run aborts.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "printRoutines.h"
+#include "inputMap.h"
+#include "outBuffer.h"
+#include "parallelDecode.h"
+#include "streamDecode.h"
+#include "regionCache.h"
+#include "imageIr.h"
+#include "disasm.h"
+#include "outputSink.h"
+#include "imageDiff.h"
+
+#define FUZZ_THREADS 4
+#define FUZZ_BIG_IMAGE (3 * CHUNK_SIZE) //Largest random image, enough to cross chunk and stream buffer boundaries
+
+static char cachePath[] = "/tmp/fuzzDecodeCacheXXXXXX";
+static FILE *streamFile; //Holds the image for decodeStream
+
+/* Register names and the rules of the original per-opcode handlers
+ */
+static const char *const refRegs[16] = {
+  "%rax", "%rcx", "%rdx", "%rbx", "%rsp", "%rbp", "%rsi", "%rdi",
+  "%r8", "%r9", "%r10", "%r11", "%r12", "%r13", "%r14", ""
+};
+
+enum RefRegs {REF_NO_BYTE, REF_BOTH, REF_B_ONLY, REF_A_ONLY}; //Which nibbles of the register byte must name registers
+
+/* Length, mnemonic and register rule of first byte b; length 0 if b is not an opcode
+ */
+static int refOpcode(uint8_t b, const char **mnemonic, int *regs) {
+  static const char *const cmov[7] = {"rrmovq", "cmovle", "cmovl", "cmove", "cmovne", "cmovge", "cmovg"};
+  static const char *const opq[7] = {"addq", "subq", "andq", "xorq", "mulq", "divq", "modq"};
+  static const char *const jxx[7] = {"jmp", "jle", "jl", "je", "jne", "jge", "jg"};
+  unsigned hi = b >> 4, lo = b & 0xF;
+
+  *regs = REF_NO_BYTE;
+  switch (hi) {
+    case 0x0: *mnemonic = "halt"; return lo == 0 ? 1 : 0;
+    case 0x1: *mnemonic = "nop"; return lo == 0 ? 1 : 0;
+    case 0x2: *mnemonic = lo < 7 ? cmov[lo] : ""; *regs = REF_BOTH; return lo < 7 ? 2 : 0;
+    case 0x3: *mnemonic = "irmovq"; *regs = REF_B_ONLY; return lo == 0 ? 10 : 0;
+    case 0x4: *mnemonic = "rmmovq"; *regs = REF_BOTH; return lo == 0 ? 10 : 0;
+    case 0x5: *mnemonic = "mrmovq"; *regs = REF_BOTH; return lo == 0 ? 10 : 0;
+    case 0x6: *mnemonic = lo < 7 ? opq[lo] : ""; *regs = REF_BOTH; return lo < 7 ? 2 : 0;
+    case 0x7: *mnemonic = lo < 7 ? jxx[lo] : ""; return lo < 7 ? 9 : 0;
+    case 0x8: *mnemonic = "call"; return lo == 0 ? 9 : 0;
+    case 0x9: *mnemonic = "ret"; return lo == 0 ? 1 : 0;
+    case 0xA: *mnemonic = "pushq"; *regs = REF_A_ONLY; return lo == 0 ? 2 : 0;
+    case 0xB: *mnemonic = "popq"; *regs = REF_A_ONLY; return lo == 0 ? 2 : 0;
+    default: return 0;
+  }
+}
+
+static int refRegsValid(int regs, uint8_t byte) {
+  unsigned rA = byte >> 4, rB = byte & 0xF;
+  switch (regs) {
+    case REF_BOTH: return rA != 0xF && rB != 0xF;
+    case REF_B_ONLY: return rA == 0xF && rB != 0xF;
+    case REF_A_ONLY: return rA != 0xF && rB == 0xF;
+    default: return 1;
+  }
+}
+
+static uint64_t refValue(const uint8_t *bytes, int n) {
+  uint64_t value = 0;
+  for (int i = n - 1; i >= 0; i--) {
+    value = value << 8 | bytes[i];
+  }
+  return value;
+}
+
+static void refLine(struct OutBuffer *out, uint64_t addr, const uint8_t *bytes, int n, const char *mnemonic, const char *operands) {
+  char encoding[2 * 10 + 1], line[160];
+  for (int i = 0; i < n; i++) {
+    snprintf(encoding + 2 * i, 3, "%02X", bytes[i]);
+  }
+  encoding[2 * n] = '\0';
+  writeOut(out, line, (size_t)snprintf(line, sizeof(line), "%016" PRIx64 ": %-22s%-8s%s\n", addr, encoding, mnemonic, operands));
+}
+
+static void refData(struct OutBuffer *out, uint64_t addr, const uint8_t *bytes, size_t n) {
+  char value[24];
+  size_t i = 0;
+  if (n >= 8) {
+    snprintf(value, sizeof(value), "0x%" PRIx64, refValue(bytes, 8));
+    refLine(out, addr, bytes, 8, ".quad", value);
+    i = 8;
+  }
+  for (; i < n; i++) {
+    snprintf(value, sizeof(value), "0x%x", bytes[i]);
+    refLine(out, addr + i, bytes + i, 1, ".byte", value);
+  }
+}
+
+/* The reference listing of code[0..length) with code[0] at base
+ * An opcode whose register byte is bad, or a byte that is no opcode,
+ * starts up to a quad of data; an instruction cut off by the end turns
+ * everything left into data; only the first halt of a run (and none at the
+ * very start) is listed.
+ */
+static void refDecode(struct OutBuffer *out, const uint8_t *code, size_t length, uint64_t base) {
+  int skipHalt = 1;
+  size_t pos = 0;
+
+  while (pos < length) {
+    const uint8_t *instr = code + pos;
+    size_t avail = length - pos, data = 0;
+    const char *mnemonic;
+    int regs, n = refOpcode(instr[0], &mnemonic, &regs);
+    char operands[64] = "";
+
+    if (n == 0 || (regs != REF_NO_BYTE && avail >= 2 && !refRegsValid(regs, instr[1]))) {
+      data = avail < 8 ? avail : 8;
+    }
+    else if ((size_t)n > avail) {
+      data = avail;
+    }
+    if (data != 0) {
+      refData(out, base + pos, instr, data);
+      skipHalt = 0;
+      pos += data;
+      continue;
+    }
+    if (instr[0] == 0x00) {
+      if (!skipHalt) {
+        refLine(out, base + pos, instr, 1, mnemonic, "");
+      }
+      skipHalt = 1;
+      pos++;
+      continue;
+    }
+    const char *rA = refRegs[n > 1 ? instr[1] >> 4 : 0xF];
+    const char *rB = refRegs[n > 1 ? instr[1] & 0xF : 0xF];
+    switch (instr[0] >> 4) {
+      case 0x2: case 0x6:
+        snprintf(operands, sizeof(operands), "%s, %s", rA, rB);
+        break;
+      case 0x3:
+        snprintf(operands, sizeof(operands), "$0x%" PRIx64 ", %s", refValue(instr + 2, 8), rB);
+        break;
+      case 0x4:
+        snprintf(operands, sizeof(operands), "%s, 0x%" PRIx64 "(%s)", rA, refValue(instr + 2, 8), rB);
+        break;
+      case 0x5:
+        snprintf(operands, sizeof(operands), "0x%" PRIx64 "(%s), %s", refValue(instr + 2, 8), rB, rA);
+        break;
+      case 0x7: case 0x8:
+        snprintf(operands, sizeof(operands), "0x%" PRIx64, refValue(instr + 1, 8));
+        break;
+      case 0xA: case 0xB:
+        snprintf(operands, sizeof(operands), "%s", rA);
+        break;
+    }
+    refLine(out, base + pos, instr, n, mnemonic, operands);
+    skipHalt = 0;
+    pos += (size_t)n;
+  }
+}
+
+/* Length of the text line starting at offset at of out, 0 past the end
+ */
+static int lineLength(const struct OutBuffer *out, size_t at) {
+  const char *end;
+  if (at >= out->length) {
+    return 0;
+  }
+  end = memchr(out->data + at, '\n', out->length - at);
+  return (int)(end != NULL ? end - (out->data + at) : (ptrdiff_t)(out->length - at));
+}
+
+/* Keep the image that failed in fuzz-failure.bin and stop
+ */
+static void saveFailure(const uint8_t *image, size_t length) {
+  FILE *failure = fopen("fuzz-failure.bin", "wb");
+  if (failure != NULL) {
+    fwrite(image, 1, length, failure);
+    fclose(failure);
+  }
+  abort();
+}
+
+/* Abort with the first differing lines if got is not the reference text
+ */
+static void expectSame(const char *path, const struct OutBuffer *want, const struct OutBuffer *got,
+                       const uint8_t *image, size_t length, size_t start) {
+  size_t at = 0, line = 0;
+
+  if (got->error == 0 && got->length == want->length && memcmp(got->data, want->data, want->length) == 0) {
+    return;
+  }
+  while (at < want->length && at < got->length && want->data[at] == got->data[at]) {
+    if (want->data[at++] == '\n') {
+      line = at;
+    }
+  }
+  fprintf(stderr, "%s differs from the reference (image %zu bytes, window from %zu, error %d)\n",
+          path, length, start, got->error);
+  fprintf(stderr, "reference: %.*s\n", lineLength(want, line), want->data + line);
+  fprintf(stderr, "got:       %.*s\n", lineLength(got, line), got->data + line);
+  saveFailure(image, length);
+}
+
+/* Abort unless record starts where the records before it ended (covered
+ * bytes into code) and, if it is silent, takes the whole rest of a run of
+ * halts in one
+ */
+static void checkRecord(const struct Y86Record *record, const uint8_t *code, size_t n, size_t start, size_t *covered,
+                        const uint8_t *image, size_t length) {
+  size_t end = *covered + record->length;
+  int bad = record->address != start + *covered || record->length == 0 || end > n;
+
+  if (!bad && (record->flags & Y86_FLAG_SILENT)) {
+    bad = (end < n && code[end] == 0x00);
+    for (size_t i = *covered; i < end && !bad; i++) {
+      bad = code[i] != 0x00;
+    }
+  }
+  if (bad) {
+    fprintf(stderr, "y86DecodeBatch record at 0x%" PRIx64 " of %u bytes (flags %u) should start at 0x%zx"
+            " and a silent one cover a whole run of zeros (image %zu bytes, window from %zu)\n",
+            record->address, (unsigned)record->length, (unsigned)record->flags, start + *covered, length, start);
+    saveFailure(image, length);
+  }
+  *covered = end;
+}
+
+static void openMemory(struct OutBuffer *out) {
+  if (openOutBuffer(out, -1, 1 << 16) != 0) {
+    perror("openOutBuffer");
+    exit(1);
+  }
+}
+
+/* Abort unless diffImageIrs, run on before and the IR of code, ends with want
+ */
+static void expectRegions(struct OutBuffer *out, const struct ImageIr *before, const uint8_t *code, size_t n,
+                          const char *want, const char *what, const uint8_t *image, size_t length, size_t start) {
+  struct ImageIr after;
+
+  resetOutBuffer(out, -1);
+  if (buildImageIr(code, n, start, &after) != 0 || diffImageIrs(out, before, &after) != 0) {
+    perror("checkDiff");
+    exit(1);
+  }
+  freeImageIr(&after);
+  if (out->length < strlen(want) || memcmp(out->data + out->length - strlen(want), want, strlen(want)) != 0) {
+    fprintf(stderr, "diffImageIrs should end with %s(image %zu bytes, window from %zu, %s):\n%.*s",
+            want, length, start, what, (int)out->length, out->data);
+    saveFailure(image, length);
+  }
+}
+
+/* 1 if record is a listed jXX or call
+ */
+static int isBranchRecord(const struct Y86Record *record) {
+  return record->kind == Y86_KIND_CODE && (record->opcode == 0x7 || record->opcode == 0x8);
+}
+
+/* Copy code into patched (n + 1 bytes) with a nop inserted at offset at and
+ * every branch destination past it moved along with what it points to; a
+ * branch to at itself now reaches the nop, as a call does when its function
+ * gets a new first instruction
+ */
+static void insertNop(const uint8_t *code, size_t n, size_t start, size_t at, uint8_t *patched) {
+  struct Y86Record records[64];
+  struct Y86Cursor cursor;
+  size_t count;
+
+  memcpy(patched, code, at);
+  patched[at] = 0x10;
+  memcpy(patched + at + 1, code + at, n - at);
+  y86InitCursor(&cursor);
+  while ((count = y86DecodeBatch(code, n, start, &cursor, records, 64)) > 0) {
+    for (size_t i = 0; i < count; i++) {
+      uint64_t dest = records[i].immediate;
+      size_t offset = (size_t)(records[i].address - start);
+      if (isBranchRecord(&records[i]) && dest > start + at && dest < start + n) {
+        offset += offset >= at;
+        dest++;
+        for (int k = 0; k < 8; k++) {
+          patched[offset + 1 + k] = (uint8_t)(dest >> (8 * k));
+        }
+      }
+    }
+  }
+}
+
+/* Diff the IR of code against itself, against a copy in which one jXX or
+ * call (picked by seed) goes somewhere else, and against a copy with a nop
+ * inserted at the destination of a branch: the second diff must report that
+ * one branch however the alignment masks destinations, the third only the nop
+ * The nop goes before a listed item that follows no other nop, so the
+ * insertion has only one place to align to.
+ */
+static void checkDiff(const uint8_t *image, size_t length, size_t start, unsigned seed) {
+  const uint8_t *code = image + start;
+  size_t n = length - start, branches = 0, targets = 0, at = 0, insertAt = n;
+  struct Y86Record records[64];
+  struct Y86Cursor cursor;
+  struct ImageIr before;
+  struct OutBuffer out;
+  uint8_t *patched, *startsItem;
+  size_t count;
+  int afterNop = 0;
+
+  patched = malloc(n + 1);
+  startsItem = calloc(n + 1, 1); //1 at the items a nop may go before
+  if (patched == NULL || startsItem == NULL || buildImageIr(code, n, start, &before) != 0) {
+    perror("checkDiff");
+    exit(1);
+  }
+  y86InitCursor(&cursor);
+  while ((count = y86DecodeBatch(code, n, start, &cursor, records, 64)) > 0) {
+    for (size_t i = 0; i < count; i++) {
+      size_t offset = (size_t)(records[i].address - start);
+      startsItem[offset] = !(records[i].flags & Y86_FLAG_SILENT) && !afterNop;
+      afterNop = records[i].kind == Y86_KIND_CODE && code[offset] == 0x10;
+      if (isBranchRecord(&records[i]) && branches++ % (1 + seed % 5) == 0) {
+        at = offset; //Keeps some branch, which one depends on seed
+      }
+    }
+  }
+  y86InitCursor(&cursor);
+  while ((count = y86DecodeBatch(code, n, start, &cursor, records, 64)) > 0) {
+    for (size_t i = 0; i < count; i++) {
+      uint64_t dest = records[i].immediate;
+      if (isBranchRecord(&records[i]) && dest >= start && dest - start < n && startsItem[dest - start] &&
+          targets++ % (1 + seed % 3) == 0) {
+        insertAt = (size_t)(dest - start);
+      }
+    }
+  }
+
+  openMemory(&out);
+  expectRegions(&out, &before, code, n, "# 0 changed regions\n", "unchanged", image, length, start);
+  if (branches > 0) {
+    char what[64];
+    memcpy(patched, code, n);
+    patched[at + 1] ^= (uint8_t)(1 + seed % 255); //Low byte of Dest
+    snprintf(what, sizeof(what), "branch at %zu retargeted", start + at);
+    expectRegions(&out, &before, patched, n, "# 1 changed regions\n", what, image, length, start);
+  }
+  if (insertAt < n) {
+    char what[64];
+    insertNop(code, n, start, insertAt, patched);
+    snprintf(what, sizeof(what), "nop inserted at %zu", start + insertAt);
+    expectRegions(&out, &before, patched, n + 1, "# 1 changed regions\n", what, image, length, start);
+  }
+  closeOutBuffer(&out);
+  freeImageIr(&before);
+  free(startsItem);
+  free(patched);
+}
+
+/* Run every decode path on the window [start, length) of image, which
+ * lives at address start, and compare each against the reference
+ */
+static void checkImage(const uint8_t *image, size_t length, size_t start, unsigned seed) {
+  const uint8_t *code = image + start;
+  size_t n = length - start;
+  struct OutBuffer want, got;
+  struct ImageIr ir;
+
+  openMemory(&want);
+  refDecode(&want, code, n, start);
+
+  openMemory(&got);
+  decodeMachineCode(&got, code, n, start);
+  expectSame("decodeMachineCode", &want, &got, image, length, start);
+
+  //The same sweep stopped and resumed at arbitrary points
+  resetOutBuffer(&got, -1);
+  struct DecodeState state = {0, 1, 0};
+  for (size_t stop = 0; state.pos < n; ) {
+    stop += 1 + (seed = seed * 1103515245u + 12345u) % 97;
+    decodeRange(&got, code, n, start, &state, stop);
+  }
+  expectSame("decodeRange", &want, &got, image, length, start);
+
+  resetOutBuffer(&got, -1);
+  decodeParallel(&got, code, n, start, FUZZ_THREADS);
+  expectSame("decodeParallel", &want, &got, image, length, start);
+
+  //Batches of a few records, so the cursor has to carry data runs and halts over
+  resetOutBuffer(&got, -1);
+  struct Y86Record records[17];
+  struct Y86Cursor cursor;
+  size_t count, batch = 1 + seed % 17, covered = 0;
+  y86InitCursor(&cursor);
+  while ((count = y86DecodeBatch(code, n, start, &cursor, records, batch)) > 0) {
+    for (size_t i = 0; i < count; i++) {
+      char *p = reserveOut(&got, Y86_LINE_MAX);
+      commitOut(&got, p + y86RenderRecord(&records[i], p));
+      checkRecord(&records[i], code, n, start, &covered, image, length);
+    }
+  }
+  if (covered != n) {
+    fprintf(stderr, "y86DecodeBatch stopped at %zu of %zu bytes (window from %zu)\n", covered, n, start);
+    saveFailure(image, length);
+  }
+  expectSame("y86DecodeBatch", &want, &got, image, length, start);
+
+  resetOutBuffer(&got, -1);
+  struct OutputSink sink;
+  openSink(&sink, SINK_TEXT, &got);
+  decodeToSink(&sink, code, n, start);
+  expectSame("decodeToSink", &want, &got, image, length, start);
+
+  resetOutBuffer(&got, -1);
+  if (buildImageIr(code, n, start, &ir) != 0) {
+    perror("buildImageIr");
+    exit(1);
+  }
+  writeIrListing(&got, &ir);
+  freeImageIr(&ir);
+  expectSame("writeIrListing", &want, &got, image, length, start);
+
+  //The whole image goes through a file; decodeStream skips to the window itself
+  resetOutBuffer(&got, -1);
+  if (ftruncate(fileno(streamFile), 0) != 0 || pwrite(fileno(streamFile), image, length, 0) != (ssize_t)length ||
+      lseek(fileno(streamFile), 0, SEEK_SET) != 0) {
+    perror("stream file");
+    exit(1);
+  }
+  decodeStream(&got, fileno(streamFile), start, INPUT_TO_END);
+  expectSame("decodeStream", &want, &got, image, length, start);
+
+  unlink(cachePath);
+  resetOutBuffer(&got, -1);
+  decodeIncremental(&got, code, n, start, cachePath);
+  expectSame("decodeIncremental (cold)", &want, &got, image, length, start);
+  resetOutBuffer(&got, -1);
+  decodeIncremental(&got, code, n, start, cachePath);
+  expectSame("decodeIncremental (warm)", &want, &got, image, length, start);
+
+  closeOutBuffer(&got);
+  closeOutBuffer(&want);
+
+  checkDiff(image, length, start, seed);
+}
+
+static void setUp(void) {
+  int fd;
+
+  if (streamFile != NULL) {
+    return;
+  }
+  streamFile = tmpfile();
+  fd = mkstemp(cachePath);
+  if (streamFile == NULL || fd < 0) {
+    perror("temporary files");
+    exit(1);
+  }
+  close(fd);
+}
+
+#ifdef FUZZ_LIBFUZZER
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  setUp();
+  //The first byte picks where the window starts, so offsets get fuzzed too
+  checkImage(data, size, size > 0 ? data[0] % (size < 16 ? size : 16) : 0, size > 1 ? data[1] : 0);
+  return 0;
+}
+
+#else
+
+static unsigned long long rngState;
+
+static uint64_t nextRandom(void) {
+  rngState += 0x9E3779B97F4A7C15ULL;
+  uint64_t x = rngState;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  return x ^ (x >> 31);
+}
+
+/* Fill image with length bytes of one of several mixes: random bytes,
+ * instructions with mostly valid register bytes, long zero runs and
+ * repeated quads, then cut the end at an arbitrary point
+ */
+static size_t randomImage(uint8_t *image, size_t length) {
+  static const uint8_t opcodes[] = {0x00, 0x10, 0x20, 0x21, 0x26, 0x30, 0x40, 0x50, 0x60, 0x63, 0x66,
+                                    0x70, 0x74, 0x76, 0x80, 0x90, 0xA0, 0xB0, 0x27, 0x67, 0xC0, 0xFF};
+  int mix = (int)(nextRandom() % 4);
+  size_t pos = 0;
+
+  while (pos < length) {
+    uint64_t r = nextRandom();
+    if (mix == 0) {
+      image[pos++] = (uint8_t)r;
+    }
+    else if (mix == 3 && r % 8 == 0) {
+      size_t run = 1 + (r >> 8) % 4096;
+      for (size_t i = 0; i < run && pos < length; i++) {
+        image[pos++] = (r >> 24) % 2 ? 0x00 : 0xFF;
+      }
+    }
+    else {
+      uint8_t op = opcodes[r % sizeof(opcodes)];
+      const char *mnemonic;
+      int regs, n = refOpcode(op, &mnemonic, &regs);
+      uint64_t value = nextRandom();
+      image[pos++] = op;
+      for (int i = 1; i < n && pos < length; i++) {
+        if (i == 1 && regs != REF_NO_BYTE) {
+          image[pos++] = (r >> 8) % 16 == 0 ? (uint8_t)(r >> 16) : //Now and then a bad register byte
+                         (uint8_t)((regs == REF_B_ONLY ? 0xF0 : ((r >> 16) % 15) << 4) |
+                                   (regs == REF_A_ONLY ? 0xF : (r >> 20) % 15));
+        }
+        else {
+          image[pos++] = mix == 2 ? (uint8_t)(value >> (8 * (i % 8))) : (uint8_t)((value >> (8 * (i % 8))) & 0x3F);
+        }
+      }
+    }
+  }
+  return length - (size_t)(nextRandom() % 12 < 3 ? nextRandom() % (length < 11 ? length + 1 : 11) : 0);
+}
+
+static unsigned long cases;
+
+static void checkFile(const char *path) {
+  FILE *f = fopen(path, "rb");
+  uint8_t *image;
+  long size;
+
+  if (f == NULL || fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0 || fseek(f, 0, SEEK_SET) != 0) {
+    fprintf(stderr, "Failed to read %s: %s\n", path, strerror(errno));
+    exit(1);
+  }
+  image = malloc((size_t)size + 1);
+  if (image == NULL || fread(image, 1, (size_t)size, f) != (size_t)size) {
+    fprintf(stderr, "Failed to read %s\n", path);
+    exit(1);
+  }
+  fclose(f);
+  for (size_t start = 0; start <= (size_t)size && start < 11; start++) {
+    checkImage(image, (size_t)size, start, (unsigned)start);
+    cases++;
+  }
+  free(image);
+}
+
+/* Check a corpus file, or every file in a corpus directory
+ */
+static void checkPath(const char *path) {
+  struct stat st;
+  DIR *dir;
+  struct dirent *entry;
+
+  if (stat(path, &st) != 0) {
+    fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+    exit(1);
+  }
+  if (!S_ISDIR(st.st_mode)) {
+    checkFile(path);
+    return;
+  }
+  dir = opendir(path);
+  while (dir != NULL && (entry = readdir(dir)) != NULL) {
+    char child[4096];
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+    snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+    checkFile(child);
+  }
+  if (dir != NULL) {
+    closedir(dir);
+  }
+}
+
+int main(int argc, char **argv) {
+  unsigned long runs = 0;
+  uint8_t *image;
+
+  setUp();
+  rngState = 1;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      runs = strtoul(argv[++i], NULL, 0);
+    }
+    else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      rngState = strtoull(argv[++i], NULL, 0);
+    }
+    else {
+      checkPath(argv[i]);
+    }
+  }
+
+  image = malloc(FUZZ_BIG_IMAGE);
+  if (image == NULL) {
+    perror("malloc");
+    return 1;
+  }
+  for (unsigned long run = 0; run < runs; run++) {
+    //Mostly small images, now and then one that spans several chunks and stream buffers
+    size_t length = run % 64 == 63 ? CHUNK_SIZE + nextRandom() % (FUZZ_BIG_IMAGE - CHUNK_SIZE) : nextRandom() % 2048;
+    length = randomImage(image, length);
+    checkImage(image, length, length ? (size_t)(nextRandom() % (length < 24 ? length + 1 : 24)) : 0, (unsigned)run);
+    cases++;
+  }
+  free(image);
+
+  unlink(cachePath);
+  printf("%lu cases, every decode path matched the reference\n", cases);
+  return 0;
+}
+
+#endif
@@ -0,0 +1,202 @@
+/* Writes synthetic Y86 machine code images for benchmarking the disassembler.
+ *
+ * Usage: genimage OutputFilename sizeInBytes [mix [seed]]
+ * where mix is one of
+ *   code         valid instructions only
+ *   data         bytes that are not opcodes, so every item is a .quad/.byte
+ *   zero         zero padding (runs of halts)
+ *   adversarial  opcodes whose next bytes are almost right, e.g. 0x20 with an
+ *                invalid register nibble, so decoding starts and then falls back
+ *   mixed        blocks of all of the above (default)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#define ERROR_RETURN -1
+#define SUCCESS 0
+
+#define BLOCK_MAX 4096 //Largest block of one kind in a mixed image
+
+static uint64_t rngState;
+
+/* xorshift64*, good enough for filler bytes and reproducible from the seed
+ */
+static uint64_t nextRandom(void) {
+  rngState ^= rngState >> 12;
+  rngState ^= rngState << 25;
+  rngState ^= rngState >> 27;
+  return rngState * 2685821657736338717ULL;
+}
+
+static unsigned char randomReg(void) {
+  return (unsigned char)(nextRandom() % 15); //rax-r14
+}
+
+static int putQuad(unsigned char *p, uint64_t value) {
+  for (int i = 0; i < 8; i++) {
+    p[i] = (unsigned char)(value >> (8 * i));
+  }
+  return 8;
+}
+
+/* Write one random valid instruction at p, returns its length
+ */
+static int genInstruction(unsigned char *p, size_t imageSize) {
+  switch (nextRandom() % 12) {
+    case 0:
+      p[0] = 0x10; //nop
+      return 1;
+    case 1:
+      p[0] = 0x90; //ret
+      return 1;
+    case 2:
+      p[0] = (unsigned char)(0x20 + nextRandom() % 7); //rrmovq/cmovXX
+      p[1] = (unsigned char)(randomReg() << 4 | randomReg());
+      return 2;
+    case 3:
+      p[0] = 0x30; //irmovq
+      p[1] = (unsigned char)(0xF0 | randomReg());
+      return 2 + putQuad(p + 2, nextRandom() >> (nextRandom() % 64));
+    case 4:
+      p[0] = 0x40; //rmmovq
+      p[1] = (unsigned char)(randomReg() << 4 | randomReg());
+      return 2 + putQuad(p + 2, nextRandom() % 65536);
+    case 5:
+      p[0] = 0x50; //mrmovq
+      p[1] = (unsigned char)(randomReg() << 4 | randomReg());
+      return 2 + putQuad(p + 2, nextRandom() % 65536);
+    case 6:
+    case 7:
+      p[0] = (unsigned char)(0x60 + nextRandom() % 7); //OPq
+      p[1] = (unsigned char)(randomReg() << 4 | randomReg());
+      return 2;
+    case 8:
+      p[0] = (unsigned char)(0x70 + nextRandom() % 7); //jXX
+      return 1 + putQuad(p + 1, nextRandom() % imageSize);
+    case 9:
+      p[0] = 0x80; //call
+      return 1 + putQuad(p + 1, nextRandom() % imageSize);
+    case 10:
+      p[0] = 0xA0; //pushq
+      p[1] = (unsigned char)(randomReg() << 4 | 0xF);
+      return 2;
+    default:
+      p[0] = 0xB0; //popq
+      p[1] = (unsigned char)(randomReg() << 4 | 0xF);
+      return 2;
+  }
+}
+
+/* Write one data quad whose first byte is not an opcode, returns 8
+ */
+static int genData(unsigned char *p) {
+  uint64_t value = nextRandom();
+  putQuad(p, value);
+  while ((p[0] & 0x0F) <= 0x06 && (p[0] >> 4) <= 0xB) { //Steer clear of every opcode
+    p[0] = (unsigned char)nextRandom();
+  }
+  return 8;
+}
+
+/* Write an opcode followed by bytes that make it fall back to data, returns the length
+ */
+static int genAdversarial(unsigned char *p) {
+  switch (nextRandom() % 5) {
+    case 0:
+      p[0] = 0x20; //rrmovq with rA = 0xF
+      p[1] = (unsigned char)(0xF0 | randomReg());
+      break;
+    case 1:
+      p[0] = 0x30; //irmovq with a real register in rA
+      p[1] = (unsigned char)(randomReg() << 4 | randomReg());
+      break;
+    case 2:
+      p[0] = 0x50; //mrmovq with rB = 0xF
+      p[1] = (unsigned char)(randomReg() << 4 | 0xF);
+      break;
+    case 3:
+      p[0] = 0xA0; //pushq with a real register in rB
+      p[1] = (unsigned char)(randomReg() << 4 | randomReg());
+      break;
+    default:
+      p[0] = (unsigned char)(0x60 + nextRandom() % 7); //OPq with rA = 0xF
+      p[1] = (unsigned char)(0xF0 | randomReg());
+      break;
+  }
+  for (int i = 2; i < 8; i++) {
+    p[i] = (unsigned char)nextRandom();
+  }
+  return 8;
+}
+
+int main(int argc, char **argv) {
+  const char *mix = "mixed";
+  unsigned char *image;
+  size_t size, pos = 0;
+  FILE *outputFile;
+
+  if (argc < 3 || argc > 5) {
+    printf("Usage: %s OutputFilename sizeInBytes [code|data|zero|adversarial|mixed [seed]]\n", argv[0]);
+    return ERROR_RETURN;
+  }
+  size = strtoul(argv[2], NULL, 0);
+  if (argc >= 4) {
+    mix = argv[3];
+  }
+  rngState = argc == 5 ? strtoull(argv[4], NULL, 0) : 0x9E3779B97F4A7C15ULL;
+  if (rngState == 0) {
+    rngState = 1;
+  }
+  if (size == 0 || (strcmp(mix, "code") != 0 && strcmp(mix, "data") != 0 && strcmp(mix, "zero") != 0 &&
+                    strcmp(mix, "adversarial") != 0 && strcmp(mix, "mixed") != 0)) {
+    printf("Invalid size or mix: %s %s\n", argv[2], mix);
+    return ERROR_RETURN;
+  }
+
+  image = calloc(size + 16, 1); //Room for the last item to overhang
+  if (image == NULL) {
+    printf("Failed to allocate %zu bytes\n", size);
+    return ERROR_RETURN;
+  }
+  while (pos < size) {
+    const char *kind = mix;
+    size_t blockEnd = size;
+    if (strcmp(mix, "mixed") == 0) {
+      static const char *kinds[4] = {"code", "data", "zero", "adversarial"};
+      kind = kinds[nextRandom() % 4];
+      blockEnd = pos + 1 + nextRandom() % BLOCK_MAX;
+    }
+    while (pos < blockEnd && pos < size) {
+      if (strcmp(kind, "code") == 0) {
+        pos += (size_t)genInstruction(image + pos, size);
+      }
+      else if (strcmp(kind, "data") == 0) {
+        pos += (size_t)genData(image + pos);
+      }
+      else if (strcmp(kind, "adversarial") == 0) {
+        pos += (size_t)genAdversarial(image + pos);
+      }
+      else {
+        pos = blockEnd < size ? blockEnd : size; //Already zero
+      }
+    }
+  }
+
+  outputFile = fopen(argv[1], "wb");
+  if (outputFile == NULL) {
+    printf("Failed to open %s: %s\n", argv[1], strerror(errno));
+    free(image);
+    return ERROR_RETURN;
+  }
+  if (fwrite(image, 1, size, outputFile) != size || fclose(outputFile) != 0) {
+    printf("Failed to write %s: %s\n", argv[1], strerror(errno));
+    free(image);
+    return ERROR_RETURN;
+  }
+  free(image);
+  return SUCCESS;
+}
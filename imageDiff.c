@@ -0,0 +1,592 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "imageDiff.h"
+#include "inputMap.h"
+#include "disasm.h"
+
+#define DIFF_PRIME 0x100000001B3ULL //Multiplier of the rolling hash
+#define ANCHOR_SHARED ((size_t)-1)  //Anchor hash seen more than once
+
+static uint64_t mix64(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xBF58476D1CE4E5B9ULL;
+  x ^= x >> 27;
+  x *= 0x94D049BB133111EBULL;
+  x ^= x >> 31;
+  return x;
+}
+
+/* Hash every item of ir by what it is rather than where: first byte,
+ * register byte, length, kind and the immediate, except that the
+ * destinations of jXX and call are left out since they move with the code
+ * (checkBranches catches the ones that really changed once items are aligned)
+ * Returns the hashes (ir->count of them), NULL if memory ran out
+ */
+static uint64_t *hashItems(const struct ImageIr *ir) {
+  uint64_t *hashes = malloc((ir->count + 1) * sizeof(*hashes));
+
+  if (hashes == NULL) {
+    return NULL;
+  }
+  for (size_t i = 0; i < ir->count; i++) {
+    const struct IrChunk *chunk = irChunkOf(ir, i);
+    size_t slot = i % IR_CHUNK;
+    uint8_t first = chunk->opcode[slot];
+    int isBranch = (chunk->flags[slot] & 0xF) == Y86_KIND_CODE && (first >> 4 == 0x7 || first >> 4 == 0x8);
+    uint64_t shape = (uint64_t)first | (uint64_t)chunk->regs[slot] << 8 | (uint64_t)chunk->length[slot] << 16 |
+                     (uint64_t)chunk->flags[slot] << 24;
+    hashes[i] = mix64(shape ^ mix64(isBranch ? 0 : chunk->immediate[slot]));
+  }
+  return hashes;
+}
+
+/* An anchor candidate: a window whose rolling hash passed the sample test
+ */
+struct Anchor {
+  uint64_t hash;
+  size_t before; //First item of the window in the old image
+  size_t after;  //First item of the window in the new image, ANCHOR_SHARED if not unique
+};
+
+/* Open addressed table from window hash to the index of its anchor
+ */
+struct AnchorTable {
+  size_t *slots; //Anchor index + 1, 0 if free
+  size_t mask;
+};
+
+static size_t *findSlot(struct AnchorTable *table, const struct Anchor *anchors, uint64_t hash) {
+  size_t i = (size_t)mix64(hash) & table->mask;
+  while (table->slots[i] != 0 && anchors[table->slots[i] - 1].hash != hash) {
+    i = (i + 1) & table->mask;
+  }
+  return &table->slots[i];
+}
+
+/* Walks the windows of width items whose rolling hash has sampleBits low
+ * zero bits, so which windows are anchors depends on content only
+ */
+struct WindowScan {
+  const uint64_t *hashes;
+  size_t count;
+  size_t width;
+  uint64_t sampleMask;
+  size_t end;     //Items hashed so far
+  uint64_t power; //DIFF_PRIME to the power width - 1
+  uint64_t hash;  //Of the window ending at end
+};
+
+static void startWindows(struct WindowScan *scan, const uint64_t *hashes, size_t count, size_t width, int sampleBits) {
+  scan->hashes = hashes;
+  scan->count = count;
+  scan->width = width;
+  scan->sampleMask = ((uint64_t)1 << sampleBits) - 1;
+  scan->end = 0;
+  scan->hash = 0;
+  scan->power = 1;
+  for (size_t k = 0; k + 1 < width; k++) {
+    scan->power *= DIFF_PRIME;
+  }
+}
+
+/* Move to the next sampled window
+ * Returns 1 with its first item in *position, 0 at the end
+ */
+static int nextWindow(struct WindowScan *scan, size_t *position) {
+  while (scan->end < scan->count) {
+    if (scan->end >= scan->width) {
+      scan->hash -= scan->hashes[scan->end - scan->width] * scan->power;
+    }
+    scan->hash = scan->hash * DIFF_PRIME + scan->hashes[scan->end++];
+    if (scan->end >= scan->width && (scan->hash & scan->sampleMask) == 0) {
+      *position = scan->end - scan->width;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Collect the sampled windows of width items that occur exactly once on
+ * each side, in old order, keeping only a chain that is increasing on the
+ * new side too (longest increasing subsequence)
+ * Returns the number of anchors left in *chain, -1 if memory ran out
+ */
+static long findAnchors(const uint64_t *before, size_t beforeCount, const uint64_t *after, size_t afterCount,
+                        size_t width, int sampleBits, struct Anchor **chain) {
+  struct Anchor *anchors = NULL;
+  struct AnchorTable table = {NULL, 0};
+  size_t count = 0, capacity = 0, kept = 0, longest = 0;
+  size_t position, *tails = NULL, *previous = NULL;
+  struct WindowScan scan;
+
+  *chain = NULL;
+  startWindows(&scan, before, beforeCount, width, sampleBits);
+  while (nextWindow(&scan, &position)) {
+    if (count == capacity) {
+      size_t grown = capacity ? 2 * capacity : 4096;
+      struct Anchor *bigger = realloc(anchors, grown * sizeof(*bigger));
+      if (bigger == NULL) {
+        free(anchors);
+        return -1;
+      }
+      anchors = bigger;
+      capacity = grown;
+    }
+    anchors[count].hash = scan.hash;
+    anchors[count].before = position;
+    anchors[count++].after = 0;
+  }
+
+  for (table.mask = 1; table.mask < 2 * count; table.mask *= 2) {
+  }
+  table.slots = calloc(table.mask, sizeof(*table.slots));
+  table.mask--;
+  if (table.slots == NULL) {
+    free(anchors);
+    return -1;
+  }
+  for (size_t i = 0; i < count; i++) {
+    size_t *slot = findSlot(&table, anchors, anchors[i].hash);
+    if (*slot == 0) {
+      *slot = i + 1;
+    }
+    else {
+      anchors[*slot - 1].after = ANCHOR_SHARED;
+      anchors[i].after = ANCHOR_SHARED;
+    }
+  }
+  //after holds 0 until a match, then position + 1, or ANCHOR_SHARED
+  startWindows(&scan, after, afterCount, width, sampleBits);
+  while (nextWindow(&scan, &position)) {
+    size_t *slot = findSlot(&table, anchors, scan.hash);
+    if (*slot != 0) {
+      struct Anchor *anchor = &anchors[*slot - 1];
+      anchor->after = anchor->after == 0 ? position + 1 : ANCHOR_SHARED;
+    }
+  }
+  free(table.slots);
+
+  for (size_t i = 0; i < count; i++) {
+    if (anchors[i].after != 0 && anchors[i].after != ANCHOR_SHARED) {
+      anchors[kept] = anchors[i];
+      anchors[kept++].after--;
+    }
+  }
+
+  //Patience sorting: tails[l] is the anchor ending the best chain of length l + 1
+  tails = malloc((kept + 1) * sizeof(*tails));
+  previous = malloc((kept + 1) * sizeof(*previous));
+  *chain = malloc((kept + 1) * sizeof(**chain));
+  if (tails == NULL || previous == NULL || *chain == NULL) {
+    free(tails);
+    free(previous);
+    free(*chain);
+    free(anchors);
+    *chain = NULL;
+    return -1;
+  }
+  for (size_t i = 0; i < kept; i++) {
+    size_t low = 0, high = longest;
+    while (low < high) {
+      size_t mid = low + (high - low) / 2;
+      if (anchors[tails[mid]].after < anchors[i].after) {
+        low = mid + 1;
+      }
+      else {
+        high = mid;
+      }
+    }
+    previous[i] = low > 0 ? tails[low - 1] : ANCHOR_SHARED;
+    tails[low] = i;
+    if (low == longest) {
+      longest++;
+    }
+  }
+  for (size_t i = longest, at = longest ? tails[longest - 1] : 0; i > 0; i--) {
+    (*chain)[i - 1] = anchors[at];
+    at = previous[at];
+  }
+  free(tails);
+  free(previous);
+  free(anchors);
+  return (long)longest;
+}
+
+/* Write the listing lines of items [first, end) of ir, each behind mark
+ */
+static void writeSide(struct OutBuffer *out, const struct ImageIr *ir, size_t first, size_t end, char mark) {
+  struct Y86Record record;
+
+  for (size_t i = first; i < end; i++) {
+    char *p = reserveOut(out, Y86_LINE_MAX + 2);
+    getIrRecord(ir, i, &record);
+    p[0] = mark;
+    p[1] = ' ';
+    size_t n = y86RenderRecord(&record, p + 2);
+    if (n != 0) {
+      commitOut(out, p + 2 + n);
+    }
+  }
+}
+
+/* Write "0xSTART-0xEND" for items [first, end) of ir, or the address the
+ * next item would have if the range is empty
+ */
+static char *putItemRange(char *p, const struct ImageIr *ir, size_t first, size_t end) {
+  uint64_t start, stop;
+
+  if (first < ir->count) {
+    start = irAddress(ir, first);
+  }
+  else if (ir->count > 0) {
+    start = irAddress(ir, ir->count - 1) + irLength(ir, ir->count - 1);
+  }
+  else {
+    start = 0;
+  }
+  stop = start;
+  if (end > first) {
+    stop = irAddress(ir, end - 1) + irLength(ir, end - 1);
+  }
+  p = putHexValue(p, start);
+  *p++ = '-';
+  return putHexValue(p, stop);
+}
+
+static void writeHunk(struct OutBuffer *out, const struct ImageIr *before, size_t beforeFirst, size_t beforeEnd,
+                      const struct ImageIr *after, size_t afterFirst, size_t afterEnd) {
+  char *p = reserveOut(out, OUT_LINE_MAX);
+  *p++ = '@';
+  *p++ = '@';
+  *p++ = ' ';
+  p = putItemRange(p, before, beforeFirst, beforeEnd);
+  *p++ = ' ';
+  p = putItemRange(p, after, afterFirst, afterEnd);
+  *p++ = ' ';
+  *p++ = '@';
+  *p++ = '@';
+  *p++ = '\n';
+  commitOut(out, p);
+  writeSide(out, before, beforeFirst, beforeEnd, '-');
+  writeSide(out, after, afterFirst, afterEnd, '+');
+}
+
+//Old items [a, aEnd) stand where new items [b, bEnd) do
+struct Hunk {
+  size_t a, aEnd;
+  size_t b, bEnd;
+};
+
+//Hunks in order on both sides
+struct HunkList {
+  struct Hunk *hunks;
+  size_t count;
+  size_t capacity;
+};
+
+/* Append a hunk, merging it into the last one if they touch on both sides
+ * Returns 0 on success and -1 if memory ran out
+ */
+static int addHunk(struct HunkList *list, size_t a, size_t aEnd, size_t b, size_t bEnd) {
+  struct Hunk *last = list->count ? &list->hunks[list->count - 1] : NULL;
+
+  if (last != NULL && last->aEnd == a && last->bEnd == b) {
+    last->aEnd = aEnd;
+    last->bEnd = bEnd;
+    return 0;
+  }
+  if (list->count == list->capacity) {
+    size_t grown = list->capacity ? 2 * list->capacity : 64;
+    struct Hunk *bigger = realloc(list->hunks, grown * sizeof(*bigger));
+    if (bigger == NULL) {
+      return -1;
+    }
+    list->hunks = bigger;
+    list->capacity = grown;
+  }
+  list->hunks[list->count].a = a;
+  list->hunks[list->count].aEnd = aEnd;
+  list->hunks[list->count].b = b;
+  list->hunks[list->count++].bEnd = bEnd;
+  return 0;
+}
+
+/* What diffRange works on
+ */
+struct DiffRun {
+  const struct ImageIr *before;
+  const struct ImageIr *after;
+  const uint64_t *beforeHashes;
+  const uint64_t *afterHashes;
+  struct HunkList aligned; //What diffRange found, in order
+};
+
+static int emitHunk(struct DiffRun *run, size_t a, size_t aEnd, size_t b, size_t bEnd) {
+  if (a < aEnd || b < bEnd) {
+    return addHunk(&run->aligned, a, aEnd, b, bEnd);
+  }
+  return 0;
+}
+
+/* Align old items [a, aEnd) with new items [b, bEnd) and collect the hunks
+ * The common head and tail are dropped, then anchors of width items
+ * (sampled with sampleBits) split the rest; matches grow from each anchor
+ * in both directions and what is left between them is aligned again on
+ * single unique items, down to depth DIFF_MAX_DEPTH.
+ * Returns 0 on success and -1 if memory ran out
+ */
+static int diffRange(struct DiffRun *run, size_t a, size_t aEnd, size_t b, size_t bEnd, size_t width, int sampleBits,
+                     int depth) {
+  const uint64_t *before = run->beforeHashes, *after = run->afterHashes;
+  struct Anchor *chain;
+  long anchorCount;
+
+  while (a < aEnd && b < bEnd && before[a] == after[b]) {
+    a++;
+    b++;
+  }
+  while (aEnd > a && bEnd > b && before[aEnd - 1] == after[bEnd - 1]) {
+    aEnd--;
+    bEnd--;
+  }
+  if (a == aEnd || b == bEnd || depth == DIFF_MAX_DEPTH) {
+    return emitHunk(run, a, aEnd, b, bEnd);
+  }
+
+  anchorCount = findAnchors(before + a, aEnd - a, after + b, bEnd - b, width, sampleBits, &chain);
+  if (anchorCount < 0) {
+    return -1;
+  }
+  if (anchorCount == 0) {
+    free(chain);
+    if (width > 1) {
+      return diffRange(run, a, aEnd, b, bEnd, 1, 0, depth + 1);
+    }
+    return emitHunk(run, a, aEnd, b, bEnd);
+  }
+  for (long i = 0; i < anchorCount; i++) {
+    chain[i].before += a;
+    chain[i].after += b;
+  }
+  for (long i = 0; i <= anchorCount; i++) {
+    size_t startA = aEnd, startB = bEnd;
+
+    if (i < anchorCount) {
+      startA = chain[i].before;
+      startB = chain[i].after;
+      if (startA < a || startB < b) {
+        continue; //Inside the match grown from the last anchor
+      }
+      while (startA > a && startB > b && before[startA - 1] == after[startB - 1]) {
+        startA--;
+        startB--;
+      }
+    }
+    if (diffRange(run, a, startA, b, startB, 1, 0, depth + 1) != 0) {
+      free(chain);
+      return -1;
+    }
+    a = startA;
+    b = startB;
+    while (a < aEnd && b < bEnd && before[a] == after[b]) {
+      a++;
+      b++;
+    }
+  }
+  free(chain);
+  return 0;
+}
+
+/* 1 if item index of ir is a listed jXX or call
+ */
+static int isBranchItem(const struct ImageIr *ir, size_t index) {
+  const struct IrChunk *chunk = irChunkOf(ir, index);
+  size_t slot = index % IR_CHUNK;
+  uint8_t icode = chunk->opcode[slot] >> 4;
+  return chunk->flags[slot] == Y86_KIND_CODE && (icode == 0x7 || icode == 0x8);
+}
+
+static uint64_t itemImmediate(const struct ImageIr *ir, size_t index) {
+  return irChunkOf(ir, index)->immediate[index % IR_CHUNK];
+}
+
+/* The new item old item matched, IR_NONE if item is in a hunk
+ */
+static size_t matchedItem(const struct HunkList *aligned, size_t item) {
+  size_t low = 0, high = aligned->count; //First hunk ending after item
+
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (aligned->hunks[mid].aEnd <= item) {
+      low = mid + 1;
+    }
+    else {
+      high = mid;
+    }
+  }
+  if (low < aligned->count && aligned->hunks[low].a <= item) {
+    return IR_NONE;
+  }
+  if (low == 0) {
+    return item;
+  }
+  return item - aligned->hunks[low - 1].aEnd + aligned->hunks[low - 1].bEnd;
+}
+
+/* The first new item of the insertion (a hunk with no old items) that ends
+ * right before new item item, IR_NONE if there is none
+ */
+static size_t insertedBefore(const struct HunkList *aligned, size_t item) {
+  size_t low = 0, high = aligned->count; //First hunk ending at or after item
+
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (aligned->hunks[mid].bEnd < item) {
+      low = mid + 1;
+    }
+    else {
+      high = mid;
+    }
+  }
+  if (low < aligned->count && aligned->hunks[low].bEnd == item && aligned->hunks[low].a == aligned->hunks[low].aEnd) {
+    return aligned->hunks[low].b;
+  }
+  return IR_NONE;
+}
+
+/* 1 if old branch item i, matched with new item j, does not go where its
+ * old destination went: the old destination is mapped through the
+ * alignment, or, when it lies in a hunk or outside the image, must be
+ * unchanged either as an address or relative to the branch
+ * A branch to the start of an item may also go to the start of code
+ * inserted right before it, as a call does when its function gets a new
+ * first instruction.
+ */
+static int isRetargeted(const struct DiffRun *run, size_t i, size_t j) {
+  uint64_t oldDest = itemImmediate(run->before, i), newDest = itemImmediate(run->after, j);
+  size_t target = findIrItem(run->before, oldDest);
+  size_t moved = target == IR_NONE ? IR_NONE : matchedItem(&run->aligned, target);
+
+  if (moved != IR_NONE) {
+    uint64_t offset = oldDest - irAddress(run->before, target);
+    size_t inserted = offset == 0 ? insertedBefore(&run->aligned, moved) : IR_NONE;
+    return newDest != irAddress(run->after, moved) + offset &&
+           (inserted == IR_NONE || newDest != irAddress(run->after, inserted));
+  }
+  return newDest != oldDest && newDest - irAddress(run->after, j) != oldDest - irAddress(run->before, i);
+}
+
+/* Walk the items diffRange matched and add a one item hunk for every branch
+ * whose destination changed, merging them with the aligned hunks in order
+ * Returns 0 on success and -1 if memory ran out
+ */
+static int checkBranches(const struct DiffRun *run, struct HunkList *hunks) {
+  size_t a = 0, b = 0; //Start of the current matched stretch
+
+  for (size_t h = 0; h <= run->aligned.count; h++) {
+    size_t aEnd = h < run->aligned.count ? run->aligned.hunks[h].a : run->before->count;
+    for (size_t i = a; i < aEnd; i++) {
+      size_t j = b + (i - a);
+      if (isBranchItem(run->before, i) && isRetargeted(run, i, j) && addHunk(hunks, i, i + 1, j, j + 1) != 0) {
+        return -1;
+      }
+    }
+    if (h < run->aligned.count) {
+      const struct Hunk *hunk = &run->aligned.hunks[h];
+      if (addHunk(hunks, hunk->a, hunk->aEnd, hunk->b, hunk->bEnd) != 0) {
+        return -1;
+      }
+      a = hunk->aEnd;
+      b = hunk->bEnd;
+    }
+  }
+  return 0;
+}
+
+/* Write the regions in which two listings differ, ignoring where they sit:
+ * items are compared by a hash that leaves out addresses, windows of
+ * DIFF_WINDOW items that occur once in each image anchor the alignment,
+ * and matches are grown from each anchor in both directions; see diffRange.
+ * A matched jXX or call whose destination does not follow the alignment is
+ * a change of its own, see checkBranches.
+ * Everything between two matched stretches is written as a hunk: an
+ * "@@ old range new range @@" line, the old lines behind "-" and the new
+ * ones behind "+". Runs of zero bytes (silent halts) match for free, so
+ * only changes show up. A "# N changed regions" line ends the output.
+ * Time and memory are linear in the two item counts plus a log factor for
+ * the anchor chains.
+ * Returns 0 on success and -1 if memory ran out or writing failed (errno is set)
+ */
+int diffImageIrs(struct OutBuffer *out, const struct ImageIr *before, const struct ImageIr *after) {
+  uint64_t *beforeHashes = hashItems(before);
+  uint64_t *afterHashes = hashItems(after);
+  struct DiffRun run = {before, after, beforeHashes, afterHashes, {NULL, 0, 0}};
+  struct HunkList hunks = {NULL, 0, 0};
+  int result = -1;
+
+  if (beforeHashes != NULL && afterHashes != NULL) {
+    result = diffRange(&run, 0, before->count, 0, after->count, DIFF_WINDOW, DIFF_SAMPLE_BITS, 0);
+  }
+  if (result == 0) {
+    result = checkBranches(&run, &hunks);
+  }
+  free(beforeHashes);
+  free(afterHashes);
+  free(run.aligned.hunks);
+  if (result != 0) {
+    free(hunks.hunks);
+    errno = ENOMEM;
+    return -1;
+  }
+  for (size_t h = 0; h < hunks.count; h++) {
+    writeHunk(out, before, hunks.hunks[h].a, hunks.hunks[h].aEnd, after, hunks.hunks[h].b, hunks.hunks[h].bEnd);
+  }
+  free(hunks.hunks);
+
+  char *p = reserveOut(out, OUT_LINE_MAX);
+  *p++ = '#';
+  *p++ = ' ';
+  p = putDecimal(p, hunks.count);
+  memcpy(p, " changed regions\n", 17);
+  commitOut(out, p + 17);
+  if (out->error != 0) {
+    errno = out->error;
+    return -1;
+  }
+  return 0;
+}
+
+/* Decode two whole images into IRs and write how the second differs from
+ * the first to out, see diffImageIrs
+ * Returns 0 on success and -1 if an input could not be read or the output written
+ */
+int diffMachineCode(FILE *out, FILE *beforeCode, FILE *afterCode) {
+  struct InputMap beforeMap, afterMap;
+  struct ImageIr before, after;
+  struct OutBuffer ob;
+  int result = -1;
+
+  if (fflush(out) != 0 || openOutBuffer(&ob, fileno(out), OUT_BUFFER_SIZE) != 0) {
+    return -1;
+  }
+  if (mapInput(beforeCode, &beforeMap) != 0) {
+    closeOutBuffer(&ob);
+    return -1;
+  }
+  if (mapInput(afterCode, &afterMap) == 0) {
+    if (buildImageIr(beforeMap.data, beforeMap.length, 0, &before) == 0) {
+      if (buildImageIr(afterMap.data, afterMap.length, 0, &after) == 0) {
+        result = diffImageIrs(&ob, &before, &after);
+        freeImageIr(&after);
+      }
+      freeImageIr(&before);
+    }
+    unmapInput(&afterMap);
+  }
+  unmapInput(&beforeMap);
+  if (closeOutBuffer(&ob) != 0) {
+    result = -1;
+  }
+  return result;
+}
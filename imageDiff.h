@@ -0,0 +1,21 @@
+/* This file contains the prototypes and constants needed to use the
+   routines defined in imageDiff.c
+*/
+
+#ifndef _IMAGEDIFF_H_
+#define _IMAGEDIFF_H_
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "outBuffer.h"
+#include "imageIr.h"
+
+#define DIFF_WINDOW 16     //Items hashed together to find anchors
+#define DIFF_SAMPLE_BITS 3 //Only windows whose hash has this many low zero bits become anchors
+#define DIFF_MAX_DEPTH 64  //Gaps nested deeper than this are written as one hunk
+
+int diffImageIrs(struct OutBuffer *out, const struct ImageIr *before, const struct ImageIr *after);
+int diffMachineCode(FILE *out, FILE *beforeCode, FILE *afterCode);
+
+#endif /* IMAGEDIFF */
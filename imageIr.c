@@ -0,0 +1,222 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "imageIr.h"
+#include "printRoutines.h"
+
+#define IR_BATCH 4096 //Records decoded per y86DecodeBatch call
+
+struct IrArenaBlock {
+  struct IrArenaBlock *next;
+};
+
+/* Return size bytes from the arena, 8 byte aligned, or NULL if memory ran out
+ */
+static void *arenaAlloc(struct IrArena *arena, size_t size) {
+  void *p;
+
+  size = (size + 7) & ~(size_t)7;
+  if (arena->left < size) {
+    size_t blockSize = size + sizeof(struct IrArenaBlock) > IR_ARENA_BLOCK ? size + sizeof(struct IrArenaBlock) : IR_ARENA_BLOCK;
+    struct IrArenaBlock *block = malloc(blockSize);
+    if (block == NULL) {
+      return NULL;
+    }
+    block->next = arena->blocks;
+    arena->blocks = block;
+    arena->next = (char *)(block + 1);
+    arena->left = blockSize - sizeof(*block);
+    arena->reserved += blockSize;
+  }
+  p = arena->next;
+  arena->next += size;
+  arena->left -= size;
+  return p;
+}
+
+static void freeArena(struct IrArena *arena) {
+  while (arena->blocks != NULL) {
+    struct IrArenaBlock *next = arena->blocks->next;
+    free(arena->blocks);
+    arena->blocks = next;
+  }
+  memset(arena, 0, sizeof(*arena));
+}
+
+/* Start a new chunk whose first item is at base
+ * Returns 0 on success and -1 if memory ran out
+ */
+static int addChunk(struct ImageIr *ir, uint64_t base) {
+  struct IrChunk *chunk;
+
+  if (ir->chunkCount == ir->chunkCapacity) {
+    size_t grown = ir->chunkCapacity ? 2 * ir->chunkCapacity : 64;
+    struct IrChunk **bigger = realloc(ir->chunks, grown * sizeof(*bigger));
+    if (bigger == NULL) {
+      return -1;
+    }
+    ir->chunks = bigger;
+    ir->chunkCapacity = grown;
+  }
+  chunk = arenaAlloc(&ir->arena, sizeof(*chunk));
+  if (chunk == NULL) {
+    return -1;
+  }
+  chunk->base = base;
+  ir->chunks[ir->chunkCount++] = chunk;
+  return 0;
+}
+
+/* Append an item made from record to ir, holding immediate
+ * Returns 0 on success and -1 if memory ran out
+ */
+static int addItem(struct ImageIr *ir, const struct Y86Record *record, uint64_t address, uint64_t immediate, int run) {
+  size_t slot = ir->count % IR_CHUNK;
+  struct IrChunk *chunk;
+
+  if (slot == 0 && addChunk(ir, address) != 0) {
+    return -1;
+  }
+  chunk = ir->chunks[ir->chunkCount - 1];
+  chunk->immediate[slot] = immediate;
+  chunk->offset[slot] = (uint32_t)(address - chunk->base);
+  chunk->opcode[slot] = record->kind == Y86_KIND_CODE ? (uint8_t)(record->opcode << 4 | record->ifun) : 0;
+  chunk->regs[slot] = (uint8_t)(record->rA << 4 | record->rB);
+  chunk->length[slot] = run ? 1 : (uint8_t)record->length;
+  chunk->flags[slot] = (uint8_t)(record->kind | (run ? IR_RUN : 0) | record->flags << 4);
+  ir->count++;
+  return 0;
+}
+
+/* Decode the listing of code[0..length), whose first byte lives at
+ * baseAddr, into ir: one item per y86DecodeBatch record, except that a run
+ * of silent halts is split every IR_RUN_MAX halts, so zero padding costs
+ * next to nothing and the IR still prints back to exactly the listing.
+ * Memory is about 16 bytes per item, allocated in 4 MB arena blocks.
+ * Returns 0 on success and -1 if memory ran out (errno is ENOMEM)
+ */
+int buildImageIr(const uint8_t *code, size_t length, unsigned long baseAddr, struct ImageIr *ir) {
+  struct Y86Record records[IR_BATCH];
+  struct Y86Cursor cursor;
+  size_t n;
+
+  memset(ir, 0, sizeof(*ir));
+  y86InitCursor(&cursor);
+  while ((n = y86DecodeBatch(code, length, baseAddr, &cursor, records, IR_BATCH)) > 0) {
+    for (size_t i = 0; i < n; i++) {
+      const struct Y86Record *record = &records[i];
+      int failed;
+
+      if (record->flags & Y86_FLAG_SILENT) {
+        uint64_t address = record->address;
+        failed = 0;
+        for (uint64_t left = record->length; left > 0 && !failed; ) {
+          uint64_t run = left < IR_RUN_MAX ? left : IR_RUN_MAX;
+          failed = addItem(ir, record, address, run, 1);
+          address += run;
+          left -= run;
+        }
+      }
+      else {
+        failed = addItem(ir, record, record->address, record->immediate, 0);
+      }
+      if (failed) {
+        freeImageIr(ir);
+        errno = ENOMEM;
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+void freeImageIr(struct ImageIr *ir) {
+  freeArena(&ir->arena);
+  free(ir->chunks);
+  memset(ir, 0, sizeof(*ir));
+}
+
+/* Binary search for the item covering address: first among the chunk
+ * bases, then among the offsets of that chunk
+ * Returns the index of the item, or IR_NONE
+ */
+size_t findIrItem(const struct ImageIr *ir, uint64_t address) {
+  size_t low = 0, high = ir->chunkCount;
+  const struct IrChunk *chunk;
+  size_t items;
+
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (ir->chunks[mid]->base <= address) {
+      low = mid + 1;
+    }
+    else {
+      high = mid;
+    }
+  }
+  if (low == 0) {
+    return IR_NONE;
+  }
+  chunk = ir->chunks[low - 1];
+  items = (low == ir->chunkCount && ir->count % IR_CHUNK != 0) ? ir->count % IR_CHUNK : IR_CHUNK;
+  if (address - chunk->base > UINT32_MAX) {
+    return IR_NONE;
+  }
+
+  uint32_t offset = (uint32_t)(address - chunk->base);
+  size_t first = 0, last = items;
+  while (first < last) {
+    size_t mid = first + (last - first) / 2;
+    if (chunk->offset[mid] <= offset) {
+      first = mid + 1;
+    }
+    else {
+      last = mid;
+    }
+  }
+  first--; //offset[0] is 0, so some item starts at or before address
+  if (offset - chunk->offset[first] >= irLength(ir, (low - 1) * IR_CHUNK + first)) {
+    return IR_NONE;
+  }
+  return (low - 1) * IR_CHUNK + first;
+}
+
+/* Unpack item index into the record y86DecodeBatch made it from
+ * A run of silent halts comes back as one silent record of irLength bytes.
+ */
+void getIrRecord(const struct ImageIr *ir, size_t index, struct Y86Record *record) {
+  const struct IrChunk *chunk = irChunkOf(ir, index);
+  size_t slot = index % IR_CHUNK;
+
+  record->address = chunk->base + chunk->offset[slot];
+  record->immediate = (chunk->flags[slot] & IR_RUN) ? 0 : chunk->immediate[slot];
+  record->opcode = chunk->opcode[slot] >> 4;
+  record->ifun = chunk->opcode[slot] & 0xF;
+  record->rA = chunk->regs[slot] >> 4;
+  record->rB = chunk->regs[slot] & 0xF;
+  record->length = (uint32_t)irLength(ir, index);
+  record->kind = chunk->flags[slot] & 0xF & ~IR_RUN;
+  record->flags = chunk->flags[slot] >> 4;
+}
+
+/* Write the listing the IR was decoded from
+ * Returns 0 on success and -1 if writing failed (errno is set)
+ */
+int writeIrListing(struct OutBuffer *out, const struct ImageIr *ir) {
+  struct Y86Record record;
+
+  for (size_t i = 0; i < ir->count; i++) {
+    char *p;
+    if (irChunkOf(ir, i)->flags[i % IR_CHUNK] & IR_RUN) {
+      continue; //Every halt of the run is silent, so it expands to no lines
+    }
+    p = reserveOut(out, Y86_LINE_MAX);
+    getIrRecord(ir, i, &record);
+    commitOut(out, p + y86RenderRecord(&record, p));
+  }
+  if (out->error != 0) {
+    errno = out->error;
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,77 @@
+/* This file contains the prototypes and constants needed to use the
+   routines defined in imageIr.c
+*/
+
+#ifndef _IMAGEIR_H_
+#define _IMAGEIR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "outBuffer.h"
+#include "disasm.h"
+
+#define IR_CHUNK 4096                  //Items per chunk; they span less than 4 GB
+#define IR_RUN 0x8                     //In the kind nibble of flags: a run of silent halts, immediate of them
+#define IR_RUN_MAX (1u << 20)          //Most halts one run item stands for, which bounds the span of a chunk
+#define IR_ARENA_BLOCK (4u << 20)      //Bytes the arena asks malloc for at a time
+#define IR_NONE ((size_t)-1)           //findIrItem result for an address no item covers
+
+/* Bump allocator over a list of large blocks, released all at once
+ */
+struct IrArena {
+  struct IrArenaBlock *blocks; //Most recent first
+  char *next;                  //Free space in the current block
+  size_t left;                 //Bytes free at next
+  size_t reserved;             //Bytes taken from malloc
+};
+
+/* IR_CHUNK consecutive items of the listing as a structure of arrays
+ * Addresses are kept as 32 bit offsets from base, so an item costs 16 bytes.
+ * A run of silent halts is a single item: kind Y86_KIND_CODE | IR_RUN, flag
+ * Y86_FLAG_SILENT, length 1 and the number of halts in immediate.
+ */
+struct IrChunk {
+  uint64_t base;                 //Address of the first item
+  uint64_t immediate[IR_CHUNK];  //V, D or Dest of an instruction, the value of a quad or byte
+  uint32_t offset[IR_CHUNK];     //Address - base
+  uint8_t opcode[IR_CHUNK];      //First byte of an instruction, 0 for data
+  uint8_t regs[IR_CHUNK];        //Register byte, 0xFF if there is none
+  uint8_t length[IR_CHUNK];      //Bytes covered
+  uint8_t flags[IR_CHUNK];       //Y86Kind in the low nibble, Y86_FLAG_* bits above it
+};
+
+/* Every item of the listing of a whole image, in address order
+ * Item i lives in chunks[i / IR_CHUNK] at i % IR_CHUNK; chunks come from the arena.
+ */
+struct ImageIr {
+  struct IrArena arena;
+  struct IrChunk **chunks;
+  size_t chunkCount;
+  size_t chunkCapacity;
+  size_t count; //Items, each run of silent halts counting as one
+};
+
+int buildImageIr(const uint8_t *code, size_t length, unsigned long baseAddr, struct ImageIr *ir);
+void freeImageIr(struct ImageIr *ir);
+size_t findIrItem(const struct ImageIr *ir, uint64_t address);
+void getIrRecord(const struct ImageIr *ir, size_t index, struct Y86Record *record);
+int writeIrListing(struct OutBuffer *out, const struct ImageIr *ir);
+
+static inline const struct IrChunk *irChunkOf(const struct ImageIr *ir, size_t index) {
+  return ir->chunks[index / IR_CHUNK];
+}
+
+static inline uint64_t irAddress(const struct ImageIr *ir, size_t index) {
+  const struct IrChunk *chunk = irChunkOf(ir, index);
+  return chunk->base + chunk->offset[index % IR_CHUNK];
+}
+
+/* Bytes item index covers, all of them for a run of silent halts
+ */
+static inline uint64_t irLength(const struct ImageIr *ir, size_t index) {
+  const struct IrChunk *chunk = irChunkOf(ir, index);
+  size_t slot = index % IR_CHUNK;
+  return (chunk->flags[slot] & IR_RUN) ? chunk->immediate[slot] : chunk->length[slot];
+}
+
+#endif /* IMAGEIR */
@@ -0,0 +1,154 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "inputMap.h"
+
+#define STREAM_CHUNK 65536 //Bytes requested per fread when streaming
+
+static const uint8_t emptyImage[1] = {0x0};
+
+/* Throw away the first skip bytes of a stream that cannot be mapped
+ * Seekable streams are positioned directly; pipes have to be drained.
+ * Returns 0 on success and -1 on read failure
+ */
+static int skipInput(FILE *machineCode, unsigned long skip) {
+  uint8_t scratch[STREAM_CHUNK];
+
+  if (skip == 0 || fseeko(machineCode, (off_t)skip, SEEK_CUR) == 0) {
+    return 0;
+  }
+  clearerr(machineCode);
+  while (skip > 0) {
+    size_t want = skip < STREAM_CHUNK ? (size_t)skip : STREAM_CHUNK;
+    size_t got = fread(scratch, 1, want, machineCode);
+    if (got == 0) {
+      return ferror(machineCode) ? -1 : 0; //Window starts past the end
+    }
+    skip -= got;
+  }
+  return 0;
+}
+
+/* Read at most limit bytes of a stream that cannot be mapped into a growing heap buffer
+ * Returns 0 on success and -1 on allocation or read failure
+ */
+static int streamInput(FILE *machineCode, unsigned long limit, struct InputMap *map) {
+  size_t capacity = 0;
+  size_t length = 0;
+  uint8_t *buffer = NULL;
+
+  while (length < limit) {
+    if (capacity - length < STREAM_CHUNK) {
+      size_t newCapacity = capacity ? capacity * 2 : 4 * STREAM_CHUNK;
+      uint8_t *grown = realloc(buffer, newCapacity);
+      if (grown == NULL) {
+        free(buffer);
+        return -1;
+      }
+      buffer = grown;
+      capacity = newCapacity;
+    }
+    size_t want = capacity - length;
+    if (want > limit - length) {
+      want = (size_t)(limit - length);
+    }
+    size_t got = fread(buffer + length, 1, want, machineCode);
+    length += got;
+    if (got == 0) {
+      break;
+    }
+  }
+  if (ferror(machineCode)) {
+    free(buffer);
+    return -1;
+  }
+
+  map->data = length ? buffer : emptyImage;
+  map->length = length;
+  map->base = buffer;
+  map->baseLength = capacity;
+  map->mapped = 0;
+  return 0;
+}
+
+/* Make the bytes [startingOffset, endOffset) of the machine code image
+ * available as one contiguous byte span; endOffset may be INPUT_TO_END
+ * Regular files are mapped with mmap so only the pages of the window are
+ * touched and no byte is copied; other streams fall back to being read in
+ * large chunks, skipping everything before the window.
+ * A window that starts past the end of the image is empty.
+ * Returns 0 on success and -1 on failure (errno describes the failure)
+ */
+int mapInputWindow(FILE *machineCode, unsigned long startingOffset, unsigned long endOffset, struct InputMap *map) {
+  struct stat info;
+  int fd = fileno(machineCode);
+
+  memset(map, 0, sizeof(*map));
+  map->data = emptyImage;
+  if (endOffset <= startingOffset) {
+    return 0; //Nothing to decode
+  }
+
+  if (fd >= 0 && fstat(fd, &info) == 0 && S_ISREG(info.st_mode)) {
+    unsigned long size = (unsigned long)info.st_size;
+    if (endOffset > size) {
+      endOffset = size;
+    }
+    if (startingOffset >= endOffset) {
+      return 0; //Nothing to decode
+    }
+    //mmap offsets have to be page aligned so map from the page holding startingOffset
+    unsigned long pageSize = (unsigned long)sysconf(_SC_PAGESIZE);
+    unsigned long mapStart = startingOffset - startingOffset % pageSize;
+    size_t mapLength = (size_t)(endOffset - mapStart);
+    void *base = mmap(NULL, mapLength, PROT_READ, MAP_PRIVATE, fd, (off_t)mapStart);
+    if (base != MAP_FAILED) {
+      posix_madvise(base, mapLength, POSIX_MADV_SEQUENTIAL);
+      map->data = (const uint8_t *)base + (startingOffset - mapStart);
+      map->length = (size_t)(endOffset - startingOffset);
+      map->base = base;
+      map->baseLength = mapLength;
+      map->mapped = 1;
+      return 0;
+    }
+  }
+  if (skipInput(machineCode, startingOffset) != 0) {
+    return -1;
+  }
+  return streamInput(machineCode, endOffset - startingOffset, map);
+}
+
+/* Returns 1 if machineCode is a regular file (and so can be mapped), 0 otherwise
+ */
+int isRegularInput(FILE *machineCode) {
+  struct stat info;
+  int fd = fileno(machineCode);
+  return fd >= 0 && fstat(fd, &info) == 0 && S_ISREG(info.st_mode);
+}
+
+/* Make the whole machine code image available as one contiguous byte span
+ * Returns 0 on success and -1 on failure (errno describes the failure)
+ */
+int mapInput(FILE *machineCode, struct InputMap *map) {
+  return mapInputWindow(machineCode, 0, INPUT_TO_END, map);
+}
+
+/* Release whatever mapInput acquired
+ */
+void unmapInput(struct InputMap *map) {
+  if (map->base != NULL) {
+    if (map->mapped) {
+      munmap(map->base, map->baseLength);
+    }
+    else {
+      free(map->base);
+    }
+  }
+  memset(map, 0, sizeof(*map));
+}
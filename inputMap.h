@@ -0,0 +1,31 @@
+/* This file contains the prototypes and constants needed to use the
+   routines defined in inputMap.c
+*/
+
+#ifndef _INPUTMAP_H_
+#define _INPUTMAP_H_
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* A read-only view of the whole machine code image.
+ * Regular files are memory mapped; anything that cannot be mapped
+ * (pipes, terminals, ...) is streamed into a heap buffer instead.
+ */
+struct InputMap {
+  const uint8_t *data; //First byte of the image
+  size_t length;       //Number of bytes in the image
+  void *base;          //What to release (mapping or heap buffer), NULL if nothing
+  size_t baseLength;   //Length of the mapping
+  int mapped;          //1 if base is an mmap region, 0 if it is a heap buffer
+};
+
+#define INPUT_TO_END ((unsigned long)-1) //Window end meaning "until end of file"
+
+int mapInput(FILE *machineCode, struct InputMap *map);
+int mapInputWindow(FILE *machineCode, unsigned long startingOffset, unsigned long endOffset, struct InputMap *map);
+void unmapInput(struct InputMap *map);
+int isRegularInput(FILE *machineCode);
+
+#endif /* INPUTMAP */
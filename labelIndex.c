@@ -0,0 +1,295 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "labelIndex.h"
+#include "printRoutines.h"
+#include "disasm.h"
+
+#define LABEL_BATCH 4096 //Records decoded per y86DecodeBatch call
+
+static int isBranch(const struct Y86Record *record) {
+  return record->kind == Y86_KIND_CODE && (record->opcode == 0x7 || record->opcode == 0x8); //jXX, call
+}
+
+/* Sort n keys with an LSD radix sort, one byte per pass
+ * Passes in which every key has the same byte are skipped, so small
+ * addresses only cost a few passes. tmp must have room for n keys.
+ */
+static void radixSort(uint64_t *keys, uint64_t *tmp, size_t n) {
+  uint64_t *from = keys, *to = tmp;
+
+  for (int shift = 0; shift < 64 && n > 1; shift += 8) {
+    size_t counts[256] = {0};
+    size_t sum = 0;
+
+    for (size_t i = 0; i < n; i++) {
+      counts[(from[i] >> shift) & 0xFF]++;
+    }
+    if (counts[(from[0] >> shift) & 0xFF] == n) {
+      continue;
+    }
+    for (int b = 0; b < 256; b++) {
+      size_t count = counts[b];
+      counts[b] = sum;
+      sum += count;
+    }
+    for (size_t i = 0; i < n; i++) {
+      to[counts[(from[i] >> shift) & 0xFF]++] = from[i];
+    }
+    uint64_t *swap = from;
+    from = to;
+    to = swap;
+  }
+  if (from != keys) {
+    memcpy(keys, from, n * sizeof(*keys));
+  }
+}
+
+/* Collect the destination of every jXX and call in the listing of
+ * code[0..length), in address order of the branches
+ * Returns the number of destinations in *targets, or -1 if memory ran out
+ */
+static long collectTargets(const uint8_t *code, size_t length, unsigned long baseAddr, uint64_t **targets) {
+  struct Y86Record records[LABEL_BATCH];
+  struct Y86Cursor cursor;
+  size_t n, count = 0, capacity = 0;
+
+  *targets = NULL;
+  y86InitCursor(&cursor);
+  while ((n = y86DecodeBatch(code, length, baseAddr, &cursor, records, LABEL_BATCH)) > 0) {
+    for (size_t i = 0; i < n; i++) {
+      if (!isBranch(&records[i])) {
+        continue;
+      }
+      if (count == capacity) {
+        size_t grown = capacity ? 2 * capacity : 4096;
+        uint64_t *bigger = realloc(*targets, grown * sizeof(**targets));
+        if (bigger == NULL) {
+          return -1;
+        }
+        *targets = bigger;
+        capacity = grown;
+      }
+      (*targets)[count++] = records[i].immediate;
+    }
+  }
+  return (long)count;
+}
+
+/* Fill in the sources of index->labels: one pass counts the branches to
+ * each label, a second one drops each branch into its label's row
+ * Returns 0 on success and -1 if memory ran out
+ */
+static int buildSources(const uint8_t *code, size_t length, unsigned long baseAddr, struct LabelIndex *index) {
+  struct Y86Record records[LABEL_BATCH];
+  struct Y86Cursor cursor;
+  size_t *next;
+  size_t n;
+
+  index->firstSource = calloc(index->count + 1, sizeof(*index->firstSource));
+  if (index->firstSource == NULL) {
+    return -1;
+  }
+  y86InitCursor(&cursor);
+  while ((n = y86DecodeBatch(code, length, baseAddr, &cursor, records, LABEL_BATCH)) > 0) {
+    for (size_t i = 0; i < n; i++) {
+      size_t label = isBranch(&records[i]) ? findLabel(index, records[i].immediate) : LABEL_NONE;
+      if (label != LABEL_NONE) {
+        index->firstSource[label + 1]++;
+      }
+    }
+  }
+  for (size_t i = 0; i < index->count; i++) {
+    index->firstSource[i + 1] += index->firstSource[i];
+  }
+
+  index->sources = malloc((index->firstSource[index->count] + 1) * sizeof(*index->sources));
+  next = malloc(index->count * sizeof(*next));
+  if (index->sources == NULL || next == NULL) {
+    free(next);
+    return -1;
+  }
+  memcpy(next, index->firstSource, index->count * sizeof(*next));
+  y86InitCursor(&cursor);
+  while ((n = y86DecodeBatch(code, length, baseAddr, &cursor, records, LABEL_BATCH)) > 0) {
+    for (size_t i = 0; i < n; i++) {
+      size_t label = isBranch(&records[i]) ? findLabel(index, records[i].immediate) : LABEL_NONE;
+      if (label != LABEL_NONE) {
+        index->sources[next[label]++] = records[i].address;
+      }
+    }
+  }
+  free(next);
+  return 0;
+}
+
+/* Build the label index of the listing of code[0..length), whose first byte
+ * lives at baseAddr: collect all branch destinations, radix sort them, drop
+ * duplicates and every destination that is not the address of a listing line
+ * (the middle of an instruction, a silent halt, outside the image). With xref
+ * set the branches to each label are recorded too.
+ * Memory is 8 bytes per branch (twice that while sorting) and nothing is
+ * allocated per target.
+ * Returns 0 on success and -1 if memory ran out (errno is ENOMEM)
+ */
+int buildLabelIndex(const uint8_t *code, size_t length, unsigned long baseAddr, int xref, struct LabelIndex *index) {
+  struct Y86Record records[LABEL_BATCH];
+  struct Y86Cursor cursor;
+  uint64_t *targets, *tmp;
+  long found = collectTargets(code, length, baseAddr, &targets);
+  size_t count, unique = 0, kept = 0, next = 0, n;
+
+  memset(index, 0, sizeof(*index));
+  if (found < 0) {
+    free(targets);
+    errno = ENOMEM;
+    return -1;
+  }
+  count = (size_t)found;
+  tmp = malloc((count + 1) * sizeof(*tmp));
+  if (tmp == NULL) {
+    free(targets);
+    errno = ENOMEM;
+    return -1;
+  }
+  radixSort(targets, tmp, count);
+  free(tmp);
+  for (size_t i = 0; i < count; i++) {
+    if (unique == 0 || targets[unique - 1] != targets[i]) {
+      targets[unique++] = targets[i];
+    }
+  }
+
+  //Line addresses come in ascending order, so a merge finds the targets that are lines
+  y86InitCursor(&cursor);
+  while ((n = y86DecodeBatch(code, length, baseAddr, &cursor, records, LABEL_BATCH)) > 0 && next < unique) {
+    for (size_t i = 0; i < n; i++) {
+      if (records[i].flags & Y86_FLAG_SILENT) {
+        continue;
+      }
+      while (next < unique && targets[next] < records[i].address) {
+        next++;
+      }
+      if (next < unique && targets[next] == records[i].address) {
+        targets[kept++] = targets[next++];
+      }
+    }
+  }
+  index->labels = targets;
+  index->count = kept;
+
+  if (xref && buildSources(code, length, baseAddr, index) != 0) {
+    freeLabelIndex(index);
+    errno = ENOMEM;
+    return -1;
+  }
+  return 0;
+}
+
+void freeLabelIndex(struct LabelIndex *index) {
+  free(index->labels);
+  free(index->firstSource);
+  free(index->sources);
+  memset(index, 0, sizeof(*index));
+}
+
+/* Binary search for address among the labels
+ * Returns its position in index->labels, or LABEL_NONE
+ */
+size_t findLabel(const struct LabelIndex *index, uint64_t address) {
+  size_t low = 0, high = index->count;
+
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (index->labels[mid] < address) {
+      low = mid + 1;
+    }
+    else {
+      high = mid;
+    }
+  }
+  return (low < index->count && index->labels[low] == address) ? low : LABEL_NONE;
+}
+
+/* Write the synthetic name of the label at address, L_ and its hex digits
+ */
+static char *putLabelName(char *p, uint64_t address) {
+  *p++ = 'L';
+  *p++ = '_';
+  return putHexFixed(p, address, hexDigitCount(address));
+}
+
+/* Write the cross reference table: one comment line per label listing the
+ * addresses of the branches to it
+ */
+static void writeXrefTable(struct OutBuffer *out, const struct LabelIndex *index) {
+  writeOut(out, "# Cross references\n", 19);
+  for (size_t i = 0; i < index->count; i++) {
+    char *p = reserveOut(out, OUT_LINE_MAX);
+    *p++ = '#';
+    *p++ = ' ';
+    p = putLabelName(p, index->labels[i]);
+    *p++ = ':';
+    commitOut(out, p);
+    for (size_t s = index->firstSource[i]; s < index->firstSource[i + 1]; s++) {
+      p = reserveOut(out, OUT_LINE_MAX);
+      *p++ = ' ';
+      commitOut(out, putHexValue(p, index->sources[s]));
+    }
+    writeOut(out, "\n", 1);
+  }
+}
+
+/* Write the listing of code[0..length) with a "L_<address>:" line before
+ * every labelled line and label names in place of the destinations of
+ * jXX and call, followed by the cross reference table if index has one
+ * Returns 0 on success and -1 if writing failed (errno is set)
+ */
+int writeLabelledListing(struct OutBuffer *out, const uint8_t *code, size_t length, unsigned long baseAddr, const struct LabelIndex *index) {
+  struct Y86Record records[LABEL_BATCH];
+  struct Y86Cursor cursor;
+  size_t next = 0, n;
+
+  y86InitCursor(&cursor);
+  while ((n = y86DecodeBatch(code, length, baseAddr, &cursor, records, LABEL_BATCH)) > 0) {
+    for (size_t i = 0; i < n; i++) {
+      const struct Y86Record *record = &records[i];
+      const uint8_t *bytes = code + (record->address - baseAddr);
+      char *p;
+
+      if (record->flags & Y86_FLAG_SILENT) {
+        continue;
+      }
+      p = reserveOut(out, OUT_LINE_MAX);
+      if (next < index->count && index->labels[next] == record->address) {
+        p = putLabelName(p, record->address);
+        *p++ = ':';
+        *p++ = '\n';
+        commitOut(out, p);
+        p = reserveOut(out, OUT_LINE_MAX);
+        next++;
+      }
+      if (record->kind != Y86_KIND_CODE) {
+        p = putDataLine(p, bytes, record->length, record->address);
+      }
+      else if (isBranch(record) && findLabel(index, record->immediate) != LABEL_NONE) {
+        const struct OpDescriptor *op = &opTable[bytes[0]];
+        p = putColumns(p, record->address, bytes, op->length, op->mnemonic);
+        p = putLabelName(p, record->immediate);
+        *p++ = '\n';
+      }
+      else {
+        p = putInstruction(p, &opTable[bytes[0]], bytes, record->address);
+      }
+      commitOut(out, p);
+    }
+  }
+  if (index->firstSource != NULL) {
+    writeXrefTable(out, index);
+  }
+  if (out->error != 0) {
+    errno = out->error;
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,30 @@
+/* This file contains the prototypes and constants needed to use the
+   routines defined in labelIndex.c
+*/
+
+#ifndef _LABELINDEX_H_
+#define _LABELINDEX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "outBuffer.h"
+
+/* Every jXX/call destination that starts a listing line, sorted, and
+ * optionally who branches there. Sources are kept in compressed sparse row
+ * form: the branches to labels[i] are sources[firstSource[i]..firstSource[i + 1]).
+ */
+struct LabelIndex {
+  uint64_t *labels;
+  size_t count;
+  size_t *firstSource; //count + 1 entries, NULL without cross references
+  uint64_t *sources;   //Addresses of the branch instructions, ascending per label
+};
+
+#define LABEL_NONE ((size_t)-1) //findLabel result for an address without a label
+
+int buildLabelIndex(const uint8_t *code, size_t length, unsigned long baseAddr, int xref, struct LabelIndex *index);
+void freeLabelIndex(struct LabelIndex *index);
+size_t findLabel(const struct LabelIndex *index, uint64_t address);
+int writeLabelledListing(struct OutBuffer *out, const uint8_t *code, size_t length, unsigned long baseAddr, const struct LabelIndex *index);
+
+#endif /* LABELINDEX */
@@ -0,0 +1,563 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include "machineSim.h"
+#include "printRoutines.h"
+#include "decodeStats.h"
+
+/* Handlers the run loop dispatches to, one per operation rather than per
+ * opcode so OPq and jmp need no second switch
+ */
+enum SimOp {
+  OP_DECODE, //Not decoded yet (or overwritten since)
+  OP_HALT, OP_NOP, OP_RRMOVQ, OP_CMOVQ, OP_IRMOVQ, OP_RMMOVQ, OP_MRMOVQ,
+  OP_ADDQ, OP_SUBQ, OP_ANDQ, OP_XORQ, OP_MULQ, OP_DIVQ, OP_MODQ, OP_JMP,
+  OP_JXX, OP_CALL, OP_RET, OP_PUSHQ, OP_POPQ, OP_INVALID
+};
+
+/* An instruction decoded once and kept for every later visit to its address
+ */
+struct SimInstr {
+  uint64_t value;  //V, D or Dest
+  uint8_t op;      //A SimOp
+  uint8_t rA, rB;
+  uint8_t fn;      //Condition of jXX and cmovXX
+  uint8_t length;
+};
+
+#define CC_Z 4
+#define CC_S 2
+#define CC_O 1
+
+/* Bit cc of condTable[fn] is set if condition fn holds when the condition
+ * codes are cc (CC_Z | CC_S | CC_O): always, le, l, e, ne, ge, g
+ */
+static const uint8_t condTable[7] = {0xFF, 0xF6, 0x66, 0xF0, 0x0F, 0x99, 0x09};
+
+#define TAKEN(fn, cc) ((condTable[fn] >> (cc)) & 1)
+
+/* 1 if the signed product of a and b does not fit in 64 bits
+ */
+static int mulOverflows(uint64_t a, uint64_t b) {
+#if defined(__GNUC__)
+  int64_t product;
+  return __builtin_mul_overflow((int64_t)a, (int64_t)b, &product);
+#else
+  int64_t x = (int64_t)a, y = (int64_t)b;
+  if (x == 0 || y == 0) {
+    return 0;
+  }
+  if (x == -1 || y == -1) {
+    return x == INT64_MIN || y == INT64_MIN;
+  }
+  return (x > 0) == (y > 0) ? (x > 0 ? x > INT64_MAX / y : x < INT64_MAX / y)
+                            : (x > 0 ? y < INT64_MIN / x : x < INT64_MIN / y);
+#endif
+}
+
+static size_t pageHash(const struct Machine *m, uint64_t number) {
+  return (size_t)((number * 0x9E3779B97F4A7C15ULL) >> 24) & (m->pageSlots - 1);
+}
+
+/* The page holding address number * SIM_PAGE, NULL if it was never written
+ */
+static struct SimPage *findPage(struct Machine *m, uint64_t number) {
+  if (m->dataPage != NULL && m->dataPage->number == number) {
+    return m->dataPage;
+  }
+  for (size_t i = pageHash(m, number); m->pages[i] != NULL; i = (i + 1) & (m->pageSlots - 1)) {
+    if (m->pages[i]->number == number) {
+      return m->pages[i];
+    }
+  }
+  return NULL;
+}
+
+/* Like findPage, but creates a zeroed page if there is none
+ * Returns NULL if memory ran out
+ */
+static struct SimPage *makePage(struct Machine *m, uint64_t number) {
+  struct SimPage *page = findPage(m, number);
+  size_t i;
+
+  if (page != NULL) {
+    return page;
+  }
+  if (2 * (m->pageCount + 1) > m->pageSlots) {
+    size_t slots = 2 * m->pageSlots;
+    struct SimPage **pages = calloc(slots, sizeof(*pages));
+    struct SimPage **old = m->pages;
+    size_t oldSlots = m->pageSlots;
+    if (pages == NULL) {
+      return NULL;
+    }
+    m->pages = pages;
+    m->pageSlots = slots;
+    for (size_t j = 0; j < oldSlots; j++) {
+      if (old[j] != NULL) {
+        for (i = pageHash(m, old[j]->number); pages[i] != NULL; i = (i + 1) & (slots - 1)) {
+        }
+        pages[i] = old[j];
+      }
+    }
+    free(old);
+  }
+  page = calloc(1, sizeof(*page));
+  if (page == NULL) {
+    return NULL;
+  }
+  page->number = number;
+  for (i = pageHash(m, number); m->pages[i] != NULL; i = (i + 1) & (m->pageSlots - 1)) {
+  }
+  m->pages[i] = page;
+  m->pageCount++;
+  return page;
+}
+
+static int readByte(struct Machine *m, uint64_t addr) {
+  struct SimPage *page = findPage(m, addr / SIM_PAGE);
+  return page != NULL ? page->bytes[addr % SIM_PAGE] : 0;
+}
+
+/* Read the quad at addr into *value
+ * Returns 0 on success and -1 if the quad runs past the top of memory
+ */
+static int readQuad(struct Machine *m, uint64_t addr, uint64_t *value) {
+  size_t offset = addr % SIM_PAGE;
+  struct SimPage *page;
+
+  if (addr > UINT64_MAX - 7) {
+    return -1;
+  }
+  if (offset <= SIM_PAGE - 8) {
+    page = findPage(m, addr / SIM_PAGE);
+    if (page == NULL) {
+      *value = 0;
+      return 0;
+    }
+    m->dataPage = page;
+    memcpy(value, page->bytes + offset, 8);
+    return 0;
+  }
+  *value = 0;
+  for (int i = 7; i >= 0; i--) {
+    *value = *value << 8 | (uint64_t)readByte(m, addr + (uint64_t)i);
+  }
+  return 0;
+}
+
+/* Forget the decoded instructions that could include a byte in [addr, addr + 8)
+ */
+static void invalidateCode(struct Machine *m, uint64_t addr) {
+  uint64_t first = addr >= 9 ? addr - 9 : 0;
+  for (uint64_t a = first; a < addr + 8; a++) {
+    struct SimPage *page = findPage(m, a / SIM_PAGE);
+    if (page != NULL && page->code != NULL) {
+      page->code[a % SIM_PAGE].op = OP_DECODE;
+    }
+  }
+}
+
+/* Write value to the quad at addr
+ * Returns 0 on success and -1 if the address or memory for the page is bad
+ */
+static int writeQuad(struct Machine *m, uint64_t addr, uint64_t value) {
+  size_t offset = addr % SIM_PAGE;
+  struct SimPage *page;
+
+  if (addr > UINT64_MAX - 7) {
+    return -1;
+  }
+  if (offset >= 9 && offset <= SIM_PAGE - 8) {
+    page = makePage(m, addr / SIM_PAGE);
+    if (page == NULL) {
+      return -1;
+    }
+    m->dataPage = page;
+    memcpy(page->bytes + offset, &value, 8);
+    if (page->code != NULL) { //Self-modifying code, or a stack next to the program
+      for (size_t a = offset - 9; a < offset + 8; a++) {
+        page->code[a].op = OP_DECODE;
+      }
+    }
+    return 0;
+  }
+  for (int i = 0; i < 8; i++) {
+    page = makePage(m, (addr + (uint64_t)i) / SIM_PAGE);
+    if (page == NULL) {
+      return -1;
+    }
+    page->bytes[(addr + (uint64_t)i) % SIM_PAGE] = (uint8_t)(value >> (8 * i));
+  }
+  invalidateCode(m, addr);
+  return 0;
+}
+
+/* Decode the instruction at pc into ins, using the disassembler's opcode table
+ * for what is valid
+ */
+static void decodeInstr(struct Machine *m, uint64_t pc, struct SimInstr *ins) {
+  static const uint8_t opOf[12] = {OP_HALT, OP_NOP, OP_RRMOVQ, OP_IRMOVQ, OP_RMMOVQ, OP_MRMOVQ,
+                                   OP_ADDQ, OP_JXX, OP_CALL, OP_RET, OP_PUSHQ, OP_POPQ};
+  uint8_t instr[10];
+  const struct OpDescriptor *op;
+
+  for (int i = 0; i < 10; i++) {
+    instr[i] = (uint8_t)readByte(m, pc + (uint64_t)i);
+  }
+  op = &opTable[instr[0]];
+  memset(ins, 0, sizeof(*ins));
+  if (pc > UINT64_MAX - 10 || dataRunReason(op, instr, sizeof(instr)) != DATA_NONE) {
+    ins->op = OP_INVALID;
+    return;
+  }
+
+  unsigned char icode = instr[0] >> 4;   //icode is upper 4 bits
+  unsigned char ifun = instr[0] & 0x0F;  //ifun is lower 4 bits
+  ins->op = opOf[icode];
+  ins->fn = ifun;
+  ins->length = op->length;
+  if (op->rAMask != 0) {
+    ins->rA = instr[1] >> 4;
+    ins->rB = instr[1] & 0x0F;
+  }
+  switch (icode) {
+    case 0x2:
+      ins->op = ifun == 0 ? OP_RRMOVQ : OP_CMOVQ;
+      break;
+    case 0x3:
+    case 0x4:
+    case 0x5:
+      ins->value = readLittleEndian(instr + 2, 8);
+      break;
+    case 0x6:
+      ins->op = (uint8_t)(OP_ADDQ + ifun);
+      break;
+    case 0x7:
+      ins->op = ifun == 0 ? OP_JMP : OP_JXX;
+      ins->value = readLittleEndian(instr + 1, 8);
+      break;
+    case 0x8:
+      ins->value = readLittleEndian(instr + 1, 8);
+      break;
+  }
+}
+
+/* Load image at address 0 of a fresh machine with every register and pc
+ * zero and the condition codes Z=1 S=0 O=0
+ * Returns 0 on success and -1 if memory ran out
+ */
+int openMachine(struct Machine *m, const uint8_t *image, size_t length) {
+  memset(m, 0, sizeof(*m));
+  m->zf = 1;
+  m->pageSlots = 1024;
+  m->pages = calloc(m->pageSlots, sizeof(*m->pages));
+  if (m->pages == NULL) {
+    return -1;
+  }
+  for (size_t at = 0; at < length; at += SIM_PAGE) {
+    struct SimPage *page = makePage(m, at / SIM_PAGE);
+    if (page == NULL) {
+      closeMachine(m);
+      return -1;
+    }
+    memcpy(page->bytes, image + at, length - at < SIM_PAGE ? length - at : SIM_PAGE);
+  }
+  return 0;
+}
+
+/* Threaded dispatch: with GNU C every handler jumps straight to the next
+ * one through a table of label addresses, so each has its own indirect
+ * branch to predict. Other compilers get the same handlers in a switch.
+ */
+#if defined(__GNUC__)
+#define SIM_THREADED 1
+#define SIM_OP(op) case op: op##_label:
+#define SIM_DISPATCH() __extension__ ({ goto *handlers[ins->op]; })
+#else
+#define SIM_THREADED 0
+#define SIM_OP(op) case op:
+#define SIM_DISPATCH() goto dispatch
+#endif
+
+/* Fetch the instruction at pc (pc is the entry of a predecoded page) and
+ * run its handler
+ */
+#define SIM_NEXT() do { \
+    if (steps == maxSteps) { \
+      goto stop; \
+    } \
+    if (pc / SIM_PAGE != codeNumber || codePage == NULL) { \
+      codePage = codePageOf(m, pc); \
+      if (codePage == NULL) { \
+        status = SIM_ADR; \
+        goto stop; \
+      } \
+      codeNumber = pc / SIM_PAGE; \
+    } \
+    steps++; \
+    ins = &codePage->code[pc % SIM_PAGE]; \
+    SIM_DISPATCH(); \
+  } while (0)
+
+#define SIM_FAULT(why) do { \
+    status = (why); \
+    goto stop; \
+  } while (0)
+
+/* The page holding pc with its predecoded instruction array
+ * Returns NULL if memory ran out
+ */
+static struct SimPage *codePageOf(struct Machine *m, uint64_t pc) {
+  struct SimPage *page = makePage(m, pc / SIM_PAGE);
+  if (page != NULL && page->code == NULL) {
+    page->code = calloc(SIM_PAGE, sizeof(*page->code));
+    if (page->code == NULL) {
+      return NULL;
+    }
+  }
+  return page;
+}
+
+/* Run from the current pc until halt, a fault, or maxSteps instructions
+ * Returns the SimStatus, also left in m->status
+ */
+int runMachine(struct Machine *m, unsigned long maxSteps) {
+#if SIM_THREADED
+  static const void *const handlers[] = {
+    __extension__ &&OP_DECODE_label, __extension__ &&OP_HALT_label, __extension__ &&OP_NOP_label,
+    __extension__ &&OP_RRMOVQ_label, __extension__ &&OP_CMOVQ_label, __extension__ &&OP_IRMOVQ_label,
+    __extension__ &&OP_RMMOVQ_label, __extension__ &&OP_MRMOVQ_label, __extension__ &&OP_ADDQ_label,
+    __extension__ &&OP_SUBQ_label, __extension__ &&OP_ANDQ_label, __extension__ &&OP_XORQ_label,
+    __extension__ &&OP_MULQ_label, __extension__ &&OP_DIVQ_label, __extension__ &&OP_MODQ_label,
+    __extension__ &&OP_JMP_label, __extension__ &&OP_JXX_label, __extension__ &&OP_CALL_label,
+    __extension__ &&OP_RET_label, __extension__ &&OP_PUSHQ_label, __extension__ &&OP_POPQ_label,
+    __extension__ &&OP_INVALID_label
+  };
+#endif
+  uint64_t r[16]; //r[0xF] stands in for "no register"
+  uint64_t pc = m->pc;
+  uint64_t a, b, t;
+  unsigned cc = (m->zf ? CC_Z : 0) | (m->sf ? CC_S : 0) | (m->of ? CC_O : 0);
+  unsigned long steps = 0;
+  int status = SIM_AOK;
+  struct SimPage *codePage = NULL;
+  uint64_t codeNumber = 0;
+  struct SimInstr *ins;
+  double start = statsClock();
+
+  memcpy(r, m->regs, sizeof(m->regs));
+  r[0xF] = 0;
+
+  SIM_NEXT();
+#if !SIM_THREADED
+dispatch:
+#endif
+  switch (ins->op) {
+    SIM_OP(OP_DECODE)
+      decodeInstr(m, pc, ins);
+      SIM_DISPATCH();
+    SIM_OP(OP_HALT)
+      SIM_FAULT(SIM_HLT);
+    SIM_OP(OP_NOP)
+      pc += 1;
+      SIM_NEXT();
+    SIM_OP(OP_RRMOVQ)
+      r[ins->rB] = r[ins->rA];
+      pc += 2;
+      SIM_NEXT();
+    SIM_OP(OP_CMOVQ)
+      if (TAKEN(ins->fn, cc)) {
+        r[ins->rB] = r[ins->rA];
+      }
+      pc += 2;
+      SIM_NEXT();
+    SIM_OP(OP_IRMOVQ)
+      r[ins->rB] = ins->value;
+      pc += 10;
+      SIM_NEXT();
+    SIM_OP(OP_RMMOVQ)
+      a = r[ins->rB] + ins->value;
+      pc += 10; //Before the write, which may overwrite ins
+      if (writeQuad(m, a, r[ins->rA]) != 0) {
+        pc -= 10;
+        SIM_FAULT(SIM_ADR);
+      }
+      SIM_NEXT();
+    SIM_OP(OP_MRMOVQ)
+      if (readQuad(m, r[ins->rB] + ins->value, &t) != 0) {
+        SIM_FAULT(SIM_ADR);
+      }
+      r[ins->rA] = t;
+      pc += 10;
+      SIM_NEXT();
+    SIM_OP(OP_ADDQ)
+      a = r[ins->rA];
+      b = r[ins->rB];
+      t = b + a;
+      cc = (t == 0 ? CC_Z : 0) | (t >> 63 ? CC_S : 0) | ((~(a ^ b) & (a ^ t)) >> 63 ? CC_O : 0);
+      r[ins->rB] = t;
+      pc += 2;
+      SIM_NEXT();
+    SIM_OP(OP_SUBQ)
+      a = r[ins->rA];
+      b = r[ins->rB];
+      t = b - a;
+      cc = (t == 0 ? CC_Z : 0) | (t >> 63 ? CC_S : 0) | (((a ^ b) & (b ^ t)) >> 63 ? CC_O : 0);
+      r[ins->rB] = t;
+      pc += 2;
+      SIM_NEXT();
+    SIM_OP(OP_ANDQ)
+      t = r[ins->rB] & r[ins->rA];
+      cc = (t == 0 ? CC_Z : 0) | (t >> 63 ? CC_S : 0);
+      r[ins->rB] = t;
+      pc += 2;
+      SIM_NEXT();
+    SIM_OP(OP_XORQ)
+      t = r[ins->rB] ^ r[ins->rA];
+      cc = (t == 0 ? CC_Z : 0) | (t >> 63 ? CC_S : 0);
+      r[ins->rB] = t;
+      pc += 2;
+      SIM_NEXT();
+    SIM_OP(OP_MULQ)
+      t = r[ins->rB] * r[ins->rA];
+      cc = (t == 0 ? CC_Z : 0) | (t >> 63 ? CC_S : 0) | (mulOverflows(r[ins->rA], r[ins->rB]) ? CC_O : 0);
+      r[ins->rB] = t;
+      pc += 2;
+      SIM_NEXT();
+    SIM_OP(OP_DIVQ)
+    SIM_OP(OP_MODQ)
+      a = r[ins->rA];
+      b = r[ins->rB];
+      if (a == 0 || (a == UINT64_MAX && b == (uint64_t)1 << 63)) { //No result fits
+        SIM_FAULT(SIM_INS);
+      }
+      t = (uint64_t)(ins->op == OP_DIVQ ? (int64_t)b / (int64_t)a : (int64_t)b % (int64_t)a);
+      cc = (t == 0 ? CC_Z : 0) | (t >> 63 ? CC_S : 0);
+      r[ins->rB] = t;
+      pc += 2;
+      SIM_NEXT();
+    SIM_OP(OP_JMP)
+      pc = ins->value;
+      SIM_NEXT();
+    SIM_OP(OP_JXX)
+      pc = TAKEN(ins->fn, cc) ? ins->value : pc + 9;
+      SIM_NEXT();
+    SIM_OP(OP_CALL)
+      a = r[4] - 8;
+      t = ins->value;
+      if (writeQuad(m, a, pc + 9) != 0) {
+        SIM_FAULT(SIM_ADR);
+      }
+      r[4] = a;
+      pc = t;
+      SIM_NEXT();
+    SIM_OP(OP_RET)
+      if (readQuad(m, r[4], &t) != 0) {
+        SIM_FAULT(SIM_ADR);
+      }
+      r[4] += 8;
+      pc = t;
+      SIM_NEXT();
+    SIM_OP(OP_PUSHQ)
+      a = r[4] - 8;
+      pc += 2;
+      if (writeQuad(m, a, r[ins->rA]) != 0) {
+        pc -= 2;
+        SIM_FAULT(SIM_ADR);
+      }
+      r[4] = a;
+      SIM_NEXT();
+    SIM_OP(OP_POPQ)
+      if (readQuad(m, r[4], &t) != 0) {
+        SIM_FAULT(SIM_ADR);
+      }
+      r[4] += 8;
+      r[ins->rA] = t;
+      pc += 2;
+      SIM_NEXT();
+    SIM_OP(OP_INVALID)
+      SIM_FAULT(SIM_INS);
+  }
+
+stop:
+  memcpy(m->regs, r, sizeof(m->regs));
+  m->pc = pc;
+  m->zf = (cc & CC_Z) != 0;
+  m->sf = (cc & CC_S) != 0;
+  m->of = (cc & CC_O) != 0;
+  m->status = status;
+  m->steps += steps;
+  m->seconds += statsClock() - start;
+  return status;
+}
+
+static int comparePages(const void *a, const void *b) {
+  uint64_t x = (*(struct SimPage *const *)a)->number;
+  uint64_t y = (*(struct SimPage *const *)b)->number;
+  return x < y ? -1 : x > y;
+}
+
+/* Print where and why the machine stopped, the registers and quads of
+ * memory that differ from the start (image loaded at 0, everything else
+ * zero), and the instruction rate
+ */
+void printMachine(FILE *out, const struct Machine *m, const uint8_t *image, size_t length) {
+  static const char *const statusNames[4] = {"AOK", "HLT", "ADR", "INS"};
+  struct SimPage **sorted = malloc((m->pageCount + 1) * sizeof(*sorted));
+  size_t count = 0;
+
+  fprintf(out, "Stopped in %lu steps at PC = 0x%" PRIx64 ".  Status '%s', CC Z=%d S=%d O=%d\n",
+          m->steps, m->pc, statusNames[m->status], m->zf, m->sf, m->of);
+  fprintf(out, "Changes to registers:\n");
+  for (unsigned char reg = 0; reg < 15; reg++) {
+    if (m->regs[reg] != 0) {
+      fprintf(out, "%s:\t0x%016" PRIx64 "\t0x%016" PRIx64 "\n", getRegString(reg), (uint64_t)0, m->regs[reg]);
+    }
+  }
+
+  fprintf(out, "\nChanges to memory:\n");
+  if (sorted != NULL) {
+    for (size_t i = 0; i < m->pageSlots; i++) {
+      if (m->pages[i] != NULL) {
+        sorted[count++] = m->pages[i];
+      }
+    }
+    qsort(sorted, count, sizeof(*sorted), comparePages);
+    for (size_t i = 0; i < count; i++) {
+      uint64_t base = sorted[i]->number * SIM_PAGE;
+      for (size_t offset = 0; offset < SIM_PAGE; offset += 8) {
+        uint64_t before = 0, after;
+        for (size_t k = 0; k < 8; k++) {
+          if (base + offset + k < length) {
+            before |= (uint64_t)image[base + offset + k] << (8 * k);
+          }
+        }
+        memcpy(&after, sorted[i]->bytes + offset, 8);
+        if (before != after) {
+          fprintf(out, "0x%04" PRIx64 ":\t0x%016" PRIx64 "\t0x%016" PRIx64 "\n", base + offset, before, after);
+        }
+      }
+    }
+    free(sorted);
+  }
+
+  fprintf(out, "\n%lu instructions in %.3f s", m->steps, m->seconds);
+  if (m->seconds > 0) {
+    fprintf(out, " (%.1f million instructions/s)", (double)m->steps / m->seconds / 1e6);
+  }
+  fprintf(out, "\n");
+}
+
+void closeMachine(struct Machine *m) {
+  for (size_t i = 0; i < m->pageSlots; i++) {
+    if (m->pages[i] != NULL) {
+      free(m->pages[i]->code);
+      free(m->pages[i]);
+    }
+  }
+  free(m->pages);
+  memset(m, 0, sizeof(*m));
+}
@@ -0,0 +1,53 @@
+/* This file contains the prototypes and constants needed to use the
+   routines defined in machineSim.c, the Y86 instruction set simulator.
+*/
+
+#ifndef _MACHINESIM_H_
+#define _MACHINESIM_H_
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SIM_PAGE 4096 //Bytes per memory page
+
+//Why the machine stopped
+enum SimStatus {
+  SIM_AOK, //Still running, the step limit was reached
+  SIM_HLT, //Executed halt
+  SIM_ADR, //Bad memory address (or no memory left for a page)
+  SIM_INS  //Invalid instruction
+};
+
+struct SimInstr;
+
+/* A page of memory and, once code has run from it, its predecoded instructions
+ */
+struct SimPage {
+  uint64_t number;        //Address / SIM_PAGE
+  struct SimInstr *code;  //One entry per byte address, NULL until the page runs code
+  uint8_t bytes[SIM_PAGE];
+};
+
+/* Machine state; memory is sparse, pages are created on first write
+ * (reads of untouched memory give zeros)
+ */
+struct Machine {
+  uint64_t regs[15];
+  uint64_t pc;
+  int zf, sf, of;
+  int status;             //A SimStatus
+  unsigned long steps;    //Instructions executed
+  double seconds;         //Time spent in runMachine
+  struct SimPage **pages; //Open addressed by page number, NULL if free
+  size_t pageSlots;       //A power of 2, at least twice pageCount
+  size_t pageCount;
+  struct SimPage *dataPage; //Last page read or written
+};
+
+int openMachine(struct Machine *m, const uint8_t *image, size_t length);
+int runMachine(struct Machine *m, unsigned long maxSteps);
+void printMachine(FILE *out, const struct Machine *m, const uint8_t *image, size_t length);
+void closeMachine(struct Machine *m);
+
+#endif /* MACHINESIM */
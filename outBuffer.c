@@ -0,0 +1,137 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include "outBuffer.h"
+
+/* Set up an output buffer of capacity bytes writing to fd
+ * Returns 0 on success and -1 if the buffer could not be allocated
+ */
+int openOutBuffer(struct OutBuffer *ob, int fd, size_t capacity) {
+  memset(ob, 0, sizeof(*ob));
+  if (capacity < OUT_LINE_MAX) {
+    capacity = OUT_LINE_MAX;
+  }
+  ob->data = malloc(capacity);
+  if (ob->data == NULL) {
+    return -1;
+  }
+  ob->fd = fd;
+  ob->capacity = capacity;
+  return 0;
+}
+
+static double writeClock(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* Make room for at least n more bytes in a buffer without a descriptor
+ * Returns 0 on success and -1 if memory ran out (the buffered text is dropped)
+ */
+static int growOutBuffer(struct OutBuffer *ob, size_t n) {
+  size_t capacity = ob->capacity;
+  while (capacity - ob->length < n) {
+    capacity *= 2;
+  }
+  if (capacity != ob->capacity) {
+    char *grown = realloc(ob->data, capacity);
+    if (grown == NULL) {
+      ob->error = ENOMEM;
+      ob->length = 0;
+      return -1;
+    }
+    ob->data = grown;
+    ob->capacity = capacity;
+  }
+  return ob->error ? -1 : 0;
+}
+
+/* Hand everything buffered to write(), retrying short and interrupted writes
+ * Buffers without a descriptor grow instead so they can hold a whole listing.
+ * Returns 0 on success and -1 once a write has failed
+ */
+int flushOutBuffer(struct OutBuffer *ob) {
+  if (ob->fd < 0) {
+    return growOutBuffer(ob, OUT_LINE_MAX);
+  }
+
+  size_t done = 0;
+  double start = ob->length ? writeClock() : 0;
+  while (done < ob->length && ob->error == 0) {
+    ssize_t wrote = write(ob->fd, ob->data + done, ob->length - done);
+    if (wrote < 0) {
+      if (errno != EINTR) {
+        ob->error = errno;
+      }
+    }
+    else {
+      done += (size_t)wrote;
+    }
+  }
+  if (done != 0) {
+    ob->writeSeconds += writeClock() - start;
+  }
+  ob->length = 0;
+  return ob->error ? -1 : 0;
+}
+
+/* Append n bytes of already rendered text
+ * Large blocks skip the buffer and go straight to write()
+ * Returns 0 on success and -1 once a write has failed
+ */
+int writeOut(struct OutBuffer *ob, const char *text, size_t n) {
+  if (ob->fd < 0) {
+    if (growOutBuffer(ob, n) != 0) {
+      return -1;
+    }
+  }
+  else if (ob->capacity - ob->length < n) {
+    if (flushOutBuffer(ob) != 0) {
+      return -1;
+    }
+    if (n >= ob->capacity) {
+      struct OutBuffer direct = *ob; //Write the block in place of the buffer contents
+      direct.data = (char *)text;
+      direct.length = n;
+      flushOutBuffer(&direct);
+      ob->error = direct.error;
+      ob->writeSeconds = direct.writeSeconds;
+      return ob->error ? -1 : 0;
+    }
+  }
+  memcpy(ob->data + ob->length, text, n);
+  ob->length += n;
+  return 0;
+}
+
+/* Point the buffer at another descriptor, dropping any unwritten text and
+ * error, so one buffer can serve a series of files
+ */
+void resetOutBuffer(struct OutBuffer *ob, int fd) {
+  ob->fd = fd;
+  ob->length = 0;
+  ob->error = 0;
+}
+
+/* Flush what is left and release the buffer (the descriptor stays open)
+ * Text collected in memory is simply discarded
+ * Returns 0 if every write succeeded and -1 otherwise, with errno set
+ */
+int closeOutBuffer(struct OutBuffer *ob) {
+  if (ob->fd >= 0) {
+    flushOutBuffer(ob);
+  }
+  free(ob->data);
+  ob->data = NULL;
+  ob->capacity = 0;
+  if (ob->error != 0) {
+    errno = ob->error;
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,155 @@
+/* This file contains the prototypes and constants needed to use the
+   routines defined in outBuffer.c
+*/
+
+#ifndef _OUTBUFFER_H_
+#define _OUTBUFFER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define OUT_BUFFER_SIZE (1 << 20) //Bytes collected before each write
+#define OUT_LINE_MAX 128          //Upper bound on one rendered listing line
+
+/* Output accumulated in one large buffer and handed to write() in big
+ * blocks. Text is rendered straight into the buffer by the put* helpers,
+ * so no format string is ever parsed. Every decoding thread owns its own
+ * OutBuffer and the helpers write nowhere else, so threads never share
+ * formatting state.
+ */
+struct OutBuffer {
+  int fd;          //Destination, -1 to only collect in memory
+  char *data;      //Start of the buffer
+  size_t length;   //Bytes waiting to be written
+  size_t capacity; //Size of data
+  int error;       //errno of the first failed write, 0 if none
+  double writeSeconds; //Time spent in write() so far
+};
+
+int openOutBuffer(struct OutBuffer *ob, int fd, size_t capacity);
+int flushOutBuffer(struct OutBuffer *ob);
+int closeOutBuffer(struct OutBuffer *ob);
+void resetOutBuffer(struct OutBuffer *ob, int fd);
+int writeOut(struct OutBuffer *ob, const char *text, size_t n);
+
+/* Return a write position with room for at least n bytes, flushing first
+ * if needed. Finish with commitOut once the bytes are in place.
+ */
+static inline char *reserveOut(struct OutBuffer *ob, size_t n) {
+  if (ob->capacity - ob->length < n) {
+    flushOutBuffer(ob);
+  }
+  return ob->data + ob->length;
+}
+
+static inline void commitOut(struct OutBuffer *ob, char *end) {
+  ob->length = (size_t)(end - ob->data);
+}
+
+/* Copy the string s and pad it with spaces to at least width characters
+ */
+static inline char *putPadded(char *p, const char *s, int width) {
+  char *start = p;
+  while (*s != '\0') {
+    *p++ = *s++;
+  }
+  while (p - start < width) {
+    *p++ = ' ';
+  }
+  return p;
+}
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#define OUT_HEX_SSE2 1
+#include <emmintrin.h>
+
+/* Turn the low 8 bytes of bytes into 16 hex digits, byte 0 first and its
+ * high nibble before its low one; alpha is 'a' or 'A'
+ */
+static inline void storeHex16(char *p, __m128i bytes, char alpha) {
+  __m128i mask = _mm_set1_epi8(0x0F);
+  __m128i nibbles = _mm_unpacklo_epi8(_mm_and_si128(_mm_srli_epi16(bytes, 4), mask),
+                                      _mm_and_si128(bytes, mask));
+  __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)),
+                                  _mm_set1_epi8((char)(alpha - '0' - 10)));
+  _mm_storeu_si128((__m128i *)p, _mm_add_epi8(nibbles, _mm_add_epi8(letters, _mm_set1_epi8('0'))));
+}
+#endif
+
+/* Number of hex digits value needs without leading zeros, at least 1
+ */
+static inline int hexDigitCount(uint64_t value) {
+#if defined(__GNUC__)
+  return value == 0 ? 1 : 16 - __builtin_clzll(value) / 4;
+#else
+  int digits = 1;
+  while (digits < 16 && (value >> (4 * digits)) != 0) {
+    digits++;
+  }
+  return digits;
+#endif
+}
+
+/* Write value as exactly digits lower case hex digits
+ * The SSE2 version always stores 16 characters, so there must be room for
+ * 16 at p even when digits is smaller; the ones past p + digits are junk.
+ */
+static inline char *putHexFixed(char *p, uint64_t value, int digits) {
+#ifdef OUT_HEX_SSE2
+  uint64_t swapped = __builtin_bswap64(value << (4 * (16 - digits))); //Most significant digit in byte 0
+  storeHex16(p, _mm_loadl_epi64((const __m128i *)&swapped), 'a');
+#else
+  static const char hex[17] = "0123456789abcdef";
+  for (int i = digits - 1; i >= 0; i--) {
+    p[i] = hex[value & 0xF];
+    value >>= 4;
+  }
+#endif
+  return p + digits;
+}
+
+/* Write value as 0x followed by lower case hex without leading zeros ("0x0" for zero)
+ * Needs room for 18 characters at p, see putHexFixed
+ */
+static inline char *putHexValue(char *p, uint64_t value) {
+  *p++ = '0';
+  *p++ = 'x';
+  return putHexFixed(p, value, hexDigitCount(value));
+}
+
+/* Write value in decimal without leading zeros
+ * Needs room for 20 characters at p
+ */
+static inline char *putDecimal(char *p, uint64_t value) {
+  char digits[20];
+  int n = 0;
+  do {
+    digits[n++] = (char)('0' + value % 10);
+    value /= 10;
+  } while (value != 0);
+  while (n > 0) {
+    *p++ = digits[--n];
+  }
+  return p;
+}
+
+/* Write n bytes in memory order as upper case hex, two digits per byte
+ */
+static inline char *putHexBytes(char *p, const uint8_t *bytes, int n) {
+  static const char hex[17] = "0123456789ABCDEF";
+  int i = 0;
+#ifdef OUT_HEX_SSE2
+  if (n >= 8) {
+    storeHex16(p, _mm_loadl_epi64((const __m128i *)bytes), 'A');
+    p += 16;
+    i = 8;
+  }
+#endif
+  for (; i < n; i++) {
+    *p++ = hex[bytes[i] >> 4];
+    *p++ = hex[bytes[i] & 0xF];
+  }
+  return p;
+}
+
+#endif /* OUTBUFFER */
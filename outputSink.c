@@ -0,0 +1,208 @@
+#include <string.h>
+#include <errno.h>
+#include "outputSink.h"
+#include "printRoutines.h"
+
+#define SINK_BATCH 4096 //Records decoded per y86DecodeBatch call
+
+static const char *const sinkNames[] = {"text", "compact", "jsonl", "null"};
+
+/* Copy the string s without its terminator
+ */
+static char *putText(char *p, const char *s) {
+  while (*s != '\0') {
+    *p++ = *s++;
+  }
+  return p;
+}
+
+/* The text sink: the listing line of every item, as decodeMachineCode writes it
+ */
+static int textInstruction(struct OutputSink *sink, const struct Y86Record *record, const uint8_t *bytes) {
+  struct OutBuffer *out = sink->out;
+  commitOut(out, putInstruction(reserveOut(out, SINK_LINE_MAX), &opTable[bytes[0]], bytes, record->address));
+  return 0;
+}
+
+static int textData(struct OutputSink *sink, const struct Y86Record *record, const uint8_t *bytes) {
+  struct OutBuffer *out = sink->out;
+  commitOut(out, putDataLine(reserveOut(out, SINK_LINE_MAX), bytes, record->length, record->address));
+  return 0;
+}
+
+/* Returns -1 if any write of the sink failed
+ */
+static int outEnd(struct OutputSink *sink) {
+  if (sink->out->error != 0) {
+    errno = sink->out->error;
+    return -1;
+  }
+  return 0;
+}
+
+/* The compact sink: "addr: mnemonic operands" with the address in hex
+ * without leading zeros and no encoding column
+ */
+static int compactInstruction(struct OutputSink *sink, const struct Y86Record *record, const uint8_t *bytes) {
+  const struct OpDescriptor *op = &opTable[bytes[0]];
+  char *p = reserveOut(sink->out, SINK_LINE_MAX);
+
+  p = putHexFixed(p, record->address, hexDigitCount(record->address));
+  *p++ = ':';
+  *p++ = ' ';
+  p = putText(p, op->mnemonic);
+  if (op->shape != SHAPE_NONE) {
+    *p++ = ' ';
+    p = putOperands(p, op, bytes);
+  }
+  *p++ = '\n';
+  commitOut(sink->out, p);
+  return 0;
+}
+
+static int compactData(struct OutputSink *sink, const struct Y86Record *record, const uint8_t *bytes) {
+  char *p = reserveOut(sink->out, SINK_LINE_MAX);
+
+  p = putHexFixed(p, record->address, hexDigitCount(record->address));
+  p = putText(p, record->kind == Y86_KIND_QUAD ? ": .quad " : ": .byte ");
+  p = putHexValue(p, record->immediate);
+  *p++ = '\n';
+  commitOut(sink->out, p);
+  return 0;
+}
+
+/* Start a JSON Lines object with the fields every item has
+ */
+static char *putJsonItem(char *p, const struct Y86Record *record, const uint8_t *bytes, const char *kind, const char *mnemonic) {
+  p = putText(p, "{\"address\":\"");
+  p = putHexValue(p, record->address);
+  p = putText(p, "\",\"length\":");
+  p = putDecimal(p, record->length);
+  p = putText(p, ",\"bytes\":\"");
+  p = putHexBytes(p, bytes, record->length);
+  p = putText(p, "\",\"kind\":\"");
+  p = putText(p, kind);
+  p = putText(p, "\",\"mnemonic\":\"");
+  p = putText(p, mnemonic);
+  *p++ = '"';
+  return p;
+}
+
+/* The JSON Lines sink: one object per item, registers and values only when
+ * the instruction has them, e.g.
+ * {"address":"0x0","length":10,"bytes":"30F40001000000000000","kind":"code","mnemonic":"irmovq","rB":"%rsp","value":"0x100"}
+ */
+static int jsonInstruction(struct OutputSink *sink, const struct Y86Record *record, const uint8_t *bytes) {
+  const struct OpDescriptor *op = &opTable[bytes[0]];
+  char *p = reserveOut(sink->out, SINK_LINE_MAX);
+
+  p = putJsonItem(p, record, bytes, "code", op->mnemonic);
+  if (record->rA != Y86_NO_REG) {
+    p = putText(p, ",\"rA\":\"");
+    p = putText(p, getRegString(record->rA));
+    *p++ = '"';
+  }
+  if (record->rB != Y86_NO_REG) {
+    p = putText(p, ",\"rB\":\"");
+    p = putText(p, getRegString(record->rB));
+    *p++ = '"';
+  }
+  if (op->length >= 9) { //Every instruction this long carries V, D or Dest
+    p = putText(p, ",\"value\":\"");
+    p = putHexValue(p, record->immediate);
+    *p++ = '"';
+  }
+  p = putText(p, "}\n");
+  commitOut(sink->out, p);
+  return 0;
+}
+
+static int jsonData(struct OutputSink *sink, const struct Y86Record *record, const uint8_t *bytes) {
+  int quad = (record->kind == Y86_KIND_QUAD);
+  char *p = reserveOut(sink->out, SINK_LINE_MAX);
+
+  p = putJsonItem(p, record, bytes, quad ? "quad" : "byte", quad ? ".quad" : ".byte");
+  p = putText(p, ",\"value\":\"");
+  p = putHexValue(p, record->immediate);
+  p = putText(p, "\"}\n");
+  commitOut(sink->out, p);
+  return 0;
+}
+
+/* The null sink: drops everything
+ */
+static int nullItem(struct OutputSink *sink, const struct Y86Record *record, const uint8_t *bytes) {
+  (void)sink;
+  (void)record;
+  (void)bytes;
+  return 0;
+}
+
+static int nullEnd(struct OutputSink *sink) {
+  (void)sink;
+  return 0;
+}
+
+//Indexed by SinkFormat
+static const struct SinkOps builtInSinks[] = {
+  {textInstruction, textData, outEnd},
+  {compactInstruction, compactData, outEnd},
+  {jsonInstruction, jsonData, outEnd},
+  {nullItem, nullItem, nullEnd}
+};
+
+/* Look up a built-in sink by its name ("text", "compact", "jsonl" or "null")
+ * Returns its SinkFormat, -1 if there is none by that name
+ */
+int findSinkFormat(const char *name) {
+  for (int i = 0; i < (int)(sizeof(sinkNames) / sizeof(sinkNames[0])); i++) {
+    if (strcmp(name, sinkNames[i]) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/* Set sink up as the built-in sink format writing to out
+ */
+void openSink(struct OutputSink *sink, int format, struct OutBuffer *out) {
+  sink->ops = &builtInSinks[format];
+  sink->out = out;
+  sink->state = NULL;
+}
+
+/* Decode code[0..length), whose first byte lives at baseAddr, and hand every
+ * item the listing shows to sink in address order, then call its onEnd
+ * Decoding is separate from rendering: records come from y86DecodeBatch a
+ * batch at a time and only the sink decides what, if anything, gets written.
+ * Returns 0 on success and -1 as soon as a callback fails
+ */
+int decodeToSink(struct OutputSink *sink, const uint8_t *code, size_t length, uint64_t baseAddr) {
+  struct Y86Record records[SINK_BATCH];
+  const struct SinkOps *ops = sink->ops;
+  struct Y86Cursor cursor;
+  size_t n;
+
+  y86InitCursor(&cursor);
+  while ((n = y86DecodeBatch(code, length, baseAddr, &cursor, records, SINK_BATCH)) > 0) {
+    for (size_t i = 0; i < n; i++) {
+      const struct Y86Record *record = &records[i];
+      const uint8_t *bytes = code + (record->address - baseAddr);
+      int result;
+
+      if (record->flags & Y86_FLAG_SILENT) {
+        continue;
+      }
+      if (record->kind == Y86_KIND_CODE) {
+        result = ops->onInstruction(sink, record, bytes);
+      }
+      else {
+        result = ops->onData(sink, record, bytes);
+      }
+      if (result != 0) {
+        return -1;
+      }
+    }
+  }
+  return ops->onEnd(sink);
+}
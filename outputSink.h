@@ -0,0 +1,46 @@
+/* This file contains the prototypes and constants needed to use the
+   routines defined in outputSink.c
+*/
+
+#ifndef _OUTPUTSINK_H_
+#define _OUTPUTSINK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "outBuffer.h"
+#include "disasm.h"
+
+//The built-in sinks
+enum SinkFormat {
+  SINK_TEXT,    //The listing
+  SINK_COMPACT, //Address, mnemonic and operands only, objdump style
+  SINK_JSONL,   //One JSON object per item
+  SINK_NULL     //Nothing, to time decoding alone
+};
+
+struct OutputSink;
+
+/* What a sink does with the items of a decode
+ * record is the decoded item and bytes its record->length bytes in the
+ * image. Silent halts are never handed over. Each callback returns 0, or -1
+ * with errno set to stop the decode.
+ */
+struct SinkOps {
+  int (*onInstruction)(struct OutputSink *sink, const struct Y86Record *record, const uint8_t *bytes);
+  int (*onData)(struct OutputSink *sink, const struct Y86Record *record, const uint8_t *bytes);
+  int (*onEnd)(struct OutputSink *sink);
+};
+
+struct OutputSink {
+  const struct SinkOps *ops;
+  struct OutBuffer *out; //Where the rendering goes (unused by the null sink)
+  void *state;           //Private to the ops of sinks defined elsewhere
+};
+
+#define SINK_LINE_MAX 256 //Upper bound on one rendered item of any built-in sink
+
+int findSinkFormat(const char *name);
+void openSink(struct OutputSink *sink, int format, struct OutBuffer *out);
+int decodeToSink(struct OutputSink *sink, const uint8_t *code, size_t length, uint64_t baseAddr);
+
+#endif /* OUTPUTSINK */
@@ -0,0 +1,145 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <pthread.h>
+#include "parallelDecode.h"
+#include "printRoutines.h"
+
+/* A place where a worker's instruction stream could join the true one
+ */
+struct SyncPoint {
+  struct DecodeState state; //Instruction boundary and halt state the worker saw there
+  size_t outLength;         //How much of the worker's output comes before it
+};
+
+/* One chunk [start, stop) of the image, decoded by a worker on a guessed
+ * entry state. The worker output is only used from a SyncPoint that the
+ * true instruction stream actually reaches.
+ */
+struct ChunkJob {
+  const uint8_t *code;
+  size_t length;
+  unsigned long baseAddr;
+  size_t start;
+  size_t stop;
+  struct OutBuffer out;
+  struct SyncPoint sync[SYNC_POINTS];
+  int syncCount;
+  struct DecodeState end; //State after the last instruction starting before stop
+  int onThread;           //1 if a thread was started for the job and has to be joined
+};
+
+/* Worker body: decode a chunk as if an instruction (after a halt) started at
+ * its first byte, remembering the first SYNC_POINTS boundaries on the way
+ */
+static void *decodeChunk(void *arg) {
+  struct ChunkJob *job = arg;
+  struct DecodeState state = {job->start, 1};
+
+  job->out.length = 0;
+  job->out.error = 0;
+  for (job->syncCount = 0; job->syncCount < SYNC_POINTS && state.pos < job->stop; job->syncCount++) {
+    job->sync[job->syncCount].state = state;
+    job->sync[job->syncCount].outLength = job->out.length;
+    decodeRange(&job->out, job->code, job->length, job->baseAddr, &state, state.pos + 1); //One instruction
+  }
+  decodeRange(&job->out, job->code, job->length, job->baseAddr, &state, job->stop);
+  job->end = state;
+  if (job->out.error != 0) {
+    job->syncCount = 0; //Output is incomplete, make the merge decode the chunk itself
+  }
+  return NULL;
+}
+
+/* Append the listing of a chunk to out given the true state on entry
+ * The true stream is stepped one instruction at a time until it lands on a
+ * boundary the worker saw in the same halt state; from there the outputs are
+ * identical so the worker's text is copied. If that never happens within the
+ * remembered boundaries the rest of the chunk is decoded here.
+ */
+static void mergeChunk(struct OutBuffer *out, struct ChunkJob *job, struct DecodeState *state) {
+  int i = 0;
+
+  while (state->pos < job->stop) {
+    while (i < job->syncCount && job->sync[i].state.pos < state->pos) {
+      i++;
+    }
+    if (i == job->syncCount) {
+      decodeRange(out, job->code, job->length, job->baseAddr, state, job->stop);
+      return;
+    }
+    if (job->sync[i].state.pos == state->pos && job->sync[i].state.skipHalt == state->skipHalt) {
+      size_t from = job->sync[i].outLength;
+      writeOut(out, job->out.data + from, job->out.length - from);
+      *state = job->end;
+      return;
+    }
+    decodeRange(out, job->code, job->length, job->baseAddr, state, state->pos + 1); //One instruction
+  }
+}
+
+/* Decode code[0..length) like decodeMachineCode but on up to threads worker threads
+ * The image is cut into CHUNK_SIZE chunks which are decoded a batch of threads
+ * chunks at a time and stitched together in order, so the output is byte for
+ * byte what a serial decode produces.
+ * Returns 0 on success and -1 if the worker buffers could not be allocated
+ */
+int decodeParallel(struct OutBuffer *out, const uint8_t *code, size_t length, unsigned long baseAddr, int threads) {
+  struct DecodeState state = {0, 1};
+  struct ChunkJob *jobs;
+  pthread_t *workers;
+  int created = 0;
+  int result = 0;
+
+  if (threads <= 1 || length <= CHUNK_SIZE) {
+    decodeMachineCode(out, code, length, baseAddr);
+    return 0;
+  }
+
+  jobs = calloc((size_t)threads, sizeof(*jobs));
+  workers = calloc((size_t)threads, sizeof(*workers));
+  if (jobs == NULL || workers == NULL) {
+    result = -1;
+    goto done;
+  }
+  for (created = 0; created < threads; created++) {
+    if (openOutBuffer(&jobs[created].out, -1, 4 * CHUNK_SIZE) != 0) {
+      result = -1;
+      goto done;
+    }
+  }
+
+  for (size_t start = 0; start < length; ) {
+    int batch;
+    for (batch = 0; batch < threads && start < length; batch++, start += CHUNK_SIZE) {
+      struct ChunkJob *job = &jobs[batch];
+      job->code = code;
+      job->length = length;
+      job->baseAddr = baseAddr;
+      job->start = start;
+      job->stop = length - start > CHUNK_SIZE ? start + CHUNK_SIZE : length;
+    }
+    //The first chunk of a batch is decoded here while the workers take the rest
+    for (int i = 1; i < batch; i++) {
+      jobs[i].onThread = (pthread_create(&workers[i], NULL, decodeChunk, &jobs[i]) == 0);
+      if (!jobs[i].onThread) {
+        decodeChunk(&jobs[i]);
+      }
+    }
+    decodeChunk(&jobs[0]);
+    for (int i = 0; i < batch; i++) {
+      if (i > 0 && jobs[i].onThread) {
+        pthread_join(workers[i], NULL);
+      }
+      mergeChunk(out, &jobs[i], &state);
+    }
+  }
+
+done:
+  for (int i = 0; i < created; i++) {
+    closeOutBuffer(&jobs[i].out);
+  }
+  free(jobs);
+  free(workers);
+  return result;
+}
@@ -0,0 +1,17 @@
+/* This file contains the prototypes and constants needed to use the
+   routines defined in parallelDecode.c
+*/
+
+#ifndef _PARALLELDECODE_H_
+#define _PARALLELDECODE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "outBuffer.h"
+
+#define CHUNK_SIZE (1 << 20) //Bytes of image decoded by one worker task
+#define SYNC_POINTS 64       //Instruction boundaries remembered at the start of each chunk
+
+int decodeParallel(struct OutBuffer *out, const uint8_t *code, size_t length, unsigned long baseAddr, int threads);
+
+#endif /* PARALLELDECODE */
@@ -1,441 +1,567 @@
+#define _POSIX_C_SOURCE 200809L
+
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include "printRoutines.h"
+#include "inputMap.h"
+#include "outBuffer.h"
+#include "parallelDecode.h"
+#include "recordWriter.h"
+#include "decodeStats.h"
+#include "flowDecode.h"
+#include "labelIndex.h"
+#include "regionCache.h"
+#include "streamDecode.h"
+#include "imageIr.h"
+#include "flowGraph.h"
+#include "outputSink.h"
+#include "addressIndex.h"
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#endif
+
+/* Returns 1 if options ask for nothing but the linear text listing
+ */
+static int isPlainListing(const struct DecodeOptions *options) {
+  return options->output == OUTPUT_TEXT && options->stats == STATS_OFF && !options->fill && !options->follow &&
+         options->labels == LABELS_OFF && options->cachePath == NULL && !options->ir &&
+         options->graph == GRAPH_OFF && options->format == SINK_TEXT &&
+         options->indexPath == NULL;
+}
 
-/* Perform read on machine code and write Y86 interpretation to corresponding file */
-void readMachineCode(FILE* out, FILE *machineCode, unsigned long startingOffset) {
-  //Set address:
-  unsigned long currAddr; //"program counter"
-  unsigned char buffer[1]; //Currently reads 1 bytes at a time
-
-  //Move currAddr to offset value
-  for (currAddr = 0; currAddr < startingOffset; currAddr++) {
-    fread(buffer, 1, 1, machineCode); //each element to be read is 1 byte, buffer has 1 element, machineCode is the input stream
-  }
-
-  //int counter = 0; //Counter for keeping track of rows for now (remove later)
-  int increment; //How much to increment the curr addr value by after each switch statement
-  int skipHalt = 1; //If 1, skip printing halt statement
-  while (fread(buffer, 1, 1, machineCode) == 1) { //Progresses fread by one byte
-    //This switch statement assumes that there is no "expected" instruction yet
-    char* encodString;
-    char* instrString;
-    switch(buffer[0]) {
-      case 0x00: //HALT
-        if (skipHalt == 0){
-          encodString = "00";
-          instrString = "halt";
-          fprintf(out, "%016lx: %-22s%-8s\n", currAddr, encodString, instrString);
-        }
-        skipHalt = 1;
-        increment = 1;
-        break;
-
-      case 0x10: //NOP
-        encodString = "10";
-        instrString = "nop";
-        fprintf(out, "%016lx: %-22s%-8s\n", currAddr, encodString, instrString);
-        skipHalt = 0;
-        increment = 1;
-        break;
-
-      case 0x20: //RRMOVQ
-        skipHalt = 0;
-        increment = rrmovqCase(out, machineCode, buffer, currAddr);
-        break;
-
-      case 0x21: //Add additional cases to CMOVXX
-      case 0x22:
-      case 0x23:
-      case 0x24:
-      case 0x25:
-      case 0x26:
-        skipHalt = 0;
-        increment = cmovXXCase(out, machineCode, buffer, currAddr);
-        break;
-
-      case 0x30: //IRMOVQ
-        skipHalt = 0;
-        increment = irmovqCase(out, machineCode, buffer, currAddr);
-        break;
+/* Follow control flow through the mapped window from its first byte and
+ * from every entry address in options
+ */
+static int decodeFollowingFrom(struct OutBuffer *out, const struct InputMap *map, const struct DecodeOptions *options) {
+  unsigned long *entries = malloc(((size_t)options->entryCount + 1) * sizeof(*entries));
+  int result;
 
-      case 0x40: //RRMOVQ
-        skipHalt = 0;
-        increment = rmmovqCase(out, machineCode, buffer, currAddr);
-        break;
+  if (entries == NULL) {
+    return -1;
+  }
+  entries[0] = options->startingOffset;
+  for (int i = 0; i < options->entryCount; i++) {
+    entries[i + 1] = options->entries[i];
+  }
+  result = decodeFollowing(out, map->data, map->length, options->startingOffset, entries, options->entryCount + 1, options->fill);
+  free(entries);
+  return result;
+}
 
-      case 0x50: //MRMOVQ
-        skipHalt = 0;
-        increment = mrmovqCase(out, machineCode, buffer, currAddr);
-        break;
+/* Write the listing of the mapped window with labels for branch destinations
+ */
+static int decodeLabelled(struct OutBuffer *out, const struct InputMap *map, const struct DecodeOptions *options) {
+  struct LabelIndex index;
+  int result;
 
-      case 0x60: //Add additional cases to OPQ
-      case 0x61:
-      case 0x62:
-      case 0x63:
-      case 0x64:
-      case 0x65:
-      case 0x66:
-        skipHalt = 0;
-        increment = opqCase(out, machineCode, buffer, currAddr);
-        break;
+  if (buildLabelIndex(map->data, map->length, options->startingOffset, options->labels == LABELS_XREF, &index) != 0) {
+    return -1;
+  }
+  result = writeLabelledListing(out, map->data, map->length, options->startingOffset, &index);
+  freeLabelIndex(&index);
+  return result;
+}
 
-      case 0x70: //Add additional cases to JXX
-      case 0x71:
-      case 0x72:
-      case 0x73:
-      case 0x74:
-      case 0x75:
-      case 0x76:
-        skipHalt = 0;
-        increment = jxxCase(out, machineCode, buffer, currAddr);
-        break;
+/* Write the listing of the mapped window by way of the whole-image IR
+ */
+static int decodeThroughIr(struct OutBuffer *out, const struct InputMap *map, const struct DecodeOptions *options) {
+  struct ImageIr ir;
+  int result;
 
-      case 0x80: //CALL DEST
-        skipHalt = 0;
-        increment = callCase(out, machineCode, buffer, currAddr);
-        break;
+  if (buildImageIr(map->data, map->length, options->startingOffset, &ir) != 0) {
+    return -1;
+  }
+  result = writeIrListing(out, &ir);
+  freeImageIr(&ir);
+  return result;
+}
 
-      case 0x90: //RET
-        instrString = "ret";
-        encodString = "90";
-            fprintf(out, "%016lx: %-22s%-8s\n", currAddr, encodString, instrString);
-        skipHalt = 0;
-        increment = 1;
-        break;
+/* Write the control flow graph of the mapped window instead of its listing
+ */
+static int decodeGraph(struct OutBuffer *out, const struct InputMap *map, const struct DecodeOptions *options) {
+  struct ImageIr ir;
+  struct FlowGraph graph;
+  int result;
 
-      case 0xA0: //PUSHQ
-        skipHalt = 0;
-        increment = pushqCase(out, machineCode, buffer, currAddr);
-        break;
+  if (buildImageIr(map->data, map->length, options->startingOffset, &ir) != 0) {
+    return -1;
+  }
+  if (buildFlowGraph(&ir, &graph) != 0) {
+    freeImageIr(&ir);
+    return -1;
+  }
+  result = writeFlowGraph(out, &graph, &ir, options->graph);
+  freeFlowGraph(&graph);
+  freeImageIr(&ir);
+  return result;
+}
 
-      case 0xB0: //POPQ
-        skipHalt = 0;
-        increment = popqCase(out, machineCode, buffer, currAddr);
-        break;
+/* Write the listing of the mapped window along with an address index of it
+ */
+static int decodeIndexed(struct OutBuffer *out, const struct InputMap *map, const struct DecodeOptions *options) {
+  int fd = open(options->indexPath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  int result, saved;
 
-      default:  //Quad/Byte
-        skipHalt = 0;
-        unsigned char byteData[8] = {0x0,0x0,0x0,0x0,0x0,0x0,0x0,0x0};
-        byteData[0] = buffer[0];
-        increment = quadOrByteCase(out, machineCode, buffer, byteData, 1, currAddr);
-        break;
-    }
-    currAddr+=increment; //Increment determined from the switch statement
+  if (fd < 0) {
+    return -1;
+  }
+  result = writeIndexedListing(out, fd, map->data, map->length, options->startingOffset, options->indexEvery);
+  saved = errno;
+  if (close(fd) != 0 && result == 0) {
+    return -1;
   }
+  errno = saved;
+  return result;
 }
 
-/* This is a function to handle a "rrmovq rA rB" instruction.
- * It will write the corresponding y86 info to the output file
- * Returns the number of bytes of the nop instruction or data (if quad/byte)
+/* Perform read on machine code and write Y86 interpretation to corresponding file
+ * Only the window [startingOffset, endOffset) of the input is read, so the cost is
+ * proportional to the window and not to the offset; endOffset may be INPUT_TO_END.
+ * Instructions running past endOffset are treated as if the image ended there.
+ * The listing (or the binary record file) bypasses stdio: out is flushed and then
+ * written through its descriptor.
+ * With follow set only code reachable from startingOffset and the entries is
+ * decoded as instructions, see decodeFollowing.
+ * Input that is not a regular file (a pipe) is decoded as it is read, in
+ * constant memory, when only the plain listing is wanted; see decodeStream.
+ * With a cachePath only the regions that changed since the last run are decoded,
+ * see decodeIncremental.
+ * With labels set branch destinations get names, see buildLabelIndex.
+ * With ir set the window is decoded into memory first, see buildImageIr.
+ * With a graph format the basic blocks and their edges are written instead of
+ * the listing, see buildFlowGraph.
+ * With a format other than SINK_TEXT the items go to that built-in sink
+ * instead, see decodeToSink.
+ * With an indexPath an address index of the listing is written as well, see
+ * writeIndexedListing.
+ * With fill set the text listing is decoded on the calling thread, so .fill lines
+ * do not depend on where chunks were cut.
+ * With STATS_ALONGSIDE a statistics report follows on stderr; with STATS_ONLY the
+ * report is written to out instead of the listing.
+ * Returns 0 on success and -1 if the input could not be read or the output written
  */
-int rrmovqCase (FILE* out, FILE *machineCode, unsigned char buffer[1], unsigned long currAddr) {
-  //currAddr used in print statement handled by this function
+int readMachineCode(FILE* out, FILE *machineCode, const struct DecodeOptions *options) {
+  struct InputMap map;
+  struct OutBuffer ob;
+  struct DecodeStats stats;
+  double start = 0;
+  int result = 0;
+
+  if (fflush(out) != 0 || openOutBuffer(&ob, fileno(out), OUT_BUFFER_SIZE) != 0) {
+    return -1;
+  }
+  if (isPlainListing(options) && !isRegularInput(machineCode)) {
+    //A pipe is decoded as it arrives instead of being collected first
+    result = decodeStream(&ob, fileno(machineCode), options->startingOffset, options->endOffset);
+    if (closeOutBuffer(&ob) != 0) {
+      result = -1;
+    }
+    return result;
+  }
+  if (options->stats != STATS_OFF) {
+    memset(&stats, 0, sizeof(stats));
+    start = statsClock();
+  }
+  if (mapInputWindow(machineCode, options->startingOffset, options->endOffset, &map) != 0) {
+    closeOutBuffer(&ob);
+    return -1;
+  }
+  if (options->stats != STATS_OFF) {
+    touchImage(map.data, map.length);
+    stats.inputSeconds = statsClock() - start;
+    collectStats(map.data, map.length, &stats);
+    start = statsClock();
+  }
 
-  unsigned char byteData[8] = {0x0,0x0,0x0,0x0,0x0,0x0,0x0,0x0}; //Use in case it is quad/byte
-  byteData[0] = buffer[0];   //Pre-emptively put first buffered byte into bytedata
+  if (options->stats == STATS_ONLY) {
+    printStats(out, &stats); //The report is the output, no listing
+  }
+  else if (options->output == OUTPUT_TEXT && options->indexPath != NULL) {
+    result = decodeIndexed(&ob, &map, options);
+  }
+  else if (options->output == OUTPUT_TEXT && options->format != SINK_TEXT) {
+    struct OutputSink sink;
+    openSink(&sink, options->format, &ob);
+    result = decodeToSink(&sink, map.data, map.length, options->startingOffset);
+  }
+  else if (options->output == OUTPUT_TEXT && options->cachePath != NULL) {
+    result = decodeIncremental(&ob, map.data, map.length, options->startingOffset, options->cachePath);
+  }
+  else if (options->output == OUTPUT_TEXT && options->labels != LABELS_OFF) {
+    result = decodeLabelled(&ob, &map, options);
+  }
+  else if (options->output == OUTPUT_TEXT && options->graph != GRAPH_OFF) {
+    result = decodeGraph(&ob, &map, options);
+  }
+  else if (options->output == OUTPUT_TEXT && options->ir) {
+    result = decodeThroughIr(&ob, &map, options);
+  }
+  else if (options->output == OUTPUT_TEXT && options->follow) {
+    result = decodeFollowingFrom(&ob, &map, options);
+  }
+  else if (options->output == OUTPUT_TEXT && options->fill) {
+    struct DecodeState state = {0, 1, 1};
+    decodeRange(&ob, map.data, map.length, options->startingOffset, &state, map.length);
+    result = ob.error ? -1 : 0;
+  }
+  else if (options->output == OUTPUT_TEXT) {
+    result = decodeParallel(&ob, map.data, map.length, options->startingOffset, options->threads);
+  }
+  else {
+    result = writeRecordFile(ob.fd, map.data, map.length, options->startingOffset,
+                             options->output == OUTPUT_COLUMNS ? RECORD_LAYOUT_COLUMNS : RECORD_LAYOUT_ROWS);
+  }
+  unmapInput(&map);
+  if (closeOutBuffer(&ob) != 0) {
+    result = -1;
+  }
 
-  fread(buffer, 1, 1, machineCode); //Read next byte
-  byteData[1] = buffer[0]; //Fill in second bit of data
+  if (options->stats == STATS_ALONGSIDE && result == 0) {
+    stats.listingSeconds = statsClock() - start;
+    stats.writeSeconds = ob.writeSeconds;
+    printStats(stderr, &stats);
+  }
+  return result;
+}
 
-  unsigned char rA = buffer[0]>>4;   //rA is upper 4 bits
-  unsigned char rB = buffer[0]&0x0F; //rB is lower 4 bits
+#define REG_ANY  0x7FFF //rax-r14 (0x0-0xE) are valid register nibbles
+#define REG_NONE 0x8000 //Only the "no register" nibble 0xF is valid
 
-  if (checkRegister(rA)==1 && checkRegister(rB)==1) { //If registers are valid ...
-    char* encodString = bytesToEncInstrString(byteData, 2);
-    fprintf(out, "%016lx: %-22s%-8s%s, %s\n", currAddr, encodString, "rrmovq", getRegString(rA), getRegString(rB));
-    return 2; //rrmovqCase instruction is 2 bytes
+/* One entry per possible first byte. Entries without a length are not
+ * instructions, so a byte that selects one of them starts data.
+ */
+const struct OpDescriptor opTable[256] = {
+  [0x00] = {"halt",   1, SHAPE_NONE, 0, 0},
+  [0x10] = {"nop",    1, SHAPE_NONE, 0, 0},
+  [0x20] = {"rrmovq", 2, SHAPE_RR,   REG_ANY,  REG_ANY},
+  [0x21] = {"cmovle", 2, SHAPE_RR,   REG_ANY,  REG_ANY},
+  [0x22] = {"cmovl",  2, SHAPE_RR,   REG_ANY,  REG_ANY},
+  [0x23] = {"cmove",  2, SHAPE_RR,   REG_ANY,  REG_ANY},
+  [0x24] = {"cmovne", 2, SHAPE_RR,   REG_ANY,  REG_ANY},
+  [0x25] = {"cmovge", 2, SHAPE_RR,   REG_ANY,  REG_ANY},
+  [0x26] = {"cmovg",  2, SHAPE_RR,   REG_ANY,  REG_ANY},
+  [0x30] = {"irmovq", 10, SHAPE_IR,  REG_NONE, REG_ANY},
+  [0x40] = {"rmmovq", 10, SHAPE_RM,  REG_ANY,  REG_ANY},
+  [0x50] = {"mrmovq", 10, SHAPE_MR,  REG_ANY,  REG_ANY},
+  [0x60] = {"addq",   2, SHAPE_RR,   REG_ANY,  REG_ANY},
+  [0x61] = {"subq",   2, SHAPE_RR,   REG_ANY,  REG_ANY},
+  [0x62] = {"andq",   2, SHAPE_RR,   REG_ANY,  REG_ANY},
+  [0x63] = {"xorq",   2, SHAPE_RR,   REG_ANY,  REG_ANY},
+  [0x64] = {"mulq",   2, SHAPE_RR,   REG_ANY,  REG_ANY},
+  [0x65] = {"divq",   2, SHAPE_RR,   REG_ANY,  REG_ANY},
+  [0x66] = {"modq",   2, SHAPE_RR,   REG_ANY,  REG_ANY},
+  [0x70] = {"jmp",    9, SHAPE_DEST, 0, 0},
+  [0x71] = {"jle",    9, SHAPE_DEST, 0, 0},
+  [0x72] = {"jl",     9, SHAPE_DEST, 0, 0},
+  [0x73] = {"je",     9, SHAPE_DEST, 0, 0},
+  [0x74] = {"jne",    9, SHAPE_DEST, 0, 0},
+  [0x75] = {"jge",    9, SHAPE_DEST, 0, 0},
+  [0x76] = {"jg",     9, SHAPE_DEST, 0, 0},
+  [0x80] = {"call",   9, SHAPE_DEST, 0, 0},
+  [0x90] = {"ret",    1, SHAPE_NONE, 0, 0},
+  [0xA0] = {"pushq",  2, SHAPE_R,    REG_ANY,  REG_NONE},
+  [0xB0] = {"popq",   2, SHAPE_R,    REG_ANY,  REG_NONE},
+};
+
+/* Work out why the bytes starting at instr cannot be the instruction op
+ * describes. Mirrors the way the per-instruction handlers used to bail out:
+ * the opcode is checked first, then the register byte, then whether the
+ * whole instruction fits in the avail bytes left.
+ * Returns DATA_NONE if the bytes form a valid instruction
+ */
+int dataRunReason(const struct OpDescriptor *op, const uint8_t *instr, size_t avail) {
+  if (op->length == 0) {
+    return DATA_BAD_OPCODE;
+  }
+  if (op->rAMask != 0 && avail >= 2) {
+    unsigned char rA = instr[1]>>4;   //rA is upper 4 bits
+    unsigned char rB = instr[1]&0x0F; //rB is lower 4 bits
+    if (((op->rAMask >> rA) & (op->rBMask >> rB) & 1) == 0) {
+      return DATA_BAD_REGISTER;
+    }
   }
-  else { //Must be data...
-    return quadOrByteCase(out, machineCode, buffer, byteData, 2, currAddr); //Quad or byte case deals with print and returns number of bytes
+  if (op->length > avail) {
+    return DATA_TRUNCATED;
   }
+  return DATA_NONE;
 }
 
-/* This is a function to handle a "cmovXX rA, rB" instruction.
- * It will write the corresponding y86 info to the output file
- * Returns the number of bytes of the nop instruction or data (if quad/byte)
+/* Work out how many bytes starting at instr decode as data instead of the
+ * instruction op describes: bad opcodes and bad register bytes give up to a
+ * quad, an instruction cut off by the end of the image leaves everything as data.
+ * Returns 0 if the bytes form a valid instruction
  */
-int cmovXXCase (FILE* out, FILE *machineCode, unsigned char buffer[1], unsigned long currAddr) {
-  //currAddr used in print statement handled by this function
-  unsigned char byteData[8] = {0x0,0x0,0x0,0x0,0x0,0x0,0x0,0x0}; //Use in case it is quad/byte
-  byteData[0] = buffer[0];   //Pre-emptively put first buffered byte into bytedata
-  char* cMovCode = getCMovString(buffer[0]&0xF); //Retrieve cmov condition from lower half of first byte
+int dataRunLength(const struct OpDescriptor *op, const uint8_t *instr, size_t avail) {
+  switch (dataRunReason(op, instr, avail)) {
+    case DATA_NONE:
+      return 0;
+    case DATA_TRUNCATED:
+      return (int)avail;
+    default:
+      return avail < 8 ? (int)avail : 8;
+  }
+}
 
-  fread(buffer, 1, 1, machineCode); //Read next byte
-  byteData[1] = buffer[0]; //Fill in second bit of data
+static const char *const regNames[16] = {
+  "%rax", "%rcx", "%rdx", "%rbx", "%rsp", "%rbp", "%rsi", "%rdi",
+  "%r8", "%r9", "%r10", "%r11", "%r12", "%r13", "%r14", ""
+};
 
-  unsigned char rA = buffer[0]>>4;   //rA is upper 4 bits
-  unsigned char rB = buffer[0]&0x0F; //rB is lower 4 bits
-  if (checkRegister(rA)==1 && checkRegister(rB)==1) { //If registers are valid ...
-    char* encodString = bytesToEncInstrString(byteData, 2);
-    fprintf(out, "%016lx: %-22s%-8s%s, %s\n", currAddr, encodString, cMovCode, getRegString(rA), getRegString(rB));
-    return 2; //cmovXXCase instruction is 2 bytes
-  }
-  else { //Must be data...
-    return quadOrByteCase(out, machineCode, buffer, byteData, 2, currAddr); //Quad or byte case deals with print and returns number of bytes
+/* Little endian value of the n (at most 8) bytes starting at bytes
+ */
+uint64_t readLittleEndian(const uint8_t *bytes, int n) {
+  uint64_t value = 0;
+  for (int i = n - 1; i >= 0; i--) {
+    value = (value << 8) | bytes[i];
   }
+  return value;
 }
 
-/* This is a function to handle a "irmovq V, rB" instruction.
- * It will write the corresponding y86 info to the output file
- * Returns the number of bytes of the nop instruction or data (if quad/byte)
+/* Start a listing line: the address, the encoding and the mnemonic columns
+ * (the fprintf layout "%016lx: %-22s%-8s")
  */
-int irmovqCase (FILE* out, FILE *machineCode, unsigned char buffer[1], unsigned long currAddr) {
-    unsigned char byteData[8] = {0x0,0x0,0x0,0x0,0x0,0x0,0x0,0x0}; //Use in case it is quad/byte
-    byteData[0] = buffer[0];   //Pre-emptively put first buffered byte into bytedata
-
-    fread(buffer, 1, 1, machineCode); //Read next byte
-    byteData[1] = buffer[0];
-    unsigned char rA = buffer[0]>>4;   //rA is upper 4 bits
-    unsigned char rB = buffer[0]&0x0F; //rB is lower 4 bits
-
-    if (checkNoRegister(rA)==1 && checkRegister(rB)==1) { //If registers are valid, next 8? bytes are V
-        unsigned char V[8] = {0x0,0x0,0x0,0x0,0x0,0x0,0x0,0x0}; //Holds imm
-        for (int i=0; i<8; i++){ //Fills imm
-          if (fread(buffer, 1, 1, machineCode)){
-            byteData[i+2] = buffer[0];
-            V[i] = buffer[0];
-          }
-          else{
-            return quadOrByteCase(out, machineCode, buffer, byteData, i+2, currAddr);
-          }
-        }
-        char* encodString = bytesToEncInstrString(byteData, 10);
-        fprintf(out, "%016lx: %-22s%-8s$%s, %s\n", currAddr, encodString, "irmovq", bytesToString(V, 8), getRegString(rB));
-        return 10; //irmovqCase instruction is 10 bytes
-    }
-    else { //Must be data...
-        return quadOrByteCase(out, machineCode, buffer, byteData, 2, currAddr); //Quad or byte case deals with print and returns number of bytes
-    }
+char *putColumns(char *p, unsigned long currAddr, const uint8_t *bytes, int n, const char *mnemonic) {
+  char *encoding;
+  p = putHexFixed(p, currAddr, 16);
+  *p++ = ':';
+  *p++ = ' ';
+  encoding = p;
+  p = putHexBytes(p, bytes, n);
+  while (p - encoding < 22) {
+    *p++ = ' ';
+  }
+  return putPadded(p, mnemonic, 8);
 }
 
-/* This is a function to handle a "rmmovq rA, D (rB)" instruction.
- * It will write the corresponding y86 info to the output file
- * Returns the number of bytes of the nop instruction or data (if quad/byte)
+/* Render the operands of one valid instruction described by op, as they
+ * appear after the mnemonic column of the listing (nothing for SHAPE_NONE)
+ * Returns the end of the operands, no newline
  */
-int rmmovqCase (FILE* out, FILE *machineCode, unsigned char buffer[1], unsigned long currAddr) {
-    unsigned char byteData[10] = {0x0,0x0,0x0,0x0,0x0,0x0,0x0,0x0,0x0,0x0}; //Use in case it is quad/byte
-    byteData[0] = buffer[0];   //Pre-emptively put first buffered byte into bytedata
-
-    fread(buffer, 1, 1, machineCode); //Read next byte
-    byteData[1] = buffer[0];
-    unsigned char rA = buffer[0]>>4;   //rA is upper 4 bits
-    unsigned char rB = buffer[0]&0x0F; //rB is lower 4 bits
-
-    if (checkRegister(rA)==1 && checkRegister(rB)==1) { //If registers are valid, next 8? bytes are V
-        unsigned char D[8] = {0x0,0x0,0x0,0x0,0x0,0x0,0x0,0x0}; //Holds adr base
-        for (int i=0; i<8; i++){ //Fills adr base
-          if (fread(buffer, 1, 1, machineCode)){
-            byteData[i+2] = buffer[0];
-            D[i] = buffer[0];
-          }
-          else{
-            return quadOrByteCase(out, machineCode, buffer, byteData, i+2, currAddr);
-          }
-        }
-        char* encodString = bytesToEncInstrString(byteData, 10);
-        fprintf(out, "%016lx: %-22s%-8s%s, %s(%s)\n", currAddr, encodString, "rrmovq", getRegString(rA), bytesToString(D, 8), getRegString(rB));
-        return 10; //irmovqCase instruction is 10 bytes
-    }
-    else { //Must be data...
-        return quadOrByteCase(out, machineCode, buffer, byteData, 2, currAddr); //Quad or byte case deals with print and returns number of bytes
-    }
+char *putOperands(char *p, const struct OpDescriptor *op, const uint8_t *instr) {
+  unsigned char regs = op->length > 1 ? instr[1] : 0; //Only meaningful for shapes with a register byte
+  const char *rA = regNames[regs>>4];   //rA is upper 4 bits
+  const char *rB = regNames[regs&0x0F]; //rB is lower 4 bits
+
+  switch (op->shape) {
+    case SHAPE_NONE:
+      break;
+    case SHAPE_RR:
+      p = putPadded(p, rA, 0);
+      *p++ = ',';
+      *p++ = ' ';
+      p = putPadded(p, rB, 0);
+      break;
+    case SHAPE_IR:
+      *p++ = '$';
+      p = putHexValue(p, readLittleEndian(instr + 2, 8));
+      *p++ = ',';
+      *p++ = ' ';
+      p = putPadded(p, rB, 0);
+      break;
+    case SHAPE_RM:
+      p = putPadded(p, rA, 0);
+      *p++ = ',';
+      *p++ = ' ';
+      p = putHexValue(p, readLittleEndian(instr + 2, 8));
+      *p++ = '(';
+      p = putPadded(p, rB, 0);
+      *p++ = ')';
+      break;
+    case SHAPE_MR:
+      p = putHexValue(p, readLittleEndian(instr + 2, 8));
+      *p++ = '(';
+      p = putPadded(p, rB, 0);
+      *p++ = ')';
+      *p++ = ',';
+      *p++ = ' ';
+      p = putPadded(p, rA, 0);
+      break;
+    case SHAPE_DEST:
+      p = putHexValue(p, readLittleEndian(instr + 1, 8));
+      break;
+    case SHAPE_R:
+      p = putPadded(p, rA, 0);
+      break;
+  }
+  return p;
 }
 
-/* This is a function to handle a "mrmovq D (rB), rA" instruction.
- * It will write the corresponding y86 info to the output file
- * Returns the number of bytes of the nop instruction or data (if quad/byte)
+/* Render the listing line (with its newline) of one valid instruction described by op
+ * p needs room for OUT_LINE_MAX chars. Returns the end of the line
  */
-int mrmovqCase (FILE* out, FILE *machineCode, unsigned char buffer[1], unsigned long currAddr) {
-    unsigned char byteData[10] = {0x0,0x0,0x0,0x0,0x0,0x0,0x0,0x0,0x0,0x0}; //Use in case it is quad/byte
-    byteData[0] = buffer[0];   //Pre-emptively put first buffered byte into bytedata
-    fread(buffer, 1, 1, machineCode); //Read next byte
-    byteData[1] = buffer[0];
-    unsigned char rA = buffer[0]>>4;   //rA is upper 4 bits
-    unsigned char rB = buffer[0]&0x0F; //rB is lower 4 bits
-    if (checkRegister(rA)==1 && checkRegister(rB)==1) { //If registers are valid, next 8? bytes are V
-        unsigned char D[8] = {0x0,0x0,0x0,0x0,0x0,0x0,0x0,0x0}; //Holds offset
-        for (int i=0; i<8; i++){ //Fills offset
-          if (fread(buffer, 1, 1, machineCode)){
-            D[i] = buffer[0];
-            byteData[i+2] = buffer[0];
-          }
-          else{
-            return quadOrByteCase(out, machineCode, buffer, byteData, i+2, currAddr);
-          }
-        }
-        char* encodString = bytesToEncInstrString(byteData, 10);
-        fprintf(out, "%016lx: %-22s%-8s%s(%s), %s\n", currAddr, encodString, "mrmovq", bytesToString(D, 8), getRegString(rB), getRegString(rA));
-        return 10; //irmovqCase instruction is 10 bytes
-    }
-    else { //Must be data...
-        return quadOrByteCase(out, machineCode, buffer, byteData, 2, currAddr); //Quad or byte case deals with print and returns number of bytes
-    }
+char *putInstruction(char *p, const struct OpDescriptor *op, const uint8_t *instr, unsigned long currAddr) {
+  p = putColumns(p, currAddr, instr, op->length, op->mnemonic);
+  p = putOperands(p, op, instr);
+  *p++ = '\n';
+  return p;
 }
 
-/* This is a function to handle a "OPq rA, rB" instruction.
- * It will write the corresponding y86 info to the output file
- * Returns the number of bytes of the nop instruction or data (if quad/byte)
+/* Render the listing line of a .quad (n is 8) or a .byte (n is 1) holding bytes
+ * p needs room for OUT_LINE_MAX chars. Returns the end of the line
  */
-int opqCase(FILE* out, FILE *machineCode, unsigned char buffer[1], unsigned long currAddr){
-    unsigned char byteData[8] = {0x0,0x0,0x0,0x0,0x0,0x0,0x0,0x0}; //Use in case it is quad/byte
-    byteData[0] = buffer[0];   //Pre-emptively put first buffered byte into bytedata
-    char* opCode = getOpCodeString(buffer[0]&0xF); //Retrieve opcode from lower half of first byte
-
-    fread(buffer, 1, 1, machineCode); //Read next byte
-    byteData[1] = buffer[0]; //Fill in second bit of data
-    unsigned char rA = buffer[0]>>4;   //rA is upper 4 bits
-    unsigned char rB = buffer[0]&0x0F; //rB is lower 4 bits
-    if (checkRegister(rA)==1 && checkRegister(rB)==1) { //If registers are valid ...
-      char* encodString = bytesToEncInstrString(byteData, 2);
-      fprintf(out, "%016lx: %-22s%-8s%s, %s\n", currAddr, encodString, opCode, getRegString(rA), getRegString(rB));
-      return 2; //opqCase instruction is 2 bytes
-    }
-    else { //Must be data...
-      return quadOrByteCase(out, machineCode, buffer, byteData, 2, currAddr); //Quad or byte case deals with print and returns number of bytes
-    }
+char *putDataLine(char *p, const uint8_t *bytes, int n, unsigned long currAddr) {
+  p = putColumns(p, currAddr, bytes, n, n == 8 ? ".quad" : ".byte");
+  p = putHexValue(p, readLittleEndian(bytes, n));
+  *p++ = '\n';
+  return p;
 }
 
-/* This is a function to handle a "jXX Dest" instruction.
- * It will write the corresponding y86 info to the output file
- * Returns the number of bytes of the nop instruction or data (if quad/byte)
- * Note that in this instruction, it is impossible for it to be a quad (unless we run out of space?)
+/* Render one line standing for count identical .quad lines holding bytes
+ * (the GNU as directive ".fill count, 8, value")
+ * p needs room for OUT_LINE_MAX chars. Returns the end of the line
  */
-int jxxCase(FILE* out, FILE *machineCode, unsigned char buffer[1], unsigned long currAddr){
-    unsigned char byteData[9] = {0x0,0x0,0x0,0x0,0x0,0x0,0x0,0x0,0x0};
-    byteData[0] = buffer[0];
-    char* jmpCode = getJmpString(buffer[0]&0xF); //Retrieve opcode from lower half of first byte
-    unsigned char dest[8] = {0x0,0x0,0x0,0x0,0x0,0x0,0x0,0x0}; //Holds offset
-    for (int i=0; i<8; i++){ //Fills offset
-      if (fread(buffer, 1, 1, machineCode)){
-        dest[i] = buffer[0];
-        byteData[i+1] = buffer[0];
-      }
-      else{
-        return quadOrByteCase(out, machineCode, buffer, byteData, i+1, currAddr);
-      }
-    }
-    char* encodString = bytesToEncInstrString(byteData, 9);
-    fprintf(out, "%016lx: %-22s%-8s%s\n", currAddr, encodString, jmpCode, bytesToString(dest, 8));
-    return 9; //jxxCase instruction is 9 bytes
+char *putFillLine(char *p, const uint8_t *bytes, size_t count, unsigned long currAddr) {
+  p = putColumns(p, currAddr, bytes, 8, ".fill");
+  p = putHexValue(p, count);
+  *p++ = ',';
+  *p++ = ' ';
+  *p++ = '8';
+  *p++ = ',';
+  *p++ = ' ';
+  p = putHexValue(p, readLittleEndian(bytes, 8));
+  *p++ = '\n';
+  return p;
 }
 
-/* This is a function to handle a "call Dest" instruction.
- * It will write the corresponding y86 info to the output file
- * Returns the number of bytes of the nop instruction or data (if quad/byte)
- * Note that in this instruction, it is impossible for it to be a quad (unless we run out of space?)
+/* Count the zero bytes starting at code[pos], looking no further than stop
+ * A zero byte is always a halt, so the decoder can take a whole run at once.
  */
-int callCase(FILE* out, FILE *machineCode, unsigned char buffer[1], unsigned long currAddr){
-    unsigned char byteData[9] = {0x0,0x0,0x0,0x0,0x0,0x0,0x0,0x0,0x0};
-    byteData[0] = buffer[0];
-    unsigned char dest[8] = {0x0,0x0,0x0,0x0,0x0,0x0,0x0,0x0}; //Holds offset
-    for (int i=0; i<8; i++){ //Fills offset
-      if (fread(buffer, 1, 1, machineCode)){
-        dest[i] = buffer[0];
-        byteData[i+1] = buffer[0];
-      }
-      else {
-        return quadOrByteCase(out, machineCode, buffer, byteData, i+1, currAddr);
-      }
+size_t zeroRunLength(const uint8_t *code, size_t pos, size_t stop) {
+  size_t end = pos;
+#if defined(__SSE2__) && defined(__GNUC__)
+  const __m128i zero = _mm_setzero_si128();
+  while (stop - end >= 16) {
+    __m128i block = _mm_loadu_si128((const __m128i *)(code + end));
+    unsigned nonZero = ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(block, zero)) & 0xFFFF;
+    if (nonZero != 0) {
+      return end + (size_t)__builtin_ctz(nonZero) - pos;
     }
-    char* encodString = bytesToEncInstrString(byteData, 9);
-    fprintf(out, "%016lx: %-22s%-8s%s\n", currAddr, encodString, "call", bytesToString(dest, 8));
-    return 9; //call instruction is 9 bytes
+    end += 16;
+  }
+#endif
+  while (end < stop && code[end] == 0x00) {
+    end++;
+  }
+  return end - pos;
 }
 
-/* This is a function to handle a "pushq rA" instruction.
- * It will write the corresponding y86 info to the output file
- * Returns the number of bytes of the nop instruction or data (if quad/byte)
+/* Count the quads starting at code[pos], pos + 8, ... before stop that are
+ * byte for byte the same as the first one, which is assumed to be data
+ * Identical quads decode identically as long as each one is whole, so stop
+ * must leave room for 8 bytes after the last quad start it allows.
  */
-int pushqCase (FILE* out, FILE *machineCode, unsigned char buffer[1], unsigned long currAddr) {
-  unsigned char byteData[8] = {0x0,0x0,0x0,0x0,0x0,0x0,0x0,0x0}; //Use in case it is quad/byte
-  byteData[0] = buffer[0];   //Pre-emptively put first buffered byte into bytedata
-
-  fread(buffer, 1, 1, machineCode); //Read next byte
-  byteData[1] = buffer[0]; //Fill in second bit of data
-  unsigned char rA = buffer[0]>>4;   //rA is upper 4 bits
-  unsigned char rB = buffer[0]&0x0F; //rB is lower 4 bits
-  if (checkRegister(rA)==1 && checkNoRegister(rB)==1) { //If registers are valid ...
-    char* encodString = bytesToEncInstrString(byteData,2);
-    fprintf(out, "%016lx: %-22s%-8s%s\n", currAddr, encodString, "pushq", getRegString(rA));
-    return 2; //pushQ instruction is 2 bytes
-  }
-  else { //Must be data...
-    return quadOrByteCase(out, machineCode, buffer, byteData, 2, currAddr); //Quad or byte case deals with print and returns number of bytes
+size_t quadRunLength(const uint8_t *code, size_t pos, size_t stop) {
+  uint64_t first, next;
+  size_t count = 1;
+
+  memcpy(&first, code + pos, 8);
+  for (pos += 8; pos < stop; pos += 8) {
+    memcpy(&next, code + pos, 8);
+    if (next != first) {
+      break;
+    }
+    count++;
   }
+  return count;
 }
 
-/* This is a function to handle a "popq rA" instruction.
- * It will write the corresponding y86 info to the output file
- * Returns the number of bytes of the nop instruction or data (if quad/byte)
+/* Write one valid instruction described by op
  */
-int popqCase (FILE* out, FILE *machineCode, unsigned char buffer[1], unsigned long currAddr) {
-  //currAddr used in print statement handled by this function
-
-  unsigned char byteData[8] = {0x0,0x0,0x0,0x0,0x0,0x0,0x0,0x0}; //Use in case it is quad/byte
-  byteData[0] = buffer[0];   //Pre-emptively put first buffered byte into bytedata
+static void printInstruction(struct OutBuffer *out, const struct OpDescriptor *op, const uint8_t *instr, unsigned long currAddr) {
+  commitOut(out, putInstruction(reserveOut(out, OUT_LINE_MAX), op, instr, currAddr));
+}
 
-  fread(buffer, 1, 1, machineCode); //Read next byte
-  byteData[1] = buffer[0]; //Fill in second bit of data
-  unsigned char rA = buffer[0]>>4;   //rA is upper 4 bits
-  unsigned char rB = buffer[0]&0x0F; //rB is lower 4 bits
-  if (checkRegister(rA)==1 && checkNoRegister(rB)==1) { //If registers are valid ...
-    char* encodString = bytesToEncInstrString(byteData,2);
-    fprintf(out, "%016lx: %-22s%-8s%s\n", currAddr, encodString, "popq", getRegString(rA));
-    return 2; //pushQ instruction is 2 bytes
-  }
-  else { //Must be data...
-    return quadOrByteCase(out, machineCode, buffer, byteData, 2, currAddr); //Quad or byte case deals with print and returns number of bytes
-  }
+/* Decode the bytes code[0..length) and write the Y86 interpretation to out
+ * code[0] lives at address baseAddr
+ */
+void decodeMachineCode(struct OutBuffer *out, const uint8_t *code, size_t length, unsigned long baseAddr) {
+  struct DecodeState state = {0, 1};
+  decodeRange(out, code, length, baseAddr, &state, length);
 }
 
-/* Attempt to read a quad or byte
- * Note that it reads from the machine code file so it progresses fread
- * The byteData array holds the bytes of the expected quad/byte
- * bytesSoFar represents how many valid bits already exist in byteData
- * Returns the length of the byte data and manipulates the byteData array to contain the bytes read
- * Therefore returns 8 if it is a quad, and <8 if it is a byte
+/* Decode instructions starting at state->pos for as long as they start before stop
+ * code[0..length) is the whole image (so instructions may run past stop but not
+ * past length) and code[0] lives at address baseAddr. state is updated to where
+ * decoding stopped, so a later call can carry on from there.
+ * Every position is a lookup in opTable followed by a bounds and register check,
+ * except that a run of zero bytes (halts) is skipped in one scan and, with
+ * state->fill, a run of identical data quads becomes a single .fill line.
  */
-int quadOrByteCase(FILE* out, FILE *machineCode, unsigned char buffer[1], unsigned char byteData[], int bytesSoFar, unsigned long currAddr) {
-  int currBytes;
-  char* encodString;
-  for (currBytes=bytesSoFar; currBytes<8; currBytes++){
-    if (fread(buffer, 1, 1, machineCode)==1){ //Take next byte
-      byteData[currBytes] = buffer[0];
+void decodeRange(struct OutBuffer *out, const uint8_t *code, size_t length, unsigned long baseAddr, struct DecodeState *state, size_t stop) {
+  int skipHalt = state->skipHalt; //If 1, skip printing halt statement
+  size_t pos = state->pos;        //Offset of currAddr in code
+
+  if (stop > length) {
+    stop = length;
+  }
+  while (pos < stop) {
+    const uint8_t *instr = code + pos; //First byte of the current instruction
+    size_t avail = length - pos;       //Bytes left in the image from instr onwards
+    unsigned long currAddr = baseAddr + pos; //"program counter"
+    const struct OpDescriptor *op = &opTable[instr[0]];
+    size_t increment; //How much to increment the curr addr value by
+    int data = dataRunLength(op, instr, avail);
+
+    if (data == 8 && state->fill && avail >= 16 && dataRunReason(op, instr, avail) != DATA_TRUNCATED) {
+      //Whole quads from stop - 7 on would run past the image
+      size_t count = quadRunLength(code, pos, (length - 7 < stop ? length - 7 : stop));
+      if (count > 1) {
+        commitOut(out, putFillLine(reserveOut(out, OUT_LINE_MAX), instr, count, currAddr));
+      }
+      else {
+        quadOrByteCase(out, instr, data, currAddr);
+      }
+      increment = 8 * count;
+      skipHalt = 0;
+    }
+    else if (data != 0) { //Quad/Byte
+      increment = (size_t)quadOrByteCase(out, instr, data, currAddr);
+      skipHalt = 0;
+    }
+    else if (instr[0] == 0x00) { //HALT, only the first of a run is printed
+      if (skipHalt == 0) {
+        printInstruction(out, op, instr, currAddr);
+      }
+      increment = zeroRunLength(code, pos, stop); //The rest of the run is silent
+      skipHalt = 1;
     }
     else {
-      break;
+      printInstruction(out, op, instr, currAddr);
+      increment = op->length;
+      skipHalt = 0;
     }
+    pos += increment;
   }
+  state->pos = pos;
+  state->skipHalt = skipHalt;
+}
+
+/* Print dataLength bytes starting at instr as a quad and/or bytes
+ * A full 8 bytes become a .quad, any bytes beyond the quad or any shorter
+ * run become one .byte each
+ * Returns the number of bytes printed (dataLength)
+ */
+int quadOrByteCase(struct OutBuffer *out, const uint8_t *instr, int dataLength, unsigned long currAddr) {
+  int i = 0;
+
   //Quad print procedure
-  if (currBytes==8){
-    encodString = bytesToEncInstrString(byteData,8);
-    fprintf(out, "%016lx: %-22s%-8s%s\n", currAddr, encodString, ".quad", bytesToString(byteData, 8));
-    return currBytes;
-  }
-  else if (currBytes<8){ //Byte print procedure
-    for (int i=0; i<currBytes; i++){
-      unsigned char oneByteData[] = {byteData[i]};
-      encodString = bytesToEncInstrString(oneByteData,1);
-      fprintf(out, "%016lx: %-22s%-8s%s\n", currAddr + i, encodString, ".byte", bytesToString(oneByteData, 1));
-    }
-    return currBytes;
+  if (dataLength >= 8) {
+    commitOut(out, putDataLine(reserveOut(out, OUT_LINE_MAX), instr, 8, currAddr));
+    i = 8;
   }
-  else{//Quad+byte print procedure
-    encodString = bytesToEncInstrString(byteData,8);
-    fprintf(out, "%016lx: %-22s%-8s%s\n", currAddr, encodString, ".quad", bytesToString(byteData, 8));
-
-    for (int i=8; i<currBytes; i++){ //Print extra bytes
-      unsigned char oneByteData[] = {byteData[i]};
-      encodString = bytesToEncInstrString(oneByteData,1);
-      fprintf(out, "%016lx: %-22s%-8s%s\n", currAddr + i, encodString, ".byte", bytesToString(oneByteData, 1));
-    }
-    return currBytes;
+  for (; i<dataLength; i++){ //Byte print procedure
+    commitOut(out, putDataLine(reserveOut(out, OUT_LINE_MAX), instr + i, 1, currAddr + i));
   }
+  return dataLength;
 }
 
-char* getOpCodeString(unsigned char reg) {
+const char* getOpCodeString(unsigned char reg) {
   switch(reg){
     case 0x0:
       return "addq";
@@ -464,7 +590,7 @@ char* getOpCodeString(unsigned char reg) {
   }
 }
 
-char* getJmpString(unsigned char reg) {
+const char* getJmpString(unsigned char reg) {
   switch(reg){
     case 0x0:
       return "jmp";
@@ -493,7 +619,7 @@ char* getJmpString(unsigned char reg) {
   }
 }
 
-char* getCMovString(unsigned char reg) {
+const char* getCMovString(unsigned char reg) {
   switch(reg){
     case 0x1:
       return "cmovle";
@@ -521,7 +647,7 @@ char* getCMovString(unsigned char reg) {
 
  /* Converts reg value to string
   */
-char* getRegString(unsigned char reg) {
+const char* getRegString(unsigned char reg) {
     switch(reg){
       case 0x0:
         return "%rax";
@@ -574,54 +700,25 @@ char* getRegString(unsigned char reg) {
     }
 }
 
-/* Converts byte data into a corresponding string representation from
- * byteData to byteString, in hexdecimal
- * Note that the byteString is in reverse order as displayed b/c little endian
- * so least significant bytes are read first
- * Bytelength specifies the number of bytes in the byteData array
+/* Converts byte data into a corresponding string representation in
+ * hexadecimal, written to the caller supplied byteString
+ * Note that the bytes are in reverse order as displayed b/c little endian
+ * so least significant bytes are read first; leading zeros are dropped
+ * Bytelength specifies the number of bytes in the byteData array (at most 8)
+ * byteString must hold VALUE_STRING_SIZE chars; it is returned for convenience
  */
-char* bytesToString(unsigned char byteData[], int byteLength) {
-  int i;
-  char hex[17] = "0123456789abcdef";
-  static char byteString[19];
-  byteString[0] = '0';
-  byteString[1] = 'x';
-
-  for (i=0; i<byteLength; i++){
-    byteString[2*i+2] = hex[(byteData[byteLength-1-i]>>4)&0xF];
-    byteString[2*i+3] = hex[(byteData[byteLength-1-i])&0xF];
-  }
-  byteString[2*i+2] = '\0';
-
-  // Remove leading 0's:
-  i=2;
-  int numLeadZero = 0;
-  while (byteString[i]=='0' && i<byteLength*2+2){
-    numLeadZero ++;
-    i++;
-  }
-  if (numLeadZero == byteLength*2){ //If all 0's, return 0x0
-    return "0x0";
-  }
-  //Shift left to remove leading zeros
-  for (i=2; i<(byteLength*2-numLeadZero+3); i++){
-    byteString[i] = byteString[i+numLeadZero];
-  }
+char* bytesToString(const unsigned char byteData[], int byteLength, char byteString[VALUE_STRING_SIZE]) {
+  *putHexValue(byteString, readLittleEndian(byteData, byteLength)) = '\0';
   return byteString;
 }
 
-/* Converts bytes into a corresponding encoded instruction format
- * byteLength = number of bytes to take from array
+/* Converts bytes into a corresponding encoded instruction format, written
+ * to the caller supplied instrString
+ * byteLength = number of bytes to take from array (at most 10)
+ * instrString must hold ENC_STRING_SIZE chars; it is returned for convenience
  */
-char* bytesToEncInstrString(unsigned char bytes[], int byteLength) {
-  char hex[17] = "0123456789ABCDEF";
-  static char instrString[21];
-
-  for (int i=0; i<byteLength; i++){
-    instrString[2*i] = hex[(bytes[i]>>4)&0xF];
-    instrString[2*i+1] = hex[bytes[i]&0xF];
-  }
-  instrString[2*byteLength] = '\0';
+char* bytesToEncInstrString(const unsigned char bytes[], int byteLength, char instrString[ENC_STRING_SIZE]) {
+  *putHexBytes(instrString, bytes, byteLength) = '\0';
   return instrString;
 }
 
@@ -6,33 +6,110 @@
 #define _PRINTROUTINES_H_
 
 #include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "outBuffer.h"
 
 int samplePrint(FILE *);
 
-void readMachineCode(FILE* out, FILE *machineCode, unsigned long startingOffset); //Maybe shouldnt go here
-
-//Methods to deal with each instruction:
-int nopCase (FILE* out, FILE *machineCode, unsigned char buffer[1], unsigned long currAddr);
-int rrmovqCase (FILE* out, FILE *machineCode, unsigned char buffer[1], unsigned long currAddr);
-int cmovXXCase (FILE* out, FILE *machineCode, unsigned char buffer[1], unsigned long currAddr);
-int irmovqCase (FILE* out, FILE *machineCode, unsigned char buffer[1], unsigned long currAddr);
-int rmmovqCase (FILE* out, FILE *machineCode, unsigned char buffer[1], unsigned long currAddr);
-int mrmovqCase (FILE* out, FILE *machineCode, unsigned char buffer[1], unsigned long currAddr);
-int opqCase(FILE* out, FILE *machineCode, unsigned char buffer[1], unsigned long currAddr);
-int jxxCase(FILE* out, FILE *machineCode, unsigned char buffer[1], unsigned long currAddr);
-int callCase(FILE* out, FILE *machineCode, unsigned char buffer[1], unsigned long currAddr);
-int pushqCase (FILE* out, FILE *machineCode, unsigned char buffer[1], unsigned long currAddr);
-int popqCase (FILE* out, FILE *machineCode, unsigned char buffer[1], unsigned long currAddr);
-int quadOrByteCase(FILE* out, FILE *machineCode, unsigned char buffer[1], unsigned char byteData[], int bytesSoFar, unsigned long currAddr);
+//What readMachineCode writes
+enum OutputKind {
+  OUTPUT_TEXT,   //The listing
+  OUTPUT_ROWS,   //Binary record file, one fixed-size record after another
+  OUTPUT_COLUMNS //Binary record file, one array per field
+};
+
+//Whether readMachineCode also reports decode statistics
+enum StatsMode {STATS_OFF, STATS_ALONGSIDE, STATS_ONLY};
+
+//Whether readMachineCode names branch destinations
+enum LabelMode {LABELS_OFF, LABELS_ON, LABELS_XREF};
+
+//How readMachineCode should go about the input
+struct DecodeOptions {
+  unsigned long startingOffset; //First byte of the window to decode
+  unsigned long endOffset;      //End of the window, INPUT_TO_END for the whole file
+  int threads;                  //Worker threads, 1 decodes on the calling thread only
+  int output;                   //An OutputKind
+  int stats;                    //A StatsMode
+  int fill;                     //If 1, runs of identical quads collapse into .fill lines (decodes serially)
+  int follow;                   //If 1, follow control flow from startingOffset and entries instead of sweeping
+  const unsigned long *entries; //Extra entry addresses for follow
+  int entryCount;
+  int labels;                   //A LabelMode (decodes serially)
+  const char *cachePath;        //If not NULL, reuse and update this region cache (decodes serially)
+  int ir;                       //If 1, decode the whole window into an ImageIr and list it from there
+  int graph;                    //A GraphFormat: write the control flow graph instead of the listing
+  int format;                   //A SinkFormat: anything but SINK_TEXT renders through decodeToSink
+  const char *indexPath;        //If not NULL, also write an address index of the listing here (decodes serially)
+  unsigned indexEvery;          //Items between index checkpoints, 0 for INDEX_DEFAULT_EVERY
+};
+
+int readMachineCode(FILE* out, FILE *machineCode, const struct DecodeOptions *options); //Maybe shouldnt go here
+void decodeMachineCode(struct OutBuffer *out, const uint8_t *code, size_t length, unsigned long baseAddr);
+
+//Where a linear sweep is and whatever else decides how the next byte prints
+struct DecodeState {
+  size_t pos;   //Offset of the next instruction in the image
+  int skipHalt; //If 1, the next halt is not printed
+  int fill;     //If 1, a run of identical data quads is listed as one .fill line
+};
+
+void decodeRange(struct OutBuffer *out, const uint8_t *code, size_t length, unsigned long baseAddr, struct DecodeState *state, size_t stop);
+
+//Operand layouts of the instructions, used by the opcode table
+enum OperandShape {
+  SHAPE_NONE, //halt, nop, ret
+  SHAPE_RR,   //rA, rB
+  SHAPE_IR,   //$V, rB
+  SHAPE_RM,   //rA, D(rB)
+  SHAPE_MR,   //D(rB), rA
+  SHAPE_DEST, //Dest
+  SHAPE_R     //rA
+};
+
+//Everything the decoder needs to know about one first byte
+struct OpDescriptor {
+  const char *mnemonic;
+  unsigned char length;  //Instruction length in bytes, 0 if the byte is not an opcode
+  unsigned char shape;   //An OperandShape
+  unsigned short rAMask; //Bit n set if rA nibble n is valid, 0 if there is no register byte
+  unsigned short rBMask; //Bit n set if rB nibble n is valid
+};
+
+extern const struct OpDescriptor opTable[256];
+
+//Why a position decodes as data instead of an instruction
+enum DataReason {
+  DATA_NONE,         //It does not, the instruction is valid
+  DATA_BAD_OPCODE,   //The first byte is not an opcode
+  DATA_BAD_REGISTER, //The register byte is not valid for the opcode
+  DATA_TRUNCATED     //The instruction runs past the end of the image
+};
+
+int dataRunReason(const struct OpDescriptor *op, const uint8_t *instr, size_t avail);
+int dataRunLength(const struct OpDescriptor *op, const uint8_t *instr, size_t avail);
+char *putColumns(char *p, unsigned long currAddr, const uint8_t *bytes, int n, const char *mnemonic);
+char *putOperands(char *p, const struct OpDescriptor *op, const uint8_t *instr);
+char *putInstruction(char *p, const struct OpDescriptor *op, const uint8_t *instr, unsigned long currAddr);
+char *putDataLine(char *p, const uint8_t *bytes, int n, unsigned long currAddr);
+char *putFillLine(char *p, const uint8_t *bytes, size_t count, unsigned long currAddr);
+size_t zeroRunLength(const uint8_t *code, size_t pos, size_t stop);
+size_t quadRunLength(const uint8_t *code, size_t pos, size_t stop);
+int quadOrByteCase(struct OutBuffer *out, const uint8_t *instr, int dataLength, unsigned long currAddr);
 
 //Helper methods:
-char* bytesToString(unsigned char byteData[], int byteLength);
-char* bytesToEncInstrString(unsigned char bytes[], int byteLength);
+//Both write into the caller's buffer and keep no state, so any thread may call them
+#define VALUE_STRING_SIZE 19 //"0x", up to 16 hex digits and the terminator
+#define ENC_STRING_SIZE 21   //Up to 10 bytes as hex and the terminator
+char* bytesToString(const unsigned char byteData[], int byteLength, char byteString[VALUE_STRING_SIZE]);
+char* bytesToEncInstrString(const unsigned char bytes[], int byteLength, char instrString[ENC_STRING_SIZE]);
+uint64_t readLittleEndian(const uint8_t *bytes, int n);
 int checkRegister(unsigned char regVal);
 int checkNoRegister(unsigned char regVal);
-char* getRegString(unsigned char reg);
-char* getOpCodeString(unsigned char reg);
-char* getJmpString(unsigned char reg);
-char* getCMovString(unsigned char reg);
+const char* getRegString(unsigned char reg);
+const char* getOpCodeString(unsigned char reg);
+const char* getJmpString(unsigned char reg);
+const char* getCMovString(unsigned char reg);
 
 #endif /* PRINTROUTINES */
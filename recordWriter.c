@@ -0,0 +1,201 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "recordWriter.h"
+#include "outBuffer.h"
+#include "disasm.h"
+
+#define RECORD_BATCH 4096    //Records decoded per y86DecodeBatch call
+#define COLUMN_BUFFER 65536  //Bytes collected per column before each pwrite
+
+static void putLE(uint8_t *p, uint64_t value, int n) {
+  for (int i = 0; i < n; i++) {
+    p[i] = (uint8_t)(value >> (8 * i));
+  }
+}
+
+static void fillHeader(uint8_t header[RECORD_HEADER_SIZE], int layout, uint64_t count, unsigned long baseAddr, size_t length) {
+  memset(header, 0, RECORD_HEADER_SIZE);
+  memcpy(header, "Y86R", 4);
+  putLE(header + 4, RECORD_FILE_VERSION, 2);
+  putLE(header + 6, (uint64_t)layout, 2);
+  putLE(header + 8, layout == RECORD_LAYOUT_ROWS ? RECORD_ROW_SIZE : RECORD_COLUMNS_SIZE, 4);
+  putLE(header + 16, count, 8);
+  putLE(header + 24, baseAddr, 8);
+  putLE(header + 32, length, 8);
+}
+
+/* pwrite all n bytes at offset, retrying short and interrupted writes
+ */
+static int pwriteAll(int fd, const uint8_t *data, size_t n, off_t offset) {
+  while (n > 0) {
+    ssize_t wrote = pwrite(fd, data, n, offset);
+    if (wrote < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    data += wrote;
+    n -= (size_t)wrote;
+    offset += wrote;
+  }
+  return 0;
+}
+
+/* Stream the records one row after another in a single decoding pass
+ * The count is patched into the header afterwards if the output can be rewound.
+ */
+static int writeRows(int fd, const uint8_t *code, size_t length, unsigned long baseAddr) {
+  struct Y86Record records[RECORD_BATCH];
+  struct Y86Cursor cursor;
+  struct OutBuffer ob;
+  uint64_t count = 0;
+  off_t start = lseek(fd, 0, SEEK_CUR);
+  size_t n;
+
+  if (openOutBuffer(&ob, fd, OUT_BUFFER_SIZE) != 0) {
+    return -1;
+  }
+  char *header = reserveOut(&ob, RECORD_HEADER_SIZE);
+  fillHeader((uint8_t *)header, RECORD_LAYOUT_ROWS, RECORD_COUNT_UNKNOWN, baseAddr, length);
+  commitOut(&ob, header + RECORD_HEADER_SIZE);
+
+  y86InitCursor(&cursor);
+  while ((n = y86DecodeBatch(code, length, baseAddr, &cursor, records, RECORD_BATCH)) > 0) {
+    for (size_t i = 0; i < n; i++) {
+      if (records[i].flags & Y86_FLAG_SILENT) {
+        continue;
+      }
+      char *row = reserveOut(&ob, RECORD_ROW_SIZE);
+      uint8_t *p = (uint8_t *)row;
+      putLE(p, records[i].address, 8);
+      putLE(p + 8, records[i].immediate, 8);
+      p[16] = records[i].opcode;
+      p[17] = records[i].ifun;
+      p[18] = records[i].rA;
+      p[19] = records[i].rB;
+      p[20] = records[i].length;
+      p[21] = records[i].kind;
+      p[22] = records[i].flags;
+      p[23] = 0;
+      commitOut(&ob, row + RECORD_ROW_SIZE);
+      count++;
+    }
+  }
+  if (closeOutBuffer(&ob) != 0) {
+    return -1;
+  }
+  if (start >= 0) { //Seekable, so the real count can go in the header
+    uint8_t countField[8];
+    putLE(countField, count, 8);
+    return pwriteAll(fd, countField, 8, start + 16);
+  }
+  return 0;
+}
+
+//One column of the columnar layout, written at its own offset
+struct Column {
+  off_t offset; //Where the next flushed byte goes
+  size_t length;
+  uint8_t data[COLUMN_BUFFER];
+};
+
+static int flushColumn(int fd, struct Column *column) {
+  int result = pwriteAll(fd, column->data, column->length, column->offset);
+  column->offset += (off_t)column->length;
+  column->length = 0;
+  return result;
+}
+
+static int putColumn(int fd, struct Column *column, uint64_t value, int n) {
+  if (COLUMN_BUFFER - column->length < (size_t)n && flushColumn(fd, column) != 0) {
+    return -1;
+  }
+  putLE(column->data + column->length, value, n);
+  column->length += (size_t)n;
+  return 0;
+}
+
+/* Write the columnar layout: one pass counts the records so every array's
+ * offset is known, a second pass fills all arrays at once with pwrite.
+ * The output has to be seekable.
+ */
+static int writeColumns(int fd, const uint8_t *code, size_t length, unsigned long baseAddr) {
+  static const int widths[7] = {8, 8, 1, 1, 1, 1, 1};
+  struct Column *columns; //addresses, immediates, first bytes, registers, lengths, kinds, flags
+  struct Y86Record records[RECORD_BATCH];
+  struct Y86Cursor cursor;
+  uint8_t header[RECORD_HEADER_SIZE];
+  uint64_t count = 0;
+  off_t start = lseek(fd, 0, SEEK_CUR);
+  off_t offset;
+  size_t n;
+
+  if (start < 0) {
+    return -1; //errno is ESPIPE for pipes
+  }
+  y86InitCursor(&cursor);
+  while ((n = y86DecodeBatch(code, length, baseAddr, &cursor, records, RECORD_BATCH)) > 0) {
+    for (size_t i = 0; i < n; i++) {
+      count += !(records[i].flags & Y86_FLAG_SILENT);
+    }
+  }
+
+  fillHeader(header, RECORD_LAYOUT_COLUMNS, count, baseAddr, length);
+  if (pwriteAll(fd, header, RECORD_HEADER_SIZE, start) != 0) {
+    return -1;
+  }
+  columns = malloc(7 * sizeof(*columns));
+  if (columns == NULL) {
+    return -1;
+  }
+  offset = start + RECORD_HEADER_SIZE;
+  for (int c = 0; c < 7; c++) {
+    columns[c].offset = offset;
+    columns[c].length = 0;
+    offset += (off_t)(count * (uint64_t)widths[c]);
+  }
+
+  y86InitCursor(&cursor);
+  while ((n = y86DecodeBatch(code, length, baseAddr, &cursor, records, RECORD_BATCH)) > 0) {
+    for (size_t i = 0; i < n; i++) {
+      const struct Y86Record *r = &records[i];
+      if (r->flags & Y86_FLAG_SILENT) {
+        continue;
+      }
+      if (putColumn(fd, &columns[0], r->address, 8) != 0 ||
+          putColumn(fd, &columns[1], r->immediate, 8) != 0 ||
+          putColumn(fd, &columns[2], (uint64_t)(r->opcode << 4 | r->ifun), 1) != 0 ||
+          putColumn(fd, &columns[3], (uint64_t)(r->rA << 4 | r->rB), 1) != 0 ||
+          putColumn(fd, &columns[4], r->length, 1) != 0 ||
+          putColumn(fd, &columns[5], r->kind, 1) != 0 ||
+          putColumn(fd, &columns[6], r->flags, 1) != 0) {
+        free(columns);
+        return -1;
+      }
+    }
+  }
+  for (int c = 0; c < 7; c++) {
+    if (flushColumn(fd, &columns[c]) != 0) {
+      free(columns);
+      return -1;
+    }
+  }
+  free(columns);
+  return lseek(fd, offset, SEEK_SET) < 0 ? -1 : 0;
+}
+
+/* Write the decoded records of code[0..length), whose first byte lives at
+ * baseAddr, to fd as a binary record file with the given layout
+ * Returns 0 on success and -1 on failure (errno describes the failure)
+ */
+int writeRecordFile(int fd, const uint8_t *code, size_t length, unsigned long baseAddr, int layout) {
+  if (layout == RECORD_LAYOUT_COLUMNS) {
+    return writeColumns(fd, code, length, baseAddr);
+  }
+  return writeRows(fd, code, length, baseAddr);
+}
@@ -0,0 +1,45 @@
+/* This file contains the prototypes and constants needed to use the
+   routines defined in recordWriter.c, and describes the binary record
+   file they produce.
+
+   All integers are little endian. The file starts with a RECORD_HEADER_SIZE
+   byte header:
+     0  "Y86R"
+     4  uint16 version (RECORD_FILE_VERSION)
+     6  uint16 layout (RECORD_LAYOUT_ROWS or RECORD_LAYOUT_COLUMNS)
+     8  uint32 bytes per record (24 for rows, 21 for columns)
+     12 uint32 reserved, 0
+     16 uint64 record count, RECORD_COUNT_UNKNOWN if the output could not be rewound
+     24 uint64 address of the first decoded byte
+     32 uint64 number of bytes decoded
+     40 reserved up to RECORD_HEADER_SIZE, 0
+
+   There is one record per listing line: halts the listing leaves out are
+   not stored, the gap in the addresses stands for them.
+
+   Rows: count records of 24 bytes follow the header:
+     0 uint64 address, 8 uint64 immediate, 16 opcode (icode), 17 ifun,
+     18 rA, 19 rB, 20 length, 21 kind (a Y86Kind), 22 flags, 23 padding
+
+   Columns: count entries per array, the arrays one after the other:
+     uint64 addresses, uint64 immediates, uint8 first bytes (icode:ifun),
+     uint8 register bytes (rA:rB), uint8 lengths, uint8 kinds, uint8 flags
+*/
+
+#ifndef _RECORDWRITER_H_
+#define _RECORDWRITER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RECORD_HEADER_SIZE 64
+#define RECORD_FILE_VERSION 1
+#define RECORD_LAYOUT_ROWS 0
+#define RECORD_LAYOUT_COLUMNS 1
+#define RECORD_ROW_SIZE 24
+#define RECORD_COLUMNS_SIZE 21
+#define RECORD_COUNT_UNKNOWN UINT64_MAX
+
+int writeRecordFile(int fd, const uint8_t *code, size_t length, unsigned long baseAddr, int layout);
+
+#endif /* RECORDWRITER */
@@ -0,0 +1,208 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "regionCache.h"
+#include "inputMap.h"
+#include "printRoutines.h"
+
+/* The cache written by the previous run, if there is a usable one
+ */
+struct OldCache {
+  FILE *file;
+  struct InputMap map;
+  const struct CacheHeader *header;
+  const struct CacheBlock *blocks;
+};
+
+/* 64 bit hash of n bytes, eight at a time
+ * Not cryptographic; a collision would splice in stale text.
+ */
+static uint64_t hashBytes(const uint8_t *p, size_t n) {
+  uint64_t h = 0x9E3779B97F4A7C15ULL ^ n;
+
+  for (; n >= 8; p += 8, n -= 8) {
+    uint64_t word;
+    memcpy(&word, p, 8);
+    h = (h ^ word) * 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 32;
+  }
+  for (; n > 0; p++, n--) {
+    h = (h ^ *p) * 0xC4CEB9FE1A85EC53ULL;
+  }
+  return h ^ (h >> 29);
+}
+
+/* Hash of everything the listing of block b can depend on besides the entry state
+ */
+static uint64_t hashBlock(const uint8_t *code, size_t length, size_t b) {
+  size_t start = b * CACHE_BLOCK;
+  size_t end = length - start > CACHE_BLOCK + CACHE_OVERHANG ? start + CACHE_BLOCK + CACHE_OVERHANG : length;
+  return hashBytes(code + start, end - start);
+}
+
+/* Map the cache at path and check that it fits this image
+ * Returns 0 if old can be used and -1 (with old->header NULL) otherwise
+ */
+static int openOldCache(const char *path, unsigned long baseAddr, struct OldCache *old) {
+  memset(old, 0, sizeof(*old));
+  old->file = fopen(path, "rb");
+  if (old->file == NULL) {
+    return -1;
+  }
+  if (mapInput(old->file, &old->map) != 0) {
+    fclose(old->file);
+    old->file = NULL;
+    return -1;
+  }
+
+  const struct CacheHeader *header = (const struct CacheHeader *)old->map.data;
+  if (old->map.length < sizeof(*header) || memcmp(header->magic, CACHE_MAGIC, 8) != 0 ||
+      header->baseAddr != baseAddr || header->blockSize != CACHE_BLOCK ||
+      header->blockCount > (old->map.length - sizeof(*header)) / sizeof(struct CacheBlock)) {
+    return -1;
+  }
+  old->header = header;
+  old->blocks = (const struct CacheBlock *)(header + 1);
+  return 0;
+}
+
+static void closeOldCache(struct OldCache *old) {
+  if (old->file != NULL) {
+    unmapInput(&old->map);
+    fclose(old->file);
+  }
+}
+
+/* The cached text of block b if it can stand in for decoding the block
+ * from entry, NULL if the block has to be decoded
+ */
+static const struct CacheBlock *reusableBlock(const struct OldCache *old, size_t b, uint64_t hash, const struct DecodeState *entry) {
+  const struct CacheBlock *block;
+
+  if (old->header == NULL || b >= old->header->blockCount) {
+    return NULL;
+  }
+  block = &old->blocks[b];
+  if (block->hash != hash || block->entryPos != entry->pos - b * CACHE_BLOCK ||
+      block->entrySkipHalt != entry->skipHalt ||
+      block->textOffset > old->map.length || block->textLength > old->map.length - block->textOffset) {
+    return NULL;
+  }
+  return block;
+}
+
+/* pwrite all n bytes at offset
+ */
+static int pwriteAll(int fd, const void *data, size_t n, off_t offset) {
+  const char *p = data;
+  while (n > 0) {
+    ssize_t wrote = pwrite(fd, p, n, offset);
+    if (wrote < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    p += wrote;
+    n -= (size_t)wrote;
+    offset += wrote;
+  }
+  return 0;
+}
+
+/* Decode code[0..length) like decodeMachineCode, reusing the text of every
+ * CACHE_BLOCK block that is unchanged since the run that wrote cachePath
+ * A block is reused when its bytes (and the few after it an instruction
+ * could reach into) hash the same and decoding enters it at the same
+ * instruction boundary and halt state; everything else is decoded again.
+ * The new cache is written next to cachePath and renamed over it at the end.
+ * The cache only saves time: if it cannot be read it is ignored and if it
+ * cannot be written the listing is still complete.
+ * Returns 0 on success and -1 if the listing could not be produced
+ */
+int decodeIncremental(struct OutBuffer *out, const uint8_t *code, size_t length, unsigned long baseAddr, const char *cachePath) {
+  struct OldCache old;
+  struct CacheHeader header;
+  struct CacheBlock *blocks;
+  struct DecodeState state = {0, 1};
+  struct OutBuffer text;
+  size_t blockCount = (length + CACHE_BLOCK - 1) / CACHE_BLOCK;
+  size_t tmpLength = strlen(cachePath) + 5;
+  char *tmpPath = malloc(tmpLength);
+  off_t textOffset = (off_t)(sizeof(header) + blockCount * sizeof(*blocks));
+  int fd = -1;
+
+  blocks = calloc(blockCount + 1, sizeof(*blocks));
+  if (tmpPath == NULL || blocks == NULL || openOutBuffer(&text, -1, 4 * CACHE_BLOCK) != 0) {
+    free(tmpPath);
+    free(blocks);
+    return -1;
+  }
+  openOldCache(cachePath, baseAddr, &old);
+  snprintf(tmpPath, tmpLength, "%s.tmp", cachePath);
+  fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+  for (size_t b = 0; b < blockCount; b++) {
+    size_t stop = length - b * CACHE_BLOCK > CACHE_BLOCK ? (b + 1) * CACHE_BLOCK : length;
+    uint64_t hash = hashBlock(code, length, b);
+    const struct CacheBlock *cached = reusableBlock(&old, b, hash, &state);
+    const char *blockText;
+    size_t blockLength;
+
+    blocks[b].hash = hash;
+    blocks[b].entryPos = (uint32_t)(state.pos - b * CACHE_BLOCK);
+    blocks[b].entrySkipHalt = (uint8_t)state.skipHalt;
+    if (cached != NULL) {
+      blockText = (const char *)old.map.data + cached->textOffset;
+      blockLength = cached->textLength;
+      state.pos = b * CACHE_BLOCK + cached->exitPos;
+      state.skipHalt = cached->exitSkipHalt;
+    }
+    else {
+      text.length = 0;
+      decodeRange(&text, code, length, baseAddr, &state, stop);
+      blockText = text.data;
+      blockLength = text.length;
+    }
+    blocks[b].exitPos = (uint32_t)(state.pos - b * CACHE_BLOCK);
+    blocks[b].exitSkipHalt = (uint8_t)state.skipHalt;
+    blocks[b].textOffset = (uint64_t)textOffset;
+    blocks[b].textLength = blockLength;
+
+    writeOut(out, blockText, blockLength);
+    if (fd >= 0 && pwriteAll(fd, blockText, blockLength, textOffset) != 0) {
+      close(fd);
+      fd = -1;
+      unlink(tmpPath);
+    }
+    textOffset += (off_t)blockLength;
+  }
+
+  if (fd >= 0) {
+    memcpy(header.magic, CACHE_MAGIC, 8);
+    header.baseAddr = baseAddr;
+    header.length = length;
+    header.blockSize = CACHE_BLOCK;
+    header.blockCount = blockCount;
+    int failed = pwriteAll(fd, &header, sizeof(header), 0) != 0 ||
+                 pwriteAll(fd, blocks, blockCount * sizeof(*blocks), sizeof(header)) != 0;
+    if (close(fd) != 0 || failed || rename(tmpPath, cachePath) != 0) {
+      unlink(tmpPath);
+    }
+  }
+
+  closeOldCache(&old);
+  closeOutBuffer(&text);
+  free(blocks);
+  free(tmpPath);
+  if (out->error != 0) {
+    errno = out->error;
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,46 @@
+/* This file contains the prototypes and constants needed to use the
+   routines defined in regionCache.c, and describes the cache file.
+
+   The cache file is only ever read back by the same build on the same
+   machine, so it is written in native byte order:
+     struct CacheHeader
+     struct CacheBlock, header.blockCount of them
+     the listing text of every block, one after the other
+   Block i covers the instructions starting in image bytes
+   [i * CACHE_BLOCK, (i + 1) * CACHE_BLOCK).
+*/
+
+#ifndef _REGIONCACHE_H_
+#define _REGIONCACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "outBuffer.h"
+
+#define CACHE_BLOCK (1 << 16)   //Image bytes per cached block
+#define CACHE_OVERHANG 16       //Bytes past a block its last instruction may read (at most 9)
+#define CACHE_MAGIC "Y86CACH1"
+
+struct CacheHeader {
+  char magic[8];       //CACHE_MAGIC
+  uint64_t baseAddr;   //Address of the first image byte, the text depends on it
+  uint64_t length;     //Image length
+  uint64_t blockSize;  //CACHE_BLOCK
+  uint64_t blockCount;
+};
+
+//What decoding one block looked like
+struct CacheBlock {
+  uint64_t hash;        //Of the block's bytes and its overhang
+  uint64_t textOffset;  //Of the block's listing, from the start of the file
+  uint64_t textLength;
+  uint32_t entryPos;    //Where the first instruction starts, from the block start
+  uint32_t exitPos;     //Where the first instruction of the next block starts, from the block start
+  uint8_t entrySkipHalt;
+  uint8_t exitSkipHalt;
+  uint8_t padding[6];
+};
+
+int decodeIncremental(struct OutBuffer *out, const uint8_t *code, size_t length, unsigned long baseAddr, const char *cachePath);
+
+#endif /* REGIONCACHE */
@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include "machineSim.h"
+#include "inputMap.h"
+
+#define ERROR_RETURN -1
+#define SUCCESS 0
+#define DEFAULT_STEPS 100000000UL
+
+int main(int argc, char **argv) {
+
+  FILE *machineCode;
+  struct InputMap map;
+  struct Machine machine;
+  unsigned long maxSteps = DEFAULT_STEPS;
+  char *program = argv[0];
+
+  // Options come before the file name
+  while (argc > 1 && argv[1][0] == '-' && argv[1][1] != '\0') {
+    if (strcmp(argv[1], "-n") == 0 && argc > 2) {
+      char *end;
+      errno = 0;
+      maxSteps = strtoul(argv[2], &end, 0);
+      if (*end != '\0' || errno != 0 || maxSteps == 0) {
+        printf("Invalid step limit: %s\n", argv[2]);
+        return ERROR_RETURN;
+      }
+      argc -= 2;
+      argv += 2;
+    }
+    else {
+      printf("Unknown option: %s\n", argv[1]);
+      return ERROR_RETURN;
+    }
+  }
+
+  if (argc != 2) {
+    printf("Usage: %s [-n maxSteps] ImageFilename|-\n", program);
+    return ERROR_RETURN;
+  }
+
+  machineCode = strcmp(argv[1], "-") == 0 ? stdin : fopen(argv[1], "rb");
+  if (machineCode == NULL) {
+    printf("Failed to open %s: %s\n", argv[1], strerror(errno));
+    return ERROR_RETURN;
+  }
+  if (mapInput(machineCode, &map) != 0) {
+    printf("Failed to read %s: %s\n", argv[1], strerror(errno));
+    fclose(machineCode);
+    return ERROR_RETURN;
+  }
+  if (openMachine(&machine, map.data, map.length) != 0) {
+    printf("Failed to load %s: %s\n", argv[1], strerror(ENOMEM));
+    unmapInput(&map);
+    fclose(machineCode);
+    return ERROR_RETURN;
+  }
+
+  runMachine(&machine, maxSteps);
+  printMachine(stdout, &machine, map.data, map.length);
+
+  closeMachine(&machine);
+  unmapInput(&map);
+  fclose(machineCode);
+  return SUCCESS;
+}
@@ -0,0 +1,91 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "streamDecode.h"
+#include "inputMap.h"
+#include "printRoutines.h"
+
+/* read() until n bytes arrived or the input ended
+ * Returns the number of bytes read, or -1 on failure (errno is set)
+ */
+static ssize_t readFully(int fd, uint8_t *buffer, size_t n) {
+  size_t done = 0;
+  while (done < n) {
+    ssize_t got = read(fd, buffer + done, n - done);
+    if (got < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    if (got == 0) {
+      break;
+    }
+    done += (size_t)got;
+  }
+  return (ssize_t)done;
+}
+
+/* Decode the bytes [startingOffset, endOffset) of the stream read from fd
+ * (endOffset may be INPUT_TO_END) with memory bounded by STREAM_BUFFER
+ * The buffer is decoded up to STREAM_MARGIN bytes before its end; the bytes
+ * from the next instruction on are carried over to the front and the rest
+ * refilled, so instructions that straddle a refill decode as in a file and
+ * the truncation fallback only ever applies at the real end of the input.
+ * Returns 0 on success and -1 on failure (errno describes the failure)
+ */
+int decodeStream(struct OutBuffer *out, int fd, unsigned long startingOffset, unsigned long endOffset) {
+  uint8_t *buffer = malloc(STREAM_BUFFER);
+  struct DecodeState state = {0, 1};
+  unsigned long bufferAddr = startingOffset; //Address of buffer[0]
+  unsigned long remaining = endOffset - startingOffset;
+  size_t filled = 0;
+  int ended = 0;
+
+  if (buffer == NULL) {
+    return -1;
+  }
+  //Discard everything before the window
+  for (unsigned long skipped = 0; skipped < startingOffset; ) {
+    size_t want = startingOffset - skipped < STREAM_BUFFER ? (size_t)(startingOffset - skipped) : STREAM_BUFFER;
+    ssize_t got = readFully(fd, buffer, want);
+    if (got < 0) {
+      free(buffer);
+      return -1;
+    }
+    if (got == 0) {
+      remaining = 0; //The window starts past the end
+      break;
+    }
+    skipped += (unsigned long)got;
+  }
+
+  while (!ended) {
+    size_t want = STREAM_BUFFER - filled < remaining ? STREAM_BUFFER - filled : (size_t)remaining;
+    ssize_t got = readFully(fd, buffer + filled, want);
+    if (got < 0) {
+      free(buffer);
+      return -1;
+    }
+    filled += (size_t)got;
+    remaining -= (unsigned long)got;
+    ended = (filled < STREAM_BUFFER); //Short read: end of input or of the window
+
+    decodeRange(out, buffer, filled, bufferAddr, &state, ended ? filled : filled - STREAM_MARGIN);
+    if (!ended) {
+      memmove(buffer, buffer + state.pos, filled - state.pos);
+      filled -= state.pos;
+      bufferAddr += state.pos;
+      state.pos = 0;
+    }
+  }
+  free(buffer);
+  if (out->error != 0) {
+    errno = out->error;
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,15 @@
+/* This file contains the prototypes and constants needed to use the
+   routines defined in streamDecode.c
+*/
+
+#ifndef _STREAMDECODE_H_
+#define _STREAMDECODE_H_
+
+#include "outBuffer.h"
+
+#define STREAM_BUFFER (1 << 20) //Bytes of input held at a time
+#define STREAM_MARGIN 16        //Bytes kept back at a refill so no instruction is cut off (at most 10 are read)
+
+int decodeStream(struct OutBuffer *out, int fd, unsigned long startingOffset, unsigned long endOffset);
+
+#endif /* STREAMDECODE */